@@ -3,6 +3,10 @@
 #include <QtEndian>
 #include <QDebug>
 
+// Write cache of the context in qeficontext.cpp, every write path drops the
+// cached value
+void qefi_write_cache_forget(QEFIContext &context, const QUuid &uuid, const QString &name);
+
 #pragma pack(push, 1)
 struct qefi_load_option_header {
     quint32 attributes;
@@ -515,13 +519,13 @@ QByteArray qefi_format_dp(QEFIDevicePath *dp)
     return QByteArray();
 }
 
-#ifndef EFIVAR_APP_DATA_DUMMY
-#ifdef Q_OS_WIN
+#if defined(Q_OS_WIN) && !defined(EFIVAR_APP_DATA_DUMMY)
 /* Implementation based on Windows API */
 #include <Windows.h>
 #include <WinBase.h>
 #include <tchar.h>
 #include <wbemidl.h>
+#include <cerrno>
 
 DWORD ObtainPrivileges(LPCTSTR privilege) {
     HANDLE hToken;
@@ -545,18 +549,6 @@ DWORD ObtainPrivileges(LPCTSTR privilege) {
     return GetLastError();
 }
 
-bool qefi_is_available()
-{
-    FIRMWARE_TYPE fType;
-    BOOL status = GetFirmwareType(&fType);
-    return status && fType == FirmwareTypeUefi;
-}
-
-bool qefi_has_privilege()
-{
-    return ObtainPrivileges(SE_SYSTEM_ENVIRONMENT_NAME) == ERROR_SUCCESS;
-}
-
 DWORD read_efivar_win(LPCTSTR name, LPCTSTR uuid, PVOID buffer, DWORD size)
 {
     DWORD len = GetFirmwareEnvironmentVariable(name, uuid, buffer, size);
@@ -580,110 +572,232 @@ DWORD write_efivar_win(LPCTSTR name, LPCTSTR uuid, PVOID buffer, DWORD size)
 }
 
 #define EFIVAR_BUFFER_SIZE 4096
+// Largest variable read, the API cannot report the size of a variable
+#define EFIVAR_MAX_BUFFER_SIZE (1024 * 1024)
 
-quint16 qefi_get_variable_uint16(QUuid uuid, QString name)
-{
 #ifdef UNICODE
-    std::wstring std_name = name.toStdWString();
-    std::wstring std_uuid = uuid.toString(QUuid::WithBraces).toStdWString();
+typedef std::wstring qefi_win_string;
+static inline qefi_win_string qefi_win_str(const QString &str)
+{
+    return str.toStdWString();
+}
 #else
-    std::string std_name = name.toStdString();
-    std::string std_uuid = uuid.toString(QUuid::WithBraces).toStdString();
+typedef std::string qefi_win_string;
+static inline qefi_win_string qefi_win_str(const QString &str)
+{
+    return str.toStdString();
+}
 #endif
-    LPCTSTR c_name = std_name.c_str();
-    LPCTSTR c_uuid = std_uuid.c_str();
-
-    // Create a buffer
-    TCHAR buffer[EFIVAR_BUFFER_SIZE];
 
-    size_t length = read_efivar_win(c_name, c_uuid, (PVOID)buffer, EFIVAR_BUFFER_SIZE);
-
-    if (length < 2)
+static int qefi_win_error_code(DWORD errorCode)
+{
+    switch (errorCode)
     {
-        return 0;
+        case ERROR_ENVVAR_NOT_FOUND:
+            return -ENOENT;
+        case ERROR_PRIVILEGE_NOT_HELD:
+            return -EPERM;
+        case ERROR_INSUFFICIENT_BUFFER:
+            return -ENOBUFS;
+        case ERROR_INVALID_PARAMETER:
+            return -EINVAL;
     }
+    return -EIO;
+}
+
+// Firmware variables through GetFirmwareEnvironmentVariableEx()
+class QEFIWin32Backend : public QEFIBackend
+{
+public:
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+};
 
-    // Read as uint16, platform-independant
-    quint16 value = *((quint16 *)buffer);
+bool QEFIWin32Backend::isAvailable()
+{
+    FIRMWARE_TYPE fType;
+    BOOL status = GetFirmwareType(&fType);
+    return status && fType == FirmwareTypeUefi;
+}
 
-    return qFromLittleEndian<quint16>(value);
+bool QEFIWin32Backend::hasPrivilege()
+{
+    return ObtainPrivileges(SE_SYSTEM_ENVIRONMENT_NAME) == ERROR_SUCCESS;
 }
 
-QByteArray qefi_get_variable(QUuid uuid, QString name)
+int QEFIWin32Backend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
 {
-#ifdef UNICODE
-    std::wstring std_name = name.toStdWString();
-    std::wstring std_uuid = uuid.toString(QUuid::WithBraces).toStdWString();
-#else
-    std::string std_name = name.toStdString();
-    std::string std_uuid = uuid.toString(QUuid::WithBraces).toStdString();
-#endif
-    LPCTSTR c_name = std_name.c_str();
-    LPCTSTR c_uuid = std_uuid.c_str();
+    qefi_win_string std_name = qefi_win_str(name);
+    qefi_win_string std_uuid = qefi_win_str(uuid.toString(QUuid::WithBraces));
+
+    // Grow the buffer until the variable fits
+    for (DWORD size = EFIVAR_BUFFER_SIZE; size <= EFIVAR_MAX_BUFFER_SIZE; size *= 2)
+    {
+        data.resize((int)size);
+        DWORD attrs = 0;
+        DWORD length = GetFirmwareEnvironmentVariableEx(std_name.c_str(),
+            std_uuid.c_str(), (PVOID)data.data(), size, &attrs);
+        if (length > 0)
+        {
+            data.resize((int)length);
+            if (attributes) *attributes = attrs;
+            return 0;
+        }
 
-    // Create a buffer
-    size_t skip = sizeof(TCHAR) / sizeof(quint8);
-    TCHAR buffer[EFIVAR_BUFFER_SIZE];
+        DWORD errorCode = GetLastError();
+        if (errorCode != ERROR_INSUFFICIENT_BUFFER)
+        {
+            data.clear();
+            return qefi_win_error_code(errorCode);
+        }
+    }
+    data.clear();
+    return -ENOBUFS;
+}
 
-    size_t length = read_efivar_win(c_name, c_uuid, (PVOID)buffer, EFIVAR_BUFFER_SIZE);
+int QEFIWin32Backend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    qefi_win_string std_name = qefi_win_str(name);
+    qefi_win_string std_uuid = qefi_win_str(uuid.toString(QUuid::WithBraces));
 
-    QByteArray value;
-    if (length == 0)
+    if (!SetFirmwareEnvironmentVariableEx(std_name.c_str(), std_uuid.c_str(),
+        (PVOID)data.constData(), data.size(), attributes))
     {
-        value.clear();
+        return qefi_win_error_code(GetLastError());
     }
-    else
+    return 0;
+}
+
+int QEFIWin32Backend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    qefi_win_string std_name = qefi_win_str(name);
+    qefi_win_string std_uuid = qefi_win_str(uuid.toString(QUuid::WithBraces));
+
+    // Writing an empty variable deletes it
+    if (!SetFirmwareEnvironmentVariable(std_name.c_str(), std_uuid.c_str(), NULL, 0))
     {
-        for (size_t i = 0; i < (length + skip - 1) / skip; i++) {
-            for (size_t j = 0; j < skip; j++) {
-                const quint8 byte = (quint8)((buffer[i] & (0xFF << (8 * j))) >> (8 * j));
-                value.append(byte);
-            }
-        }
+        return qefi_win_error_code(GetLastError());
     }
-
-    return value;
+    return 0;
 }
 
-void qefi_set_variable_uint16(QUuid uuid, QString name, quint16 value)
-{
-#ifdef UNICODE
-    std::wstring std_name = name.toStdWString();
-    std::wstring std_uuid = uuid.toString(QUuid::WithBraces).toStdWString();
-#else
-    std::string std_name = name.toStdString();
-    std::string std_uuid = uuid.toString(QUuid::WithBraces).toStdString();
-#endif
-    LPCTSTR c_name = std_name.c_str();
-    LPCTSTR c_uuid = std_uuid.c_str();
+/*
+ * Win32 has no documented call to enumerate firmware variables, ntdll
+ * exports one since Windows 8. The name class is enough unless the sizes
+ * are wanted, the value class then returns the data as well.
+ */
+#define QEFI_NT_NAME_INFORMATION        1
+#define QEFI_NT_VALUE_INFORMATION       2
+#define QEFI_NT_STATUS_BUFFER_TOO_SMALL ((LONG)0xC0000023)
+#define QEFI_NT_STATUS_NOT_IMPLEMENTED  ((LONG)0xC0000002)
+#define QEFI_NT_STATUS_ACCESS_DENIED    ((LONG)0xC0000022)
+#define QEFI_NT_STATUS_PRIVILEGE_NOT_HELD ((LONG)0xC0000061)
 
-    // Create a buffer
-    TCHAR buffer[sizeof(quint16) / sizeof(TCHAR)];
-    quint16 *p = (quint16 *)buffer;
-    *p = qToLittleEndian<quint16>(value);
+typedef LONG (WINAPI *qefi_nt_enumerate_t)(ULONG, PVOID, PULONG);
 
-    write_efivar_win(c_name, c_uuid, (PVOID)buffer, 2);
-}
+struct qefi_nt_variable_name
+{
+    ULONG NextEntryOffset;
+    GUID VendorGuid;
+    WCHAR Name[1];
+};
 
-void qefi_set_variable(QUuid uuid, QString name, QByteArray value)
+struct qefi_nt_variable_name_and_value
 {
-#ifdef UNICODE
-    std::wstring std_name = name.toStdWString();
-    std::wstring std_uuid = uuid.toString(QUuid::WithBraces).toStdWString();
-#else
-    std::string std_name = name.toStdString();
-    std::string std_uuid = uuid.toString(QUuid::WithBraces).toStdString();
-#endif
-    LPCTSTR c_name = std_name.c_str();
-    LPCTSTR c_uuid = std_uuid.c_str();
+    ULONG NextEntryOffset;
+    ULONG ValueOffset;
+    ULONG ValueLength;
+    ULONG Attributes;
+    GUID VendorGuid;
+    WCHAR Name[1];
+};
+
+static int qefi_nt_error_code(LONG status)
+{
+    switch (status)
+    {
+        case QEFI_NT_STATUS_ACCESS_DENIED:
+        case QEFI_NT_STATUS_PRIVILEGE_NOT_HELD:
+            return -EPERM;
+        case QEFI_NT_STATUS_NOT_IMPLEMENTED:
+            return -ENOSYS;
+    }
+    return -EIO;
+}
+
+int QEFIWin32Backend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    static const qefi_nt_enumerate_t enumerate = (qefi_nt_enumerate_t)GetProcAddress(
+        GetModuleHandle(TEXT("ntdll.dll")), "NtEnumerateSystemEnvironmentValuesEx");
+    if (!enumerate)
+        return -ENOSYS;
+
+    const ULONG information = sizes ? QEFI_NT_VALUE_INFORMATION : QEFI_NT_NAME_INFORMATION;
+    QByteArray buffer;
+    ULONG length = EFIVAR_BUFFER_SIZE;
+    LONG status;
+    do {
+        // The required length is returned when the buffer is too small
+        buffer.resize((int)length);
+        status = enumerate(information, buffer.data(), &length);
+    } while (status == QEFI_NT_STATUS_BUFFER_TOO_SMALL && length > (ULONG)buffer.size());
+    if (status < 0)
+        return qefi_nt_error_code(status);
+
+    for (ULONG offset = 0; offset < length;)
+    {
+        const char *entry = buffer.constData() + offset;
+        ULONG next, size = 0;
+        GUID guid;
+        const WCHAR *name;
+        if (sizes)
+        {
+            const qefi_nt_variable_name_and_value *value =
+                (const qefi_nt_variable_name_and_value *)entry;
+            next = value->NextEntryOffset;
+            size = value->ValueLength;
+            guid = value->VendorGuid;
+            name = value->Name;
+        }
+        else
+        {
+            const qefi_nt_variable_name *value = (const qefi_nt_variable_name *)entry;
+            next = value->NextEntryOffset;
+            guid = value->VendorGuid;
+            name = value->Name;
+        }
+
+        const QUuid entry_uuid(guid);
+        const QString entry_name = QString::fromWCharArray(name);
+        if ((!uuid || *uuid == entry_uuid) && entry_name.startsWith(prefix))
+        {
+            variables.append(QEFIVariableKey(entry_uuid, entry_name));
+            if (sizes) sizes->append(size);
+        }
 
-    write_efivar_win(c_name, c_uuid, (PVOID)value.data(), value.size());
+        if (next == 0)
+            break;
+        offset += next;
+    }
+    return 0;
 }
 
-#else
+#elif !defined(Q_OS_WIN)
 extern "C" {
 #include <unistd.h>
 }
+#include <cerrno>
 /* Implementation based on libefivar */
 #define EFI_VARIABLE_NON_VOLATILE				((uint64_t)0x0000000000000001)
 #define EFI_VARIABLE_BOOTSERVICE_ACCESS				((uint64_t)0x0000000000000002)
@@ -698,13 +812,21 @@ extern "C" {
 #include <QFile>
 #include <QFileInfo>
 
+// Negative errno of a failed qefivar_* call
+static inline int qefivar_error_code(void)
+{
+    return errno > 0 ? -errno : -EIO;
+}
+
 /* Get rid of efivar */
-#if defined(Q_OS_FREEBSD)
+#if defined(Q_OS_FREEBSD) && !defined(EFIVAR_APP_DATA_DUMMY)
 
 extern "C" {
 // Use FreeBSD system-level libefivar
 #include <efivar.h>
 }
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 
 int qefivar_variables_supported(void)
@@ -712,7 +834,8 @@ int qefivar_variables_supported(void)
     return efi_variables_supported();
 }
 
-static int qefivar_get_variable_size(const QUuid &uuid, const QString &name, size_t *size)
+static int qefivar_get_variable(const QUuid &uuid, const QString &name,
+    QByteArray &data, uint32_t *attributes)
 {
     int return_code;
 
@@ -727,12 +850,22 @@ static int qefivar_get_variable_size(const QUuid &uuid, const QString &name, siz
     {
         return return_code;
     }
-    return_code = efi_get_variable_size(guid, c_name, size);
 
+    uint8_t *temp_data;
+    size_t size = 0;
+    return_code = efi_get_variable(guid, c_name, &temp_data, &size, attributes);
+    if (return_code < 0)
+    {
+        return return_code;
+    }
+
+    // The buffer belongs to libefivar, copy it once
+    data = QByteArray((const char *)temp_data, (int)size);
     return 0;
 }
 
-static int qefivar_get_variable(QUuid &uuid, QString &name, uint8_t **data, size_t *size, uint32_t *attributes)
+static int qefivar_get_variable_into(const QUuid &uuid, const QString &name,
+    uint8_t *buffer, size_t capacity, size_t *size, uint32_t *attributes)
 {
     int return_code;
 
@@ -748,26 +881,14 @@ static int qefivar_get_variable(QUuid &uuid, QString &name, uint8_t **data, size
         return return_code;
     }
 
-    return_code = efi_get_variable_size(guid, c_name, size);
-    if (*size == 0 || return_code < 0)
-    {
-        return return_code;
-    }
-
     uint8_t *temp_data;
     return_code = efi_get_variable(guid, c_name, &temp_data, size, attributes);
-    if (*size == 0 || return_code < 0)
-    {
-        return return_code;
-    }
-    // Allocate to have the same behaviour with Linux efivar
-    *data = (uint8_t *)malloc(*size);
-    std::memcpy(*data, temp_data, *size);
-
     if (return_code < 0)
     {
         return return_code;
     }
+
+    std::memcpy(buffer, temp_data, *size < capacity ? *size : capacity);
     return 0;
 }
 
@@ -799,130 +920,370 @@ static int qefivar_set_variable(const QUuid &uuid, const QString &name, uint8_t
     return 0;
 }
 
-#else
+static int qefivar_del_variable(const QUuid &uuid, const QString &name)
+{
+    int return_code;
+
+    std::string std_name = name.toStdString();
+    const char *c_name = std_name.c_str();
+    std::string std_uuid = uuid.toString(QUuid::WithoutBraces).toStdString();
+    const char *c_uuid = std_uuid.c_str();
+
+    efi_guid_t guid;
+    return_code = efi_str_to_guid(c_uuid, &guid);
+    if (return_code < 0)
+    {
+        return return_code;
+    }
+
+    return efi_del_variable(guid, c_name);
+}
+
+static int qefivar_list_variables(const QUuid *uuid, const QByteArray &prefix,
+    QList<QEFIVariableKey> &variables, QList<quint64> *sizes = nullptr)
+{
+    int return_code;
+    efi_guid_t *guid = NULL;
+    char *c_name = NULL;
+
+    // libefivar walks the whole store for us, one name per call
+    while ((return_code = efi_get_next_variable_name(&guid, &c_name)) > 0)
+    {
+        if (strncmp(c_name, prefix.constData(), prefix.size()) != 0)
+            continue;
+
+        char *c_uuid = NULL;
+        if (efi_guid_to_str(guid, &c_uuid) < 0 || c_uuid == NULL)
+            continue;
+        QUuid entry_uuid = QUuid::fromString(QLatin1String(c_uuid));
+        free(c_uuid);
+        if (uuid && *uuid != entry_uuid)
+            continue;
+
+        if (sizes)
+        {
+            size_t size = 0;
+            if (efi_get_variable_size(*guid, c_name, &size) < 0)
+                continue;
+            sizes->append(size);
+        }
+        variables.append(QEFIVariableKey(entry_uuid, QString::fromUtf8(c_name)));
+    }
+
+    return return_code;
+}
+
+// Firmware variables through the libefivar of the base system
+class QEFILibefivarBackend : public QEFIBackend
+{
+public:
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int getVariableInto(const QUuid &uuid, const QString &name,
+        char *buffer, size_t capacity, size_t *size, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+};
+
+bool QEFILibefivarBackend::isAvailable()
+{
+    return qefivar_variables_supported();
+}
+
+bool QEFILibefivarBackend::hasPrivilege()
+{
+    return getuid() == 0;
+}
+
+int QEFILibefivarBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    uint32_t attrs = 0;
+    if (qefivar_get_variable(uuid, name, data, &attrs) < 0)
+        return qefivar_error_code();
+    if (attributes) *attributes = attrs;
+    return 0;
+}
+
+int QEFILibefivarBackend::getVariableInto(const QUuid &uuid, const QString &name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes)
+{
+    uint32_t attrs = 0;
+    if (qefivar_get_variable_into(uuid, name, (uint8_t *)buffer, capacity,
+            size, &attrs) < 0)
+        return qefivar_error_code();
+    if (attributes) *attributes = attrs;
+    return 0;
+}
+
+int QEFILibefivarBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    if (qefivar_set_variable(uuid, name, (uint8_t *)data.constData(), data.size(),
+            attributes, 0644) < 0)
+        return qefivar_error_code();
+    return 0;
+}
+
+int QEFILibefivarBackend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    if (qefivar_del_variable(uuid, name) < 0)
+        return qefivar_error_code();
+    return 0;
+}
+
+int QEFILibefivarBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    if (qefivar_list_variables(uuid, prefix.toUtf8(), variables, sizes) < 0)
+        return qefivar_error_code();
+    return 0;
+}
+
+#elif defined(Q_OS_LINUX)
 extern "C" {
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <linux/fs.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/vfs.h>
 }
 
+#include <QHash>
+
 static QString const default_efivarfs_path = QStringLiteral("/sys/firmware/efi/efivars/");
-static QString efivarfs_path;
 
-static QString get_efivarfs_path(void)
+QString get_efivarfs_path(void)
 {
-    // Cached path
-    if (efivarfs_path.size() > 0)
-    {
-        return efivarfs_path;
-    }
-
-    QString efivarfs_path_from_env = qgetenv("EFIVARFS_PATH");
-    if (efivarfs_path_from_env.size() > 0)
-    {
-        efivarfs_path = efivarfs_path_from_env;
-    }
-    else
-    {
-        efivarfs_path = default_efivarfs_path;
-    }
+    // Cached path, initialized once even when first called from several threads
+    static const QString efivarfs_path = []() {
+        QString efivarfs_path_from_env = qgetenv("EFIVARFS_PATH");
+        if (efivarfs_path_from_env.size() > 0)
+        {
+            return efivarfs_path_from_env;
+        }
+        return default_efivarfs_path;
+    }();
 
     return efivarfs_path;
 }
 
-int qefivar_variables_supported(void)
+// Encoded "-<GUID>" suffix, kept per thread for the GUIDs already seen
+static const QByteArray &efivarfs_guid_suffix(const QUuid &guid)
 {
-    QFileInfo fileInfo(get_efivarfs_path());
-    if (!fileInfo.exists() || !fileInfo.isDir())
-        return 0;
-    return 1;
-}
+    static thread_local QHash<QUuid, QByteArray> suffixes;
 
-static QString make_efivarfs_path(const QUuid &guid, const QString &name)
-{
-    return QString("%1%2-%3").arg(get_efivarfs_path()).arg(name).arg(guid.toString(QUuid::WithoutBraces));
+    QHash<QUuid, QByteArray>::const_iterator it = suffixes.constFind(guid);
+    if (it != suffixes.constEnd())
+        return it.value();
+
+    QByteArray suffix = '-' + guid.toByteArray(QUuid::WithoutBraces);
+    return suffixes.insert(guid, suffix).value();
 }
 
-static int qefivar_efivarfs_get_variable_size(const QUuid &guid, const QString &name, size_t *size)
+// Fill entry with "<Name>-<GUID>", relative to the efivarfs root.
+// The array keeps its capacity, so a reused one does not allocate.
+void make_efivarfs_name(const QUuid &guid, const QString &name, QByteArray &entry)
 {
-    int ret = -1;
-    const QString &path = make_efivarfs_path(guid, name);
-    QFileInfo fileInfo(path);
-    if (!fileInfo.exists())
+    const QByteArray &suffix = efivarfs_guid_suffix(guid);
+    const int name_size = name.size();
+
+    entry.resize(name_size + suffix.size());
+    char *out = entry.data();
+    const QChar *in = name.constData();
+    for (int i = 0; i < name_size; i++)
     {
-        qCritical() << "stat(" << path << ") failed";
-        return ret;
+        // Variable names are ASCII in practice, encode the others properly
+        if (in[i].unicode() >= 0x80)
+        {
+            entry = QFile::encodeName(name) + suffix;
+            return;
+        }
+        out[i] = (char)in[i].unicode();
     }
-
-    ret = 0;
-    // Compensate for the size of the Attributes field.
-    *size = fileInfo.size() - sizeof(uint32_t);
-
-    return ret;
+    memcpy(out + name_size, suffix.constData(), suffix.size());
 }
 
-static int inline qefivar_get_variable_size(const QUuid &guid, const QString &name, size_t *size)
+// Entry name in a buffer reused by the calling thread
+static const char *efivarfs_name(const QUuid &guid, const QString &name)
 {
-    return qefivar_efivarfs_get_variable_size(guid, name, size);
+    static thread_local QByteArray entry;
+    if (entry.capacity() == 0)
+        entry.reserve(128);
+    make_efivarfs_name(guid, name, entry);
+    return entry.constData();
 }
 
-static int qefivar_efivarfs_get_variable(QUuid &guid, QString &name, uint8_t **data, size_t *size, uint32_t *attributes)
+/*
+ * efivarfs fetches the whole variable from the firmware on every read(2),
+ * and readv(2) is split into one read per segment since efivarfs has no
+ * read_iter. So the Attributes field and the data are always read at once,
+ * with one contiguous read.
+ */
+static int qefivar_efivarfs_get_variable(int dirfd, const QUuid &guid,
+    const QString &name, QByteArray &data, uint32_t *attributes)
 {
-    int ret = -1;
+    __typeof__(errno) errno_value;
+    struct stat st;
+    ssize_t rc = -1;
 
-    const QString &path = make_efivarfs_path(guid, name);
-    QFile file(path);
-    if (!file.open(QIODevice::ReadOnly))
+    const char *path = efivarfs_name(guid, name);
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
         qCritical() << "open(" << path << ") failed";
-        return ret;
+        return -1;
     }
 
-    // Read the Attributes field.
-    if (file.read((char *)attributes, sizeof(uint32_t)) != sizeof(uint32_t))
+    if (fstat(fd, &st) < 0)
     {
-        qCritical() << "read(" << path << ") failed";
-        return ret;
+        qCritical() << "fstat(" << path << ") failed";
+        goto err;
     }
-
-    // Compensate for the size of the Attributes field.
-    *size = file.size() - sizeof(uint32_t);
-
-    *data = (uint8_t *)malloc(*size);
-    if (!*data)
+    if (st.st_size < (off_t)sizeof(uint32_t))
     {
-        qCritical() << "malloc(" << *size << ") failed";
-        return ret;
+        errno = EINVAL;
+        goto err;
     }
 
-    if (file.read((char *)*data, *size) != *size)
+    // Read straight into the array, then drop the Attributes field in place
+    data.resize((int)st.st_size);
+    rc = read(fd, data.data(), data.size());
+    if (rc < (ssize_t)sizeof(uint32_t))
     {
         qCritical() << "read(" << path << ") failed";
-        free(*data);
-        return ret;
+        if (rc >= 0) errno = EIO;
+        rc = -1;
+        data.clear();
+        goto err;
     }
+    memcpy(attributes, data.constData(), sizeof(uint32_t));
+    // The variable may have shrunk since fstat(2)
+    data.resize((int)rc);
+    data.remove(0, sizeof(uint32_t));
 
-    ret = 0;
+err:
+    errno_value = errno;
+    close(fd);
+    errno = errno_value;
 
-    return ret;
+    return rc < 0 ? -1 : 0;
 }
 
-static int inline qefivar_get_variable(QUuid &guid, QString &name, uint8_t **data, size_t *size, uint32_t *attributes)
+#define QEFI_EFIVARFS_STACK_BUFFER_SIZE 4096
+// A scratch buffer grown past this is released after the read
+#define QEFI_EFIVARFS_SCRATCH_KEEP_SIZE 65536
+
+static int qefivar_efivarfs_get_variable_into(int dirfd, const QUuid &guid,
+    const QString &name, uint8_t *buffer, size_t capacity, size_t *size,
+    uint32_t *attributes)
 {
-    return qefivar_efivarfs_get_variable(guid, name, data, size, attributes);
+    __typeof__(errno) errno_value;
+    struct stat st;
+    ssize_t rc;
+
+    const char *path = efivarfs_name(guid, name);
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        qCritical() << "open(" << path << ") failed";
+        return -1;
+    }
+
+    // The Attributes field comes first, so read through a scratch buffer
+    // that is reused by the thread once grown. Beyond the stack buffer the
+    // read is sized by the variable rather than by the capacity, with one
+    // byte more to tell a variable that grew since fstat(2).
+    static thread_local QByteArray scratch;
+    char stack_buffer[QEFI_EFIVARFS_STACK_BUFFER_SIZE];
+    char *read_buffer = stack_buffer;
+    size_t read_size;
+    bool sized_by_variable = false;
+    if (capacity <= sizeof(stack_buffer) - sizeof(uint32_t))
+    {
+        read_size = capacity + sizeof(uint32_t);
+    }
+    else
+    {
+        if (fstat(fd, &st) < 0)
+        {
+            qCritical() << "fstat(" << path << ") failed";
+            rc = -1;
+            goto err;
+        }
+        if (st.st_size >= INT_MAX)
+        {
+            errno = EOVERFLOW;
+            rc = -1;
+            goto err;
+        }
+        read_size = st.st_size + 1;
+        sized_by_variable = true;
+        if (read_size > sizeof(uint32_t) && read_size - sizeof(uint32_t) > capacity)
+        {
+            read_size = capacity + sizeof(uint32_t);
+            sized_by_variable = false;
+        }
+        if (read_size > sizeof(stack_buffer))
+        {
+            if ((size_t)scratch.size() < read_size)
+                scratch.resize((int)read_size);
+            read_buffer = scratch.data();
+        }
+    }
+
+    rc = read(fd, read_buffer, read_size);
+    if (rc < (ssize_t)sizeof(uint32_t))
+    {
+        qCritical() << "read(" << path << ") failed";
+        if (rc >= 0) errno = EIO;
+        rc = -1;
+    }
+    else if (sized_by_variable && (size_t)rc == read_size)
+    {
+        // Written meanwhile, what was read may be cut short
+        errno = EAGAIN;
+        rc = -1;
+    }
+    else
+    {
+        memcpy(attributes, read_buffer, sizeof(uint32_t));
+        *size = rc - sizeof(uint32_t);
+        memcpy(buffer, read_buffer + sizeof(uint32_t), *size);
+        // Only a full buffer may hide a larger variable
+        if (*size == capacity && fstat(fd, &st) == 0 &&
+            st.st_size > (off_t)sizeof(uint32_t))
+            *size = st.st_size - sizeof(uint32_t);
+    }
+    if (scratch.size() > QEFI_EFIVARFS_SCRATCH_KEEP_SIZE)
+        scratch = QByteArray();
+
+err:
+    errno_value = errno;
+    close(fd);
+    errno = errno_value;
+
+    return rc < 0 ? -1 : 0;
 }
 
 static int
-qefivar_efivarfs_del_variable(const QUuid &guid, const QString &name)
+qefivar_efivarfs_del_variable(int dirfd, const QUuid &guid, const QString &name)
 {
-    const QString &rawPath = make_efivarfs_path(guid, name);
-    const char *path = rawPath.toLocal8Bit().constData();
-
-    int rc = unlink(path);
+    int rc = unlinkat(dirfd, efivarfs_name(guid, name), 0);
 
     typeof(errno) errno_value = errno;
     errno = errno_value;
@@ -930,17 +1291,23 @@ qefivar_efivarfs_del_variable(const QUuid &guid, const QString &name)
     return rc;
 }
 
+#define EFIVARFS_MAGIC 0xde5e81e4
+
+// is_efivarfs is false when the root is a plain directory, for testing
 static int
-qefivar_efivarfs_set_variable(const QUuid &guid, const QString &name, uint8_t *data,
-    size_t data_size, uint32_t attributes, mode_t mode)
+qefivar_efivarfs_set_variable(int dirfd, bool is_efivarfs, const QUuid &guid,
+    const QString &name, uint8_t *data, size_t data_size, uint32_t attributes,
+    mode_t mode)
 {
-    QByteArray buf((qsizetype)(sizeof (attributes) + data_size), (char)0);
     __typeof__(errno) errno_value;
     int ret = -1;
     int fd = -1;
+    int flags_fd = -1;
     int flags = 0;
-    char *flagstr;
-    int rc;
+    bool restore_flags = false;
+    bool created = false;
+    bool raw_append = false;
+    ssize_t rc;
 
     if (name.size() > 1024) {
         errno = EINVAL;
@@ -948,168 +1315,337 @@ qefivar_efivarfs_set_variable(const QUuid &guid, const QString &name, uint8_t *d
         return -1;
     }
 
-    if (data_size > (size_t)-1 - sizeof (attributes)) {
+    // The write buffer is sized with an int
+    if (data_size > (size_t)INT_MAX - sizeof (attributes)) {
         errno = EOVERFLOW;
         // efi_error("data_size too large (%zu)", data_size);
         return -1;
     }
 
-    const QString &rawPath = make_efivarfs_path(guid, name);
-    const char *path = rawPath.toLocal8Bit().constData();
-
-    if (!access(path, F_OK) && !(attributes & EFI_VARIABLE_APPEND_WRITE)) {
-        rc = qefivar_efivarfs_del_variable(guid, name);
-        if (rc < 0)
-            goto err;
+    const char *path = efivarfs_name(guid, name);
+    const bool append = attributes & EFI_VARIABLE_APPEND_WRITE;
+
+    // efivarfs marks most existing variables immutable, lift the flag
+    // for the duration of the write instead of deleting the variable
+    flags_fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (flags_fd >= 0) {
+        if (ioctl(flags_fd, FS_IOC_GETFLAGS, &flags) == 0 &&
+            (flags & FS_IMMUTABLE_FL)) {
+            int writable_flags = flags & ~FS_IMMUTABLE_FL;
+            if (ioctl(flags_fd, FS_IOC_SETFLAGS, &writable_flags) < 0)
+                goto err;
+            restore_flags = true;
+        }
+    } else if (errno == ENOENT) {
+        created = true;
+    } else {
+        goto err;
     }
 
-    fd = open(path, O_WRONLY|O_CREAT, mode);
+    // Only an existing plain file can be appended to as is, a new one
+    // needs its Attributes field first, like the firmware would store it
+    if (created && !is_efivarfs)
+        attributes &= ~EFI_VARIABLE_APPEND_WRITE;
+    raw_append = append && !is_efivarfs && !created;
+
+    // A write to an existing efivarfs file is a single SetVariable() call,
+    // which replaces the variable, or extends it with APPEND_WRITE
+    fd = openat(dirfd, path, O_WRONLY | O_CREAT | O_CLOEXEC |
+        (raw_append ? O_APPEND : 0), mode);
     if (fd < 0)
         goto err;
 
-    memcpy(buf.data(), &attributes, sizeof (attributes));
-    memcpy(buf.data() + sizeof (attributes), data, data_size);
-    rc = write(fd, buf.data(), sizeof (attributes) + data_size);
-    if (rc >= 0) {
-        ret = 0;
+    if (raw_append) {
+        // Emulate the firmware append on a plain file
+        rc = write(fd, data, data_size);
+        if (rc >= 0 && (size_t)rc != data_size) {
+            errno = EIO;
+            rc = -1;
+        }
     } else {
-        unlink(path);
+        /*
+         * efivarfs only implements write(), so writev() would be split into
+         * one SetVariable() per segment, and a write must carry the
+         * Attributes and the data at once. Small payloads are assembled on
+         * the stack, larger ones in a scratch buffer reused by the thread.
+         */
+        static thread_local QByteArray scratch;
+        char stack_buffer[QEFI_EFIVARFS_STACK_BUFFER_SIZE];
+        char *write_buffer = stack_buffer;
+        size_t write_size = sizeof (attributes) + data_size;
+        if (write_size > sizeof(stack_buffer)) {
+            if ((size_t)scratch.size() < write_size)
+                scratch.resize((int)write_size);
+            write_buffer = scratch.data();
+        }
+        memcpy(write_buffer, &attributes, sizeof (attributes));
+        memcpy(write_buffer + sizeof (attributes), data, data_size);
+
+        rc = write(fd, write_buffer, write_size);
+        if (rc >= 0 && (size_t)rc != write_size) {
+            errno = EIO;
+            rc = -1;
+        }
+        // A plain file keeps the old tail when the value shrinks
+        if (rc >= 0 && !is_efivarfs && ftruncate(fd, rc) < 0)
+            rc = -1;
     }
+
+    if (rc >= 0)
+        ret = 0;
+    else if (created)
+        unlinkat(dirfd, path, 0);
 err:
     errno_value = errno;
 
     if (fd >= 0)
         close(fd);
+    if (restore_flags)
+        ioctl(flags_fd, FS_IOC_SETFLAGS, &flags);
+    if (flags_fd >= 0)
+        close(flags_fd);
 
     errno = errno_value;
     return ret;
 }
 
-static inline int
-qefivar_set_variable(const QUuid &guid, const QString &name, uint8_t *data,
-    size_t data_size, uint32_t attributes, mode_t mode)
-{
-    return qefivar_efivarfs_set_variable(guid, name, data, data_size, attributes, mode);
-}
-#endif
-/* End: Get rid of efivar */
+/* Record layout returned by getdents64(2) */
+struct qefi_linux_dirent64 {
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
 
-bool qefi_is_available()
-{
-    return qefivar_variables_supported();
-}
+#define QEFI_EFIVARFS_GUID_LENGTH 36
 
-bool qefi_has_privilege()
+static int
+qefivar_efivarfs_list_variables(int dirfd, const QUuid *uuid,
+    const QByteArray &prefix, QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes)
 {
-    if (getuid() != 0) return false;
-    return true;
-}
+    __typeof__(errno) errno_value;
+    alignas(8) char buffer[16384];
+    struct stat st;
+    long nread;
 
-quint16 qefi_get_variable_uint16(QUuid uuid, QString name)
-{
-    int return_code;
-    size_t var_size;
-    return_code = qefivar_get_variable_size(uuid, name, &var_size);
-    if (var_size == 0 || return_code != 0)
+    // getdents64 needs a readable descriptor, the O_PATH one is not
+    int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
     {
-        return 0;
+        qCritical() << "open(efivarfs root) failed";
+        return -1;
     }
 
-    uint8_t *data;
-    uint32_t attributes;
-    return_code = qefivar_get_variable(uuid, name, &data, &var_size, &attributes);
-
-    quint16 value;
-    if (return_code != 0)
+    while ((nread = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0)
     {
-        value = 0;
-    }
-    else
-    {
-        // Read as uint16, platform-independant
-        value = *((quint16 *)data);
-        free(data);
+        for (long offset = 0; offset < nread;)
+        {
+            const struct qefi_linux_dirent64 *entry =
+                (const struct qefi_linux_dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+
+            // Entries are named "<Name>-<GUID>", filter on the raw bytes
+            // so that only the matching entries are decoded
+            size_t length = strlen(entry->d_name);
+            if (length < QEFI_EFIVARFS_GUID_LENGTH + 2)
+                continue;
+            size_t name_length = length - QEFI_EFIVARFS_GUID_LENGTH - 1;
+            if (entry->d_name[name_length] != '-')
+                continue;
+            if (name_length < (size_t)prefix.size() ||
+                memcmp(entry->d_name, prefix.constData(), prefix.size()) != 0)
+                continue;
+
+            QUuid entry_uuid = QUuid::fromString(QLatin1String(
+                entry->d_name + name_length + 1, QEFI_EFIVARFS_GUID_LENGTH));
+            if (entry_uuid.isNull() || (uuid && *uuid != entry_uuid))
+                continue;
+
+            // The size comes from the inode, no firmware call is made
+            if (sizes)
+            {
+                if (fstatat(fd, entry->d_name, &st, 0) < 0 ||
+                    st.st_size < (off_t)sizeof(uint32_t))
+                    continue;
+                sizes->append(st.st_size - sizeof(uint32_t));
+            }
+            variables.append(QEFIVariableKey(entry_uuid,
+                QString::fromUtf8(entry->d_name, (int)name_length)));
+        }
     }
 
-    return qFromLittleEndian<quint16>(value);
+    errno_value = errno;
+    close(fd);
+    errno = errno_value;
+
+    return nread < 0 ? -1 : 0;
 }
 
-QByteArray qefi_get_variable(QUuid uuid, QString name)
+QEFIEfivarfsBackend::QEFIEfivarfsBackend(const QString &root)
+    : m_root(root.isEmpty() ? get_efivarfs_path() : root),
+      m_rootDescriptor(-1), m_isEfivarfs(-1)
 {
-    int return_code;
+}
 
-    size_t var_size;
-    return_code = qefivar_get_variable_size(uuid, name, &var_size);
-    if (var_size == 0 || return_code != 0)
-    {
-        return QByteArray();
-    }
+QEFIEfivarfsBackend::~QEFIEfivarfsBackend()
+{
+    int fd = m_rootDescriptor.loadAcquire();
+    if (fd >= 0)
+        close(fd);
+}
 
-    uint8_t *data;
-    uint32_t attributes;
-    return_code = qefivar_get_variable(uuid, name, &data, &var_size, &attributes);
+QString QEFIEfivarfsBackend::root() const
+{
+    return m_root;
+}
 
-    QByteArray value;
-    if (return_code != 0)
-    {
-        value.clear();
-    }
-    else
+// Every entry is resolved relative to this descriptor instead of walking
+// the full path again
+int QEFIEfivarfsBackend::rootDescriptor()
+{
+    int fd = m_rootDescriptor.loadAcquire();
+    if (fd >= 0)
+        return fd;
+
+    const QByteArray &path = QFile::encodeName(m_root);
+    fd = open(path.constData(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (!m_rootDescriptor.testAndSetOrdered(-1, fd))
     {
-        for (size_t i = 0; i < var_size; i++) {
-            value.append(data[i]);
-        }
-        free(data);
+        // Another thread opened it first
+        close(fd);
+        fd = m_rootDescriptor.loadAcquire();
     }
+    return fd;
+}
 
-    return value;
+bool QEFIEfivarfsBackend::isAvailable()
+{
+    return rootDescriptor() >= 0;
 }
 
+bool QEFIEfivarfsBackend::hasPrivilege()
+{
+    return getuid() == 0;
+}
 
-const uint32_t default_write_attribute = EFI_VARIABLE_NON_VOLATILE |
-                                         EFI_VARIABLE_BOOTSERVICE_ACCESS |
-                                         EFI_VARIABLE_RUNTIME_ACCESS;
+int QEFIEfivarfsBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    int dirfd = rootDescriptor();
+    if (dirfd < 0)
+        return qefivar_error_code();
 
-void qefi_set_variable_uint16(QUuid uuid, QString name, quint16 value)
+    uint32_t attrs = 0;
+    if (qefivar_efivarfs_get_variable(dirfd, uuid, name, data, &attrs) < 0)
+        return qefivar_error_code();
+    if (attributes) *attributes = attrs;
+    return 0;
+}
+
+int QEFIEfivarfsBackend::getVariableInto(const QUuid &uuid, const QString &name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes)
 {
-    int return_code;
+    int dirfd = rootDescriptor();
+    if (dirfd < 0)
+        return qefivar_error_code();
+
+    uint32_t attrs = 0;
+    if (qefivar_efivarfs_get_variable_into(dirfd, uuid, name, (uint8_t *)buffer,
+            capacity, size, &attrs) < 0)
+        return qefivar_error_code();
+    if (attributes) *attributes = attrs;
+    return 0;
+}
 
-    uint8_t buffer[2];
-    *((uint16_t *)buffer) = qToLittleEndian<quint16>(value);
-    return_code = qefivar_set_variable(uuid, name, buffer, 2,
-                                             default_write_attribute,
-                                             0644);
+int QEFIEfivarfsBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    int dirfd = rootDescriptor();
+    if (dirfd < 0)
+        return qefivar_error_code();
 
-    // TODO: Detect return code
+    // The root may be redirected to a plain directory for testing
+    int is_efivarfs = m_isEfivarfs.loadAcquire();
+    if (is_efivarfs < 0)
+    {
+        struct statfs fs;
+        is_efivarfs = fstatfs(dirfd, &fs) == 0 &&
+            (unsigned long)fs.f_type == (unsigned long)EFIVARFS_MAGIC;
+        m_isEfivarfs.storeRelease(is_efivarfs);
+    }
+
+    if (qefivar_efivarfs_set_variable(dirfd, is_efivarfs, uuid, name,
+            (uint8_t *)data.constData(), data.size(), attributes, 0644) < 0)
+        return qefivar_error_code();
+    return 0;
 }
 
-void qefi_set_variable(QUuid uuid, QString name, QByteArray value)
+int QEFIEfivarfsBackend::deleteVariable(const QUuid &uuid, const QString &name)
 {
-    int return_code;
+    int dirfd = rootDescriptor();
+    if (dirfd < 0)
+        return qefivar_error_code();
+
+    if (qefivar_efivarfs_del_variable(dirfd, uuid, name) < 0)
+        return qefivar_error_code();
+    return 0;
+}
+
+int QEFIEfivarfsBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    int dirfd = rootDescriptor();
+    if (dirfd < 0)
+        return qefivar_error_code();
 
-    return_code = qefivar_set_variable(uuid, name, (uint8_t *)value.data(), value.size(),
-                                             default_write_attribute,
-                                             0644);
+    if (qefivar_efivarfs_list_variables(dirfd, uuid, prefix.toUtf8(),
+            variables, sizes) < 0)
+        return qefivar_error_code();
+    return 0;
+}
+
+int QEFIEfivarfsBackend::variableSize(const QUuid &uuid, const QString &name,
+    quint64 *size)
+{
+    int dirfd = rootDescriptor();
+    if (dirfd < 0)
+        return qefivar_error_code();
 
-    // TODO: Detect return code
+    // The inode knows the size, the firmware is not asked
+    struct stat st;
+    if (fstatat(dirfd, efivarfs_name(uuid, name), &st, 0) < 0)
+        return qefivar_error_code();
+    if (st.st_size < (off_t)sizeof(uint32_t))
+        return -EINVAL;
+    *size = st.st_size - sizeof(uint32_t);
+    return 0;
 }
 #endif
-#else   // APP Data based backend
+/* End: Get rid of efivar */
+#endif
+
+/* AppData based backend */
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <QStandardPaths>
 #include <QDebug>
 #include <QString>
 #include <QFile>
 #include <QDir>
+#include <QMutex>
+#include <QReadWriteLock>
 
-bool qefi_is_available()
-{
-    return true;
-}
-
-bool qefi_has_privilege()
-{
-    return true;
-}
+#ifdef Q_OS_WIN
+#include <Windows.h>
+#else
+#include <cstdio>
+#endif
 
 bool dummy_backend_get_dir(QString &dir)
 {
@@ -1122,90 +1658,619 @@ bool dummy_backend_get_dir(QString &dir)
     return true;
 }
 
-quint16 qefi_get_variable_uint16(QUuid uuid, QString name)
-{
-    QByteArray data;
-    quint16 value = 0;
+#define APP_DATA_PACKED_FILE    "variables.fd"
+#define APP_DATA_PACKED_SIZE    0x10000
 
+class QEFIAppDataBackendPrivate
+{
+public:
+    bool packed;
+    // The directory once resolved, published by isResolved
+    QMutex mutex;
     QString dir;
-    if (dummy_backend_get_dir(dir)) {
-        QDir storedDir(dir);
-        QString filename = storedDir.absoluteFilePath(
-        QStringLiteral("%1%2.bin").arg(uuid.toString(QUuid::WithoutBraces), name));
+    QAtomicInt isResolved;
+    // Held for writing while the packed store is opened or grown
+    QReadWriteLock storeLock;
+    QEFIVarStoreBackend store;
 
-        qDebug() << filename;
-        QFile file(filename);
-        if (file.exists()) {
-            file.open(QIODevice::ReadOnly);
-            data = file.readAll();
-            file.close();
+    QEFIAppDataBackendPrivate(bool packed) : packed(packed) {}
+};
 
-            if (data.size() >= 2) {
-                value = *((quint16 *)data.data());
-            }
+QEFIAppDataBackend::QEFIAppDataBackend(const QString &dir, bool packed)
+    : m_dir(dir), d(new QEFIAppDataBackendPrivate(packed))
+{
+}
+
+QEFIAppDataBackend::~QEFIAppDataBackend()
+{
+}
+
+bool QEFIAppDataBackend::isPacked() const
+{
+    return d->packed;
+}
+
+bool QEFIAppDataBackend::directory(QString &dir) const
+{
+    if (d->isResolved.loadAcquire()) {
+        dir = d->dir;
+        return true;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    if (!d->isResolved.loadAcquire()) {
+        QString resolved = m_dir;
+        if (resolved.isEmpty()) {
+            if (!dummy_backend_get_dir(resolved)) return false;
+        } else {
+            QDir storedDir(resolved);
+            if (!storedDir.exists() && !storedDir.mkpath(resolved)) return false;
         }
+        d->dir = resolved;
+        d->isResolved.storeRelease(1);
     }
+    dir = d->dir;
+    return true;
+}
 
-    return qFromLittleEndian<quint16>(value);
+// The directory may have been removed since it was resolved
+static bool app_data_open(QFile &file, const QString &dir, QIODevice::OpenMode mode)
+{
+    if (file.open(mode)) return true;
+    return !QDir(dir).exists() && QDir().mkpath(dir) && file.open(mode);
 }
 
-QByteArray qefi_get_variable(QUuid uuid, QString name)
+// Open the packed store, with the store lock held for reading
+static int app_data_packed_store(QEFIAppDataBackendPrivate *d, const QString &dir)
 {
-    QByteArray data;
+    if (d->store.isOpen()) return 0;
 
-    QString dir;
-    if (dummy_backend_get_dir(dir)) {
-        QDir storedDir(dir);
-        QString filename = storedDir.absoluteFilePath(
+    d->storeLock.unlock();
+    d->storeLock.lockForWrite();
+    int error = 0;
+    if (!d->store.isOpen()) {
+        const QString fileName = QDir(dir).absoluteFilePath(
+            QStringLiteral(APP_DATA_PACKED_FILE));
+        if (!QFile::exists(fileName)) {
+            if (!QDir(dir).exists()) QDir().mkpath(dir);
+            error = QEFIVarStoreBackend::create(fileName, APP_DATA_PACKED_SIZE);
+        }
+        if (error == 0) error = d->store.open(fileName, true);
+    }
+    d->storeLock.unlock();
+    d->storeLock.lockForRead();
+    return error;
+}
+
+// Reclaim the packed store or move it to an image twice as large, with the
+// store lock held for writing
+static int app_data_packed_grow(QEFIAppDataBackendPrivate *d, const QString &dir,
+    quint64 needed)
+{
+    int error = d->store.reclaim();
+    if (error != 0) return error;
+    if (d->store.freeSize() >= needed) return 0;
+
+    const QString fileName = QDir(dir).absoluteFilePath(
+        QStringLiteral(APP_DATA_PACKED_FILE));
+    const QString grownName = fileName + QStringLiteral(".new");
+    const quint64 size = qMax(d->store.storeSize() * 2, d->store.storeSize() + needed);
+    if (size > 0xffff0000) return -ENOSPC;
+    error = QEFIVarStoreBackend::create(grownName, size);
+    if (error != 0) return error;
+
+    QEFIVarStoreBackend grown;
+    error = grown.open(grownName, true);
+    QList<QEFIVariableKey> variables;
+    if (error == 0) error = d->store.listVariables(variables);
+    for (const QEFIVariableKey &key : std::as_const(variables)) {
+        if (error != 0) break;
+        int dataSize = 0;
+        quint32 attributes = 0;
+        const char *data = d->store.constData(key.first, key.second, &dataSize, &attributes);
+        error = grown.setVariable(key.first, key.second,
+            QByteArray::fromRawData(data, dataSize), attributes);
+    }
+    grown.close();
+    if (error != 0) {
+        QFile::remove(grownName);
+        return error;
+    }
+
+    // Replaced in one step: the old store stays whole, and open, until the
+    // grown one has taken its place
+#ifdef Q_OS_WIN
+    // A mapped file cannot be replaced
+    d->store.close();
+    if (!MoveFileExW((LPCWSTR)QDir::toNativeSeparators(grownName).utf16(),
+            (LPCWSTR)QDir::toNativeSeparators(fileName).utf16(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        QFile::remove(grownName);
+        d->store.open(fileName, true);
+        return -EIO;
+    }
+#else
+    if (::rename(QFile::encodeName(grownName).constData(),
+            QFile::encodeName(fileName).constData()) < 0) {
+        error = -errno;
+        QFile::remove(grownName);
+        return error;
+    }
+    d->store.close();
+#endif
+    return d->store.open(fileName, true);
+}
+
+QString QEFIAppDataBackend::fileName(const QString &dir, const QUuid &uuid,
+    const QString &name) const
+{
+    return QDir(dir).absoluteFilePath(
         QStringLiteral("%1%2.bin").arg(uuid.toString(QUuid::WithoutBraces), name));
+}
 
-        qDebug() << filename;
-        QFile file(filename);
-        if (file.exists()) {
-            file.open(QIODevice::ReadOnly);
-            data = file.readAll();
-            file.close();
-        }
+bool QEFIAppDataBackend::isAvailable()
+{
+    return true;
+}
+
+bool QEFIAppDataBackend::hasPrivilege()
+{
+    return true;
+}
+
+// The attributes are only stored when packed, the default ones are
+// reported for files
+int QEFIAppDataBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    QString dir;
+    if (!directory(dir)) return -ENOENT;
+
+    if (d->packed) {
+        QReadLocker locker(&d->storeLock);
+        int error = app_data_packed_store(d.data(), dir);
+        if (error != 0) return error;
+
+        int size = 0;
+        const char *value = d->store.constData(uuid, name, &size, attributes);
+        if (!value) return -ENOENT;
+        // Copied, a grown store is mapped elsewhere
+        data = QByteArray(value, size);
+        return 0;
     }
 
-    return data;
+    QFile file(fileName(dir, uuid, name));
+    if (!file.open(QIODevice::ReadOnly)) return -ENOENT;
+    data = file.readAll();
+    if (attributes) *attributes = QEFI_VARIABLE_DEFAULT_ATTRIBUTES;
+    return 0;
 }
 
-void qefi_set_variable_uint16(QUuid uuid, QString name, quint16 value)
+int QEFIAppDataBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
 {
     QString dir;
-    if (dummy_backend_get_dir(dir)) {
-        QDir storedDir(dir);
-        QString filename = storedDir.absoluteFilePath(
-        QStringLiteral("%1%2.bin").arg(uuid.toString(QUuid::WithoutBraces), name));
+    if (!directory(dir)) return -ENOENT;
+
+    if (d->packed) {
+        QReadLocker locker(&d->storeLock);
+        int error = app_data_packed_store(d.data(), dir);
+        if (error != 0) return error;
+        error = d->store.setVariable(uuid, name, data, attributes);
+        locker.unlock();
+        if (error != -ENOSPC) return error;
+
+        QWriteLocker writeLocker(&d->storeLock);
+        quint64 size = 0;
+        d->store.variableSize(uuid, name, &size);
+        error = app_data_packed_grow(d.data(), dir,
+            qefi_variable_storage_size(name, size + data.size()));
+        if (error != 0) return error;
+        return d->store.setVariable(uuid, name, data, attributes);
+    }
+
+    QFile file(fileName(dir, uuid, name));
+    QIODevice::OpenMode mode = QIODevice::WriteOnly;
+    if (attributes & QEFI_VARIABLE_APPEND_WRITE) mode |= QIODevice::Append;
+    if (!app_data_open(file, dir, mode)) return -EIO;
+    if (file.write(data) != data.size()) return -EIO;
+    file.close();
+
+    return 0;
+}
 
-        QByteArray data;
-        data.append((const char)(value & 0xFF));
-        data.append((const char)(value >> 8));
-        qDebug() << filename;
-        QFile file(filename);
-        file.open(QIODevice::WriteOnly);
-        file.write(data);
-        file.close();
+int QEFIAppDataBackend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    QString dir;
+    if (!directory(dir)) return -ENOENT;
+
+    if (d->packed) {
+        QReadLocker locker(&d->storeLock);
+        int error = app_data_packed_store(d.data(), dir);
+        if (error != 0) return error;
+        return d->store.deleteVariable(uuid, name);
     }
+
+    const QString &filename = fileName(dir, uuid, name);
+    if (!QFile::exists(filename)) return -ENOENT;
+    if (!QFile::remove(filename)) return -EIO;
+    return 0;
 }
 
-void qefi_set_variable(QUuid uuid, QString name, QByteArray value)
+int QEFIAppDataBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
 {
     QString dir;
-    if (dummy_backend_get_dir(dir)) {
-        QDir storedDir(dir);
-        QString filename = storedDir.absoluteFilePath(
-        QStringLiteral("%1%2.bin").arg(uuid.toString(QUuid::WithoutBraces), name));
+    if (!directory(dir)) return -ENOENT;
+
+    if (d->packed) {
+        QReadLocker locker(&d->storeLock);
+        int error = app_data_packed_store(d.data(), dir);
+        if (error != 0) return error;
+        return d->store.listVariables(variables, sizes, uuid, prefix);
+    }
+
+    // Entries are named "<GUID><Name>.bin"
+    const int uuid_length = 36;
+    const int suffix_length = 4;
+    const QFileInfoList entries = QDir(dir).entryInfoList(
+        QStringList(QStringLiteral("*.bin")), QDir::Files);
+    for (const QFileInfo &entry : entries) {
+        const QString fileName = entry.fileName();
+        if (fileName.size() <= uuid_length + suffix_length) continue;
+
+        QUuid entry_uuid(fileName.left(uuid_length));
+        if (uuid && *uuid != entry_uuid) continue;
 
-        qDebug() << filename;
-        QFile file(filename);
-        file.open(QIODevice::WriteOnly);
-        file.write(value);
-        file.close();
+        QString name = fileName.mid(uuid_length,
+            fileName.size() - uuid_length - suffix_length);
+        if (!name.startsWith(prefix)) continue;
+
+        variables.append(QEFIVariableKey(entry_uuid, name));
+        if (sizes) sizes->append(entry.size());
     }
+    return 0;
+}
+
+/* Default backend */
+QEFIBackend::~QEFIBackend()
+{
+}
+
+bool QEFIBackend::isAvailable()
+{
+    return true;
 }
+
+bool QEFIBackend::hasPrivilege()
+{
+    return true;
+}
+
+int QEFIBackend::getVariableInto(const QUuid &uuid, const QString &name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes)
+{
+    QByteArray data;
+    int error = getVariable(uuid, name, data, attributes);
+    if (error != 0) return error;
+
+    *size = data.size();
+    memcpy(buffer, data.constData(), qMin(capacity, *size));
+    return 0;
+}
+
+int QEFIBackend::variableSize(const QUuid &uuid, const QString &name, quint64 *size)
+{
+    QByteArray data;
+    int error = getVariable(uuid, name, data);
+    if (error != 0) return error;
+
+    *size = data.size();
+    return 0;
+}
+
+int QEFIBackend::variableAttributes(const QUuid &uuid, const QString &name,
+    quint32 *attributes)
+{
+    QByteArray data;
+    return getVariable(uuid, name, data, attributes);
+}
+
+QEFIBackend *qefi_system_backend()
+{
+#if defined(EFIVAR_APP_DATA_DUMMY) && defined(EFIVAR_APP_DATA_PACKED)
+    static QEFIAppDataBackend backend(QString(), true);
+#elif defined(EFIVAR_APP_DATA_DUMMY)
+    static QEFIAppDataBackend backend;
+#elif defined(Q_OS_WIN)
+    static QEFIWin32Backend backend;
+#elif defined(Q_OS_FREEBSD)
+    static QEFILibefivarBackend backend;
+#elif defined(Q_OS_LINUX)
+    static QEFIEfivarfsBackend backend;
+#else
+    static QEFIAppDataBackend backend;
 #endif
+    return &backend;
+}
+
+static QAtomicPointer<QEFIBackend> qefi_default_backend_pointer;
+
+QEFIBackend *qefi_default_backend()
+{
+    QEFIBackend *backend = qefi_default_backend_pointer.loadAcquire();
+    return backend ? backend : qefi_system_backend();
+}
+
+void qefi_set_default_backend(QEFIBackend *backend)
+{
+    qefi_default_backend_pointer.storeRelease(backend);
+}
+
+bool qefi_is_available()
+{
+    return qefi_default_backend()->isAvailable();
+}
+
+bool qefi_has_privilege()
+{
+    return qefi_default_backend()->hasPrivilege();
+}
+
+quint16 qefi_get_variable_uint16(QEFIContext &context, QUuid uuid, QString name)
+{
+    char buffer[sizeof(quint16)];
+    size_t size = 0;
+    if (context.backend()->getVariableInto(uuid, name, buffer,
+            sizeof(buffer), &size) != 0 || size < sizeof(quint16))
+    {
+        return 0;
+    }
+
+    // Read as uint16, platform-independant
+    return qFromLittleEndian<quint16>(buffer);
+}
+
+QByteArray qefi_get_variable(QEFIContext &context, QUuid uuid, QString name)
+{
+    QByteArray value;
+    if (context.backend()->getVariable(uuid, name, value) != 0)
+    {
+        value.clear();
+    }
+
+    return value;
+}
+
+int qefi_get_variable_into(QEFIContext &context, QUuid uuid, QString name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes)
+{
+    int return_code = context.backend()->getVariableInto(uuid, name, buffer,
+        capacity, size, attributes);
+    if (return_code != 0) return return_code;
+
+    return *size > capacity ? -ENOBUFS : 0;
+}
+
+int qefi_get_variable_into(QEFIContext &context, QUuid uuid, QString name,
+    QByteArray &buffer, quint32 *attributes)
+{
+    // A variable may grow between two reads, so give up after a few
+    for (int attempt = 0; attempt < 4; attempt++)
+    {
+        // The whole allocation is used, resizing within it does not allocate
+        buffer.resize(buffer.capacity());
+        size_t size = 0;
+        int return_code = qefi_get_variable_into(context, uuid, name,
+            buffer.data(), buffer.size(), &size, attributes);
+        if (return_code == -ENOBUFS && size <= (size_t)INT_MAX)
+        {
+            buffer.reserve((int)size);
+            continue;
+        }
+
+        buffer.resize(return_code == 0 ? (int)size : 0);
+        return return_code;
+    }
+
+    buffer.resize(0);
+    return -EAGAIN;
+}
+
+void qefi_set_variable_uint16(QEFIContext &context, QUuid uuid, QString name, quint16 value)
+{
+    QByteArray data(sizeof(quint16), Qt::Uninitialized);
+    qToLittleEndian<quint16>(value, data.data());
+    qefi_set_variable(context, uuid, name, data);
+}
+
+void qefi_set_variable(QEFIContext &context, QUuid uuid, QString name, QByteArray value)
+{
+    qefi_write_cache_forget(context, uuid, name);
+    int return_code = context.backend()->setVariable(uuid, name, value,
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+
+    // The call cannot report errors, at least do not lose them (ENOSPC...)
+    if (return_code < 0)
+        qWarning() << "Cannot write" << name << ":" << strerror(-return_code);
+}
+
+QEFIVariable qefi_read_variable(QEFIContext &context, QUuid uuid, QString name, int *error)
+{
+    QByteArray value;
+    quint32 attributes = 0;
+    int return_code = context.backend()->getVariable(uuid, name, value,
+        &attributes);
+    if (error) *error = return_code;
+    if (return_code != 0) return QEFIVariable();
+
+    return QEFIVariable(uuid, name, value, attributes);
+}
+
+int qefi_write_variable(QEFIContext &context, const QEFIVariable &variable)
+{
+    if (variable.isNull()) return -EINVAL;
+    qefi_write_cache_forget(context, variable.guid(), variable.name());
+
+    return context.backend()->setVariable(variable.guid(), variable.name(),
+        variable.data(), variable.attributes());
+}
+
+int qefi_delete_variable(QEFIContext &context, QUuid uuid, QString name)
+{
+    qefi_write_cache_forget(context, uuid, name);
+    return context.backend()->deleteVariable(uuid, name);
+}
+
+QList<QEFIVariableKey> qefi_list_variables(QEFIContext &context, const QString &prefix)
+{
+    QList<QEFIVariableKey> variables;
+    context.backend()->listVariables(variables, nullptr, nullptr, prefix);
+    return variables;
+}
+
+QList<QEFIVariableKey> qefi_list_variables(QEFIContext &context, QUuid uuid,
+    const QString &prefix)
+{
+    QList<QEFIVariableKey> variables;
+    context.backend()->listVariables(variables, nullptr, &uuid, prefix);
+    return variables;
+}
+
+// Without a context, the default one
+quint16 qefi_get_variable_uint16(QUuid uuid, QString name)
+{
+    return qefi_get_variable_uint16(*qefi_default_context(), uuid, name);
+}
+
+QByteArray qefi_get_variable(QUuid uuid, QString name)
+{
+    return qefi_get_variable(*qefi_default_context(), uuid, name);
+}
+
+int qefi_get_variable_into(QUuid uuid, QString name, char *buffer,
+    size_t capacity, size_t *size, quint32 *attributes)
+{
+    return qefi_get_variable_into(*qefi_default_context(), uuid, name, buffer,
+        capacity, size, attributes);
+}
+
+int qefi_get_variable_into(QUuid uuid, QString name, QByteArray &buffer,
+    quint32 *attributes)
+{
+    return qefi_get_variable_into(*qefi_default_context(), uuid, name, buffer,
+        attributes);
+}
+
+void qefi_set_variable_uint16(QUuid uuid, QString name, quint16 value)
+{
+    qefi_set_variable_uint16(*qefi_default_context(), uuid, name, value);
+}
+
+void qefi_set_variable(QUuid uuid, QString name, QByteArray value)
+{
+    qefi_set_variable(*qefi_default_context(), uuid, name, value);
+}
+
+QEFIVariable qefi_read_variable(QUuid uuid, QString name, int *error)
+{
+    return qefi_read_variable(*qefi_default_context(), uuid, name, error);
+}
+
+int qefi_write_variable(const QEFIVariable &variable)
+{
+    return qefi_write_variable(*qefi_default_context(), variable);
+}
+
+int qefi_delete_variable(QUuid uuid, QString name)
+{
+    return qefi_delete_variable(*qefi_default_context(), uuid, name);
+}
+
+QList<QEFIVariableKey> qefi_list_variables(const QString &prefix)
+{
+    return qefi_list_variables(*qefi_default_context(), prefix);
+}
+
+QList<QEFIVariableKey> qefi_list_variables(QUuid uuid, const QString &prefix)
+{
+    return qefi_list_variables(*qefi_default_context(), uuid, prefix);
+}
+
+QList<QEFIVariableUsage> qefi_list_variable_usage(int *error)
+{
+    QList<QEFIVariableKey> variables;
+    QList<quint64> sizes;
+    QList<QEFIVariableUsage> usage;
+    int return_code = qefi_default_backend()->listVariables(variables, &sizes);
+    if (error) *error = return_code;
+    if (return_code != 0) return usage;
+
+    usage.reserve(variables.size());
+    for (int i = 0; i < variables.size(); i++)
+        usage.append(QEFIVariableUsage(variables[i].first, variables[i].second, sizes[i]));
+    return usage;
+}
+
+/* Batched reads */
+#include <QRunnable>
+#include <QThreadPool>
+#include <QVector>
+
+class QEFIReadTask : public QRunnable
+{
+protected:
+    QEFIVariableKey m_key;
+    QEFIVariable *m_variable;
+    int *m_error;
+public:
+    QEFIReadTask(const QEFIVariableKey &key, QEFIVariable *variable, int *error)
+        : m_key(key), m_variable(variable), m_error(error) {}
+
+    void run() override
+    {
+        *m_variable = qefi_read_variable(m_key.first, m_key.second, m_error);
+    }
+};
+
+QList<QEFIVariable> qefi_read_variables(const QList<QEFIVariableKey> &keys,
+    QList<int> *errors, int maxThreads)
+{
+    // Every task owns one slot, the vectors are never resized meanwhile
+    QVector<QEFIVariable> variables(keys.size());
+    QVector<int> codes(keys.size(), 0);
+
+    if (maxThreads <= 0) maxThreads = QEFI_READ_VARIABLES_DEFAULT_THREADS;
+    if (maxThreads > keys.size()) maxThreads = keys.size();
+
+    if (maxThreads <= 1) {
+        for (int i = 0; i < keys.size(); i++) {
+            variables[i] = qefi_read_variable(keys[i].first, keys[i].second,
+                &codes[i]);
+        }
+    } else {
+        // A private pool bounds the reads in flight without starving
+        // the global pool of the application
+        QThreadPool pool;
+        pool.setMaxThreadCount(maxThreads);
+        for (int i = 0; i < keys.size(); i++) {
+            pool.start(new QEFIReadTask(keys[i], &variables[i], &codes[i]));
+        }
+        pool.waitForDone();
+    }
+
+    if (errors) {
+        errors->clear();
+        for (int code : std::as_const(codes)) errors->append(code);
+    }
+
+    QList<QEFIVariable> results;
+    results.reserve(variables.size());
+    for (const QEFIVariable &variable : std::as_const(variables)) {
+        results.append(variable);
+    }
+    return results;
+}
 
 /* General functions */
 QString qefi_extract_name(const QByteArray &data)
@@ -1359,6 +2424,83 @@ bool qefi_loadopt_is_valid(const QByteArray &data)
     return true;
 }
 
+class QEFIVariableData : public QSharedData
+{
+public:
+    QEFIVariableData() : attributes(QEFI_VARIABLE_DEFAULT_ATTRIBUTES) {}
+
+    QUuid guid;
+    QString name;
+    quint32 attributes;
+    QByteArray data;
+};
+
+QEFIVariable::QEFIVariable()
+{
+}
+
+QEFIVariable::QEFIVariable(QUuid guid, QString name, QByteArray data,
+    quint32 attributes)
+    : d(new QEFIVariableData)
+{
+    d->guid = guid;
+    d->name = name;
+    d->attributes = attributes;
+    d->data = data;
+}
+
+QEFIVariable::QEFIVariable(const QEFIVariable &other)
+    : d(other.d)
+{
+}
+
+QEFIVariable &QEFIVariable::operator=(const QEFIVariable &other)
+{
+    d = other.d;
+    return *this;
+}
+
+QEFIVariable::~QEFIVariable()
+{
+}
+
+bool QEFIVariable::isNull() const
+{
+    return !d;
+}
+
+QUuid QEFIVariable::guid() const
+{
+    return d ? d->guid : QUuid();
+}
+
+QString QEFIVariable::name() const
+{
+    return d ? d->name : QString();
+}
+
+quint32 QEFIVariable::attributes() const
+{
+    return d ? d->attributes : 0;
+}
+
+QByteArray QEFIVariable::data() const
+{
+    return d ? d->data : QByteArray();
+}
+
+void QEFIVariable::setAttributes(quint32 attributes)
+{
+    if (!d) d = new QEFIVariableData;
+    d->attributes = attributes;
+}
+
+void QEFIVariable::setData(const QByteArray &data)
+{
+    if (!d) d = new QEFIVariableData;
+    d->data = data;
+}
+
 bool QEFILoadOption::isValidated() const
 {
     return m_isValidated;
@@ -9,20 +9,851 @@
 #  define QEFI_EXPORT Q_DECL_IMPORT
 #endif
 
+#include <QAtomicInt>
 #include <QUrl>
 #include <QUuid>
+#include <QList>
+#include <QMap>
+#include <QPair>
 #include <QString>
+#include <QStringList>
 #include <QSharedPointer>
+#include <QSharedDataPointer>
+#include <QScopedPointer>
+#include <QFuture>
+#include <QThreadPool>
+
+// A variable is identified by its vendor GUID and its name
+typedef QPair<QUuid, QString> QEFIVariableKey;
 
 QEFI_EXPORT bool qefi_is_available();
 QEFI_EXPORT bool qefi_has_privilege();
 
 QEFI_EXPORT quint16 qefi_get_variable_uint16(QUuid uuid, QString name);
 QEFI_EXPORT QByteArray qefi_get_variable(QUuid uuid, QString name);
+// Read into memory of the caller without allocating. Return 0 with size set
+// to the size of the data, or -ENOBUFS when capacity is too small, then size
+// is the required one and the buffer holds the first capacity bytes. A read
+// that raced with a write of the variable may fail with -EAGAIN.
+QEFI_EXPORT int qefi_get_variable_into(QUuid uuid, QString name, char *buffer,
+    size_t capacity, size_t *size, quint32 *attributes = nullptr);
+// Read into the allocation of buffer, which is grown only when too small
+QEFI_EXPORT int qefi_get_variable_into(QUuid uuid, QString name, QByteArray &buffer,
+    quint32 *attributes = nullptr);
 
 QEFI_EXPORT void qefi_set_variable_uint16(QUuid uuid, QString name, quint16 value);
 QEFI_EXPORT void qefi_set_variable(QUuid uuid, QString name, QByteArray value);
 
+#define QEFI_VARIABLE_NON_VOLATILE                            0x00000001
+#define QEFI_VARIABLE_BOOTSERVICE_ACCESS                      0x00000002
+#define QEFI_VARIABLE_RUNTIME_ACCESS                          0x00000004
+#define QEFI_VARIABLE_HARDWARE_ERROR_RECORD                   0x00000008
+#define QEFI_VARIABLE_AUTHENTICATED_WRITE_ACCESS              0x00000010
+#define QEFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS   0x00000020
+#define QEFI_VARIABLE_APPEND_WRITE                            0x00000040
+#define QEFI_VARIABLE_ENHANCED_AUTHENTICATED_ACCESS           0x00000080
+
+// Attributes used by qefi_set_variable
+#define QEFI_VARIABLE_DEFAULT_ATTRIBUTES    (QEFI_VARIABLE_NON_VOLATILE | \
+                                             QEFI_VARIABLE_BOOTSERVICE_ACCESS | \
+                                             QEFI_VARIABLE_RUNTIME_ACCESS)
+
+// A variable with its attributes, implicitly shared
+class QEFIVariableData;
+class QEFIVariable
+{
+protected:
+    QSharedDataPointer<QEFIVariableData> d;
+public:
+    QEFIVariable();
+    QEFIVariable(QUuid guid, QString name, QByteArray data,
+        quint32 attributes = QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    QEFIVariable(const QEFIVariable &other);
+    QEFIVariable &operator=(const QEFIVariable &other);
+    ~QEFIVariable();
+
+    bool isNull() const;
+
+    QUuid guid() const;
+    QString name() const;
+    quint32 attributes() const;
+    QByteArray data() const;
+
+    void setAttributes(quint32 attributes);
+    void setData(const QByteArray &data);
+};
+
+// Read a variable with its attributes, a null variable is returned on failure
+// and the negative errno is stored in error if given
+QEFI_EXPORT QEFIVariable qefi_read_variable(QUuid uuid, QString name,
+    int *error = nullptr);
+// Write a variable with its own attributes, return 0 or a negative errno
+QEFI_EXPORT int qefi_write_variable(const QEFIVariable &variable);
+
+// Delete a variable, return 0 or a negative errno
+QEFI_EXPORT int qefi_delete_variable(QUuid uuid, QString name);
+
+// Read several variables, overlapping the reads on at most maxThreads threads.
+// The results and the errors follow the order of keys.
+#define QEFI_READ_VARIABLES_DEFAULT_THREADS 8
+QEFI_EXPORT QList<QEFIVariable> qefi_read_variables(const QList<QEFIVariableKey> &keys,
+    QList<int> *errors = nullptr, int maxThreads = 0);
+
+// Write only when the bytes or the attributes differ from the current value.
+// The current value comes from a cache of the values last seen by this call
+// in the default context (see QEFIContext), or is read once. Every write
+// through the context updates the cache, changes made by other processes
+// are only seen after qefi_clear_write_cache(). Return 0 or a negative errno.
+QEFI_EXPORT int qefi_write_variable_if_changed(const QEFIVariable &variable);
+QEFI_EXPORT void qefi_clear_write_cache();
+
+// Writes skipped and performed by qefi_write_variable_if_changed
+struct QEFIWriteCounters
+{
+    quint64 skipped;
+    quint64 performed;
+};
+
+QEFI_EXPORT QEFIWriteCounters qefi_write_counters();
+QEFI_EXPORT void qefi_reset_write_counters();
+
+// Overhead of a variable in the firmware store: the authenticated
+// variable header, then the UCS-2 name with its terminator and the data,
+// the whole record padded to 4 bytes as edk2 lays it out on x86
+#define QEFI_AUTHENTICATED_VARIABLE_HEADER_SIZE 60
+#define QEFI_VARIABLE_STORE_ALIGNMENT 4
+
+QEFI_EXPORT quint64 qefi_variable_storage_size(const QString &name, quint64 dataSize);
+
+// Size of one stored variable
+class QEFIVariableUsage
+{
+protected:
+    QUuid m_guid;
+    QString m_name;
+    quint64 m_dataSize;
+public:
+    QEFIVariableUsage(QUuid guid = QUuid(), QString name = QString(),
+        quint64 dataSize = 0);
+
+    QUuid guid() const;
+    QString name() const;
+    quint64 dataSize() const;
+    // Data size with the header and name overhead
+    quint64 storageSize() const;
+};
+
+// List every variable with its data size in one enumeration pass,
+// without reading the variables
+QEFI_EXPORT QList<QEFIVariableUsage> qefi_list_variable_usage(int *error = nullptr);
+
+/*
+ * Usage of the variable store, computed from one enumeration pass. The
+ * store size is the space available to variables, usually the
+ * PcdVariableStoreSize of the firmware minus the store header; it has to
+ * be configured since the OS cannot query it.
+ */
+class QEFIStoreUsage
+{
+protected:
+    QList<QEFIVariableUsage> m_variables;
+    quint64 m_storeSize;
+public:
+    QEFIStoreUsage(quint64 storeSize = 0);
+
+    // Enumerate the store, return 0 or a negative errno
+    int scan();
+    void setVariables(const QList<QEFIVariableUsage> &variables);
+    QList<QEFIVariableUsage> variables() const;
+
+    quint64 storeSize() const;
+    void setStoreSize(quint64 storeSize);
+
+    quint64 usedSize() const;
+    quint64 freeSize() const;
+    QMap<QUuid, quint64> usageByGuid() const;
+    QList<QEFIVariableUsage> largestVariables(int count) const;
+
+    // Used size once the writes are done: a write replaces the stored
+    // copy, an append with QEFI_VARIABLE_APPEND_WRITE extends it
+    quint64 plannedSize(const QList<QEFIVariable> &writes) const;
+    // Whether the writes fit the configured store size
+    bool fits(const QList<QEFIVariable> &writes) const;
+};
+
+// Append EFI_SIGNATURE_LIST data to a signature database (db, dbx, MokList...)
+// with EFI_VARIABLE_APPEND_WRITE. Signatures already in the variable are not
+// sent again. A payload signed for time based authenticated access starts
+// with its EFI_VARIABLE_AUTHENTICATION_2 descriptor; it cannot be trimmed
+// without breaking the signature, so it is only skipped when every entry is
+// already present. Return 0 or a negative errno.
+QEFI_EXPORT int qefi_append_variable(QUuid uuid, QString name, QByteArray payload,
+    quint32 attributes = QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+
+/*
+ * Stages several writes and deletions and runs them in one pass: boot
+ * entries and other variables first, then the *Order variables, then
+ * BootNext, then the deletions so that no order references a missing
+ * entry. The previous values are captured before anything is written,
+ * writes whose bytes and attributes are already stored are skipped, and
+ * if a step fails the steps already done are restored.
+ */
+class QEFIWriteBatch
+{
+protected:
+    QList<QEFIVariable> m_writes;
+    QList<QEFIVariableKey> m_deletions;
+    int m_written;
+    int m_skipped;
+public:
+    QEFIWriteBatch();
+
+    void setVariable(const QEFIVariable &variable);
+    void setVariable(QUuid uuid, QString name, QByteArray value,
+        quint32 attributes = QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    void setVariableUint16(QUuid uuid, QString name, quint16 value);
+    void removeVariable(QUuid uuid, QString name);
+
+    int size() const;
+    void clear();
+
+    // Return 0, or the negative errno of the failed step once rolled back
+    int commit();
+
+    // Steps of the last commit
+    int writtenCount() const;
+    int skippedCount() const;
+};
+
+/*
+ * Immutable copy of the variable store, or of the variables under some
+ * GUIDs, loaded once. The payloads are stored back to back in one arena
+ * and looked up through a sorted (GUID, name) index in O(log n).
+ */
+class QEFIVariableSnapshotData;
+class QEFIVariableSnapshot
+{
+protected:
+    QExplicitlySharedDataPointer<QEFIVariableSnapshotData> d;
+public:
+    QEFIVariableSnapshot();
+    QEFIVariableSnapshot(const QEFIVariableSnapshot &other);
+    QEFIVariableSnapshot &operator=(const QEFIVariableSnapshot &other);
+    ~QEFIVariableSnapshot();
+
+    // Load every variable, or only the ones under the given GUIDs
+    static QEFIVariableSnapshot load(const QList<QUuid> &guids = QList<QUuid>());
+    static QEFIVariableSnapshot fromVariables(const QList<QEFIVariable> &variables);
+
+    int size() const;
+    QList<QEFIVariableKey> keys() const;
+    bool contains(const QUuid &guid, const QString &name) const;
+
+    // Point into the arena without allocating, valid while the snapshot
+    // lives. Return nullptr when the variable is not in the snapshot.
+    const char *constData(const QUuid &guid, const QString &name,
+        int *size, quint32 *attributes = nullptr) const;
+    // Copy of the payload, constData() is the zero-copy view
+    QByteArray value(const QUuid &guid, const QString &name) const;
+    quint16 valueUint16(const QUuid &guid, const QString &name) const;
+};
+
+// Asynchronous variants, run on the library thread pool. Writes to the
+// same variable complete in the order they were issued, reads run in
+// parallel. The writes report 0 or a negative errno.
+#define QEFI_ASYNC_MAX_THREADS 4
+QEFI_EXPORT QThreadPool *qefi_thread_pool();
+// Bulk work on image files, one thread per core and apart from the firmware
+QEFI_EXPORT QThreadPool *qefi_offline_thread_pool();
+QEFI_EXPORT QFuture<quint16> qefi_get_variable_uint16_async(QUuid uuid, QString name);
+QEFI_EXPORT QFuture<QByteArray> qefi_get_variable_async(QUuid uuid, QString name);
+QEFI_EXPORT QFuture<int> qefi_set_variable_uint16_async(QUuid uuid, QString name, quint16 value);
+QEFI_EXPORT QFuture<int> qefi_set_variable_async(QUuid uuid, QString name, QByteArray value);
+
+// Result of a read submitted to QEFIAsyncReader
+struct QEFIAsyncResult
+{
+    quint64 id;
+    QEFIVariable variable;
+    int error;  // 0 or a negative errno
+};
+
+/*
+ * Reads variables without blocking the caller. With IO_URING_BACKEND on
+ * Linux, every read is chained as openat/read/close in io_uring and many
+ * of them are in flight at once, a variable filling the buffer of its
+ * read is read again through the ring into a larger one; otherwise, when
+ * io_uring is not usable at runtime or the default backend is not
+ * efivarfs, submit() reads synchronously. Either way, eventDescriptor()
+ * becomes readable once results are ready so that it can be watched by a
+ * QSocketNotifier, then takeResults() collects them.
+ */
+class QEFIAsyncReaderPrivate;
+class QEFIAsyncReader
+{
+protected:
+    QScopedPointer<QEFIAsyncReaderPrivate> d;
+public:
+    QEFIAsyncReader(int queueDepth = 64);
+    ~QEFIAsyncReader();
+
+    bool isAsynchronous() const;
+    int eventDescriptor() const;
+
+    quint64 submit(QUuid uuid, QString name);
+    QList<quint64> submit(const QList<QEFIVariableKey> &keys);
+
+    bool waitForResults(int msecs = -1);
+    QList<QEFIAsyncResult> takeResults();
+};
+
+// List the variables in one pass, optionally filtered by GUID and name prefix
+QEFI_EXPORT QList<QEFIVariableKey> qefi_list_variables(const QString &prefix = QString());
+QEFI_EXPORT QList<QEFIVariableKey> qefi_list_variables(QUuid uuid, const QString &prefix = QString());
+
+/*
+ * Storage of the variables. Every call returns 0 or a negative errno.
+ * The free functions above use the process default backend, which is the
+ * one built for the OS unless another one is set at runtime.
+ */
+class QEFIBackend
+{
+public:
+    virtual ~QEFIBackend();
+
+    virtual bool isAvailable();
+    virtual bool hasPrivilege();
+
+    virtual int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) = 0;
+    // Read at most capacity bytes, size receives the full size of the data
+    virtual int getVariableInto(const QUuid &uuid, const QString &name,
+        char *buffer, size_t capacity, size_t *size, quint32 *attributes = nullptr);
+    virtual int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) = 0;
+    virtual int deleteVariable(const QUuid &uuid, const QString &name) = 0;
+
+    // Enumerate, optionally filtered by GUID and name prefix. When sizes is
+    // given it receives the data size of each variable. -ENOSYS where the
+    // OS cannot enumerate, e.g. Windows before 8.
+    virtual int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) = 0;
+    virtual int variableSize(const QUuid &uuid, const QString &name, quint64 *size);
+    virtual int variableAttributes(const QUuid &uuid, const QString &name,
+        quint32 *attributes);
+};
+
+#if defined(Q_OS_LINUX)
+// Variables exposed by the kernel in efivarfs
+class QEFIEfivarfsBackend : public QEFIBackend
+{
+protected:
+    QString m_root;
+    QAtomicInt m_rootDescriptor;
+    QAtomicInt m_isEfivarfs;
+public:
+    // The root defaults to EFIVARFS_PATH, or /sys/firmware/efi/efivars/
+    QEFIEfivarfsBackend(const QString &root = QString());
+    ~QEFIEfivarfsBackend() override;
+
+    QString root() const;
+    // O_PATH descriptor of the root, opened on first use
+    int rootDescriptor();
+
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int getVariableInto(const QUuid &uuid, const QString &name,
+        char *buffer, size_t capacity, size_t *size, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+    int variableSize(const QUuid &uuid, const QString &name, quint64 *size) override;
+};
+#endif
+
+class QEFIAppDataBackendPrivate;
+
+// Files named "<GUID><Name>.bin" in a directory, without attributes.
+// This is the dummy backend, its directory defaults to the AppData location
+// and is resolved on first use. A packed backend keeps every variable with
+// its attributes in one "variables.fd" variable store image instead, mapped
+// once and grown when full.
+class QEFIAppDataBackend : public QEFIBackend
+{
+protected:
+    QString m_dir;
+    QScopedPointer<QEFIAppDataBackendPrivate> d;
+    bool directory(QString &dir) const;
+    QString fileName(const QString &dir, const QUuid &uuid, const QString &name) const;
+public:
+    QEFIAppDataBackend(const QString &dir = QString(), bool packed = false);
+    ~QEFIAppDataBackend() override;
+
+    bool isPacked() const;
+
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+};
+
+enum QEFIBackendOperation
+{
+    BACKEND_Get     = 0,
+    BACKEND_Set     = 1,
+    BACKEND_Delete  = 2,
+    BACKEND_List    = 3
+};
+
+class QEFIMemoryBackendPrivate;
+
+/*
+ * Variables kept in a hash map only, for tests and benchmarks. A latency
+ * can be injected per operation to stand for the firmware, e.g. 20 ms on
+ * BACKEND_Set; it is spent outside of the lock, like concurrent callers
+ * waiting on their own runtime service call.
+ */
+class QEFIMemoryBackend : public QEFIBackend
+{
+protected:
+    QScopedPointer<QEFIMemoryBackendPrivate> d;
+public:
+    QEFIMemoryBackend();
+    ~QEFIMemoryBackend() override;
+
+    void setLatency(QEFIBackendOperation operation, int usecs);
+    int latency(QEFIBackendOperation operation) const;
+    // Calls made since the creation or the last reset
+    quint64 operationCount(QEFIBackendOperation operation) const;
+    void resetOperationCounts();
+    void clear();
+
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+    int variableSize(const QUuid &uuid, const QString &name, quint64 *size) override;
+    int variableAttributes(const QUuid &uuid, const QString &name,
+        quint32 *attributes) override;
+};
+
+class QEFIVarStoreBackendPrivate;
+
+/*
+ * Variables of an edk2 variable store image, such as OVMF_VARS.fd, read
+ * and written offline through a memory mapping. Writes follow the
+ * firmware: a new record is appended and the old one marked deleted, so
+ * -ENOSPC means the store needs a reclaim. Authenticated variables are
+ * stored as given, nothing is verified.
+ * getVariable() returns a copy of the data.
+ */
+class QEFIVarStoreBackend : public QEFIBackend
+{
+protected:
+    QScopedPointer<QEFIVarStoreBackendPrivate> d;
+public:
+    QEFIVarStoreBackend();
+    ~QEFIVarStoreBackend() override;
+
+    // Formats an image holding only a variable store of at least storeSize bytes
+    static int create(const QString &fileName, quint32 storeSize = 0x40000,
+        bool authenticated = true);
+
+    int open(const QString &fileName, bool writable = false);
+    void close();
+    bool isOpen() const;
+    bool isAuthenticated() const;
+    quint64 storeSize() const;
+    quint64 usedSize() const;
+    quint64 freeSize() const;
+    // Offset in the image where the next record goes
+    quint64 endOffset() const;
+    // Point into the mapping without copying. Only valid until reclaim(),
+    // close() or open(), which move the records or unmap them.
+    const char *constData(const QUuid &uuid, const QString &name, int *size,
+        quint32 *attributes = nullptr) const;
+    // One record as stored in the variable store, padding included
+    static QByteArray encodeVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes, bool authenticated = true);
+    // Moves the live records together in one pass and erases the rest of
+    // the store, like the firmware reclaim
+    int reclaim(quint64 *reclaimed = nullptr);
+
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int getVariableInto(const QUuid &uuid, const QString &name,
+        char *buffer, size_t capacity, size_t *size, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+    int variableSize(const QUuid &uuid, const QString &name, quint64 *size) override;
+    int variableAttributes(const QUuid &uuid, const QString &name,
+        quint32 *attributes) override;
+};
+
+// Reclaims the variable store of image files, the list variant runs them
+// on the offline thread pool and returns an error code per file
+QEFI_EXPORT int qefi_varstore_reclaim(const QString &fileName, quint64 *reclaimed = nullptr);
+QEFI_EXPORT QList<int> qefi_varstore_reclaim(const QStringList &fileNames,
+    QList<quint64> *reclaimed = nullptr);
+
+enum QEFIVarStoreFormat
+{
+    VARSTORE_Unknown    = 0,
+    VARSTORE_Edk2       = 1,    // Volume of an edk2 variable store, e.g. OVMF_VARS.fd
+    VARSTORE_Json       = 2,    // JSON of python-uefivars
+    VARSTORE_AwsBlob    = 3     // EC2 UEFI data, base64 or raw
+};
+
+// Adds the description and path of load options to JSON, and indents it
+#define QEFI_VARSTORE_PRETTY    0x00000001
+
+QEFI_EXPORT QEFIVarStoreFormat qefi_varstore_format(const QString &fileName);
+// Loads the variables of a file into a backend, usually a QEFIMemoryBackend.
+// The format is detected when VARSTORE_Unknown is given. EC2 blobs
+// compressed with a preset zlib dictionary return -ENOTSUP.
+QEFI_EXPORT int qefi_varstore_import(const QString &fileName, QEFIBackend &variables,
+    QEFIVarStoreFormat format = VARSTORE_Unknown);
+QEFI_EXPORT int qefi_varstore_export(QEFIBackend &variables, const QString &fileName,
+    QEFIVarStoreFormat format, int flags = 0);
+QEFI_EXPORT int qefi_varstore_convert(const QString &input, const QString &output,
+    QEFIVarStoreFormat format, int flags = 0);
+// Converts files into a directory, keeping their base names, on the
+// offline thread pool. Returns an error code per file, -EEXIST for an
+// input whose base name was already taken by a previous one.
+QEFI_EXPORT QList<int> qefi_varstore_convert(const QStringList &inputs,
+    const QString &outputDir, QEFIVarStoreFormat format, int flags = 0);
+
+class QEFILoadOption;
+
+// Boot entries of one image provisioned from a template
+class QEFIProvisionImage
+{
+protected:
+    QString m_fileName;
+    QMap<quint16, QByteArray> m_bootEntries;
+    QList<quint16> m_bootOrder;
+public:
+    QEFIProvisionImage(const QString &fileName = QString());
+
+    QString fileName() const;
+    void setFileName(const QString &fileName);
+
+    // Encoded with QEFILoadOption::format(), return false if it is invalid
+    bool addBootEntry(quint16 id, QEFILoadOption &option);
+    QMap<quint16, QByteArray> bootEntries() const;
+
+    QList<quint16> bootOrder() const;
+    void setBootOrder(const QList<quint16> &bootOrder);
+};
+
+class QEFIProvisionerPrivate;
+
+/*
+ * Stamps out variable store images from a template. The template records
+ * are encoded once without their Boot#### and BootOrder variables; every
+ * image is that shared prefix followed by its own boot records, written
+ * to the file in one sequential write.
+ */
+class QEFIProvisioner
+{
+protected:
+    QScopedPointer<QEFIProvisionerPrivate> d;
+public:
+    QEFIProvisioner();
+    ~QEFIProvisioner();
+
+    // An edk2 image such as OVMF_VARS.fd, return 0 or a negative errno
+    int setTemplate(const QString &fileName);
+    int provision(const QEFIProvisionImage &image) const;
+    // Runs on the offline thread pool, returns an error code per image
+    QList<int> provision(const QList<QEFIProvisionImage> &images) const;
+
+    /*
+     * A JSON manifest:
+     * { "images": [ { "file": "vm0.fd", "bootOrder": [ 1 ], "entries": [
+     *     { "id": 1, "description": "...", "devicePath": "<hex>",
+     *       "optionalData": "<hex>", "active": true } ] } ] }
+     * with the device path list in its binary form, and file names
+     * relative to the manifest.
+     */
+    static int loadManifest(const QString &fileName, QList<QEFIProvisionImage> &images);
+};
+
+// The backend built for the OS, or the AppData one in a dummy build
+QEFI_EXPORT QEFIBackend *qefi_system_backend();
+// Backend of the free functions. The backend is not owned, it has to
+// outlive its use; nullptr restores the system backend.
+QEFI_EXPORT QEFIBackend *qefi_default_backend();
+QEFI_EXPORT void qefi_set_default_backend(QEFIBackend *backend);
+
+class QEFIContextPrivate;
+
+/*
+ * A backend with its own caches, for callers that need state of their own
+ * instead of the process wide one. The root of a context is its efivarfs
+ * directory on Linux and its AppData directory elsewhere; the descriptors
+ * of the root are opened once and shared. A context is safe to use from
+ * several threads. The default context follows qefi_default_backend() and
+ * serves the calls without a context.
+ */
+class QEFIContext
+{
+protected:
+    QScopedPointer<QEFIContextPrivate> d;
+public:
+    // The backend is not owned, nullptr follows qefi_default_backend()
+    QEFIContext(QEFIBackend *backend = nullptr);
+    QEFIContext(const QString &root);
+    ~QEFIContext();
+
+    QEFIBackend *backend() const;
+    // Empty unless the context was created for a root
+    QString root() const;
+
+    // Cache of qefi_write_variable_if_changed() in this context
+    void clearWriteCache();
+    QEFIWriteCounters writeCounters() const;
+    void resetWriteCounters();
+
+private:
+    Q_DISABLE_COPY(QEFIContext)
+    friend class QEFIContextPrivate;
+};
+
+QEFI_EXPORT QEFIContext *qefi_default_context();
+
+#if defined(Q_OS_UNIX)
+// Credentials of a broker client, from the socket
+struct QEFIBrokerPeer
+{
+    qint64 pid;     // -1 where the OS does not report it
+    quint32 uid;
+    quint32 gid;
+};
+
+class QEFIBrokerServerPrivate;
+
+/*
+ * Serves the variables of a backend to unprivileged local clients over a
+ * Unix socket: batched reads and enumerations from a cache kept warm
+ * across clients, and writes once allowed by the policy. Up to 64 clients
+ * are served at once on their own threads, the connections beyond are
+ * closed and a client idle for 30 seconds is dropped. Writes through the
+ * broker drop the cached value, the ones made behind its back are seen
+ * once the cached value is older than cacheTtl() or after clearCache().
+ */
+class QEFIBrokerServer
+{
+protected:
+    QScopedPointer<QEFIBrokerServerPrivate> d;
+
+    // Policy, every client may read and only root or the broker user write
+    virtual bool allowRead(const QEFIBrokerPeer &peer, const QUuid &uuid,
+        const QString &name);
+    virtual bool allowWrite(const QEFIBrokerPeer &peer, const QUuid &uuid,
+        const QString &name);
+public:
+    // The backend is not owned, nullptr uses qefi_default_backend()
+    QEFIBrokerServer(QEFIBackend *backend = nullptr);
+    virtual ~QEFIBrokerServer();
+
+    // Bind the socket with the given mode and serve, return 0 or a negative errno
+    int listen(const QString &path, int mode = 0666);
+    void close();
+    bool isListening() const;
+    QString path() const;
+
+    void clearCache();
+    // Milliseconds a read is served from the cache, 1000 by default. 0 turns
+    // the cache off, a negative value keeps values until written or cleared.
+    void setCacheTtl(int msecs);
+    int cacheTtl() const;
+    quint64 requestCount() const;
+    quint64 cacheHitCount() const;
+
+private:
+    Q_DISABLE_COPY(QEFIBrokerServer)
+    friend class QEFIBrokerServerPrivate;
+};
+
+class QEFIBrokerBackendPrivate;
+
+// Client of a QEFIBrokerServer, connected on first use. Writes refused by
+// the policy of the broker fail with -EPERM. A write whose answer was lost
+// is not sent again, it fails with -ECONNRESET and may have been made.
+class QEFIBrokerBackend : public QEFIBackend
+{
+protected:
+    QScopedPointer<QEFIBrokerBackendPrivate> d;
+public:
+    QEFIBrokerBackend(const QString &path);
+    ~QEFIBrokerBackend() override;
+
+    // Several variables in one round trip, in the order of keys
+    int getVariables(const QList<QEFIVariableKey> &keys, QList<QEFIVariable> &variables,
+        QList<int> *errors = nullptr);
+
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+};
+#endif
+
+class QEFISharedSnapshotPublisherPrivate;
+
+/*
+ * Publishes a few variables into a shared memory file, e.g. on /dev/shm,
+ * for QEFISharedSnapshotBackend readers in other processes. Every publish
+ * rewrites the region under a sequence lock: readers never block the
+ * publisher and retry when they raced with it.
+ */
+class QEFISharedSnapshotPublisher
+{
+protected:
+    QScopedPointer<QEFISharedSnapshotPublisherPrivate> d;
+public:
+    // The backend is not owned, nullptr uses qefi_default_backend()
+    QEFISharedSnapshotPublisher(QEFIBackend *backend = nullptr);
+    ~QEFISharedSnapshotPublisher();
+
+    // Create or reuse the file with a fixed capacity, return 0 or a negative errno.
+    // The variables of a publisher that died while publishing are dropped.
+    int create(const QString &fileName, quint32 capacity = 0x10000);
+    void close();
+    bool isOpen() const;
+
+    // The variables read from the backend by publish()
+    void setKeys(const QList<QEFIVariableKey> &keys);
+    QList<QEFIVariableKey> keys() const;
+
+    // Variables that cannot be read are left out. Return 0, or -ENOSPC
+    // when they do not fit the capacity, then nothing is published.
+    int publish();
+    int publish(const QList<QEFIVariable> &variables);
+    // Changes on every publish
+    quint32 sequence() const;
+};
+
+class QEFISharedSnapshotBackendPrivate;
+
+// Read-only view of a QEFISharedSnapshotPublisher region. Lookups are done
+// in the mapping without locks or syscalls; getVariableInto() does not
+// allocate either.
+class QEFISharedSnapshotBackend : public QEFIBackend
+{
+protected:
+    QScopedPointer<QEFISharedSnapshotBackendPrivate> d;
+public:
+    QEFISharedSnapshotBackend(const QString &fileName = QString());
+    ~QEFISharedSnapshotBackend() override;
+
+    int open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+    quint32 sequence() const;
+
+    bool isAvailable() override;
+    bool hasPrivilege() override;
+    int getVariable(const QUuid &uuid, const QString &name,
+        QByteArray &data, quint32 *attributes = nullptr) override;
+    int getVariableInto(const QUuid &uuid, const QString &name,
+        char *buffer, size_t capacity, size_t *size, quint32 *attributes = nullptr) override;
+    // Read-only, -EROFS
+    int setVariable(const QUuid &uuid, const QString &name,
+        const QByteArray &data, quint32 attributes) override;
+    int deleteVariable(const QUuid &uuid, const QString &name) override;
+    int listVariables(QList<QEFIVariableKey> &variables,
+        QList<quint64> *sizes = nullptr, const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) override;
+    int variableSize(const QUuid &uuid, const QString &name, quint64 *size) override;
+    int variableAttributes(const QUuid &uuid, const QString &name,
+        quint32 *attributes) override;
+};
+
+class QEFIRootSetPrivate;
+
+/*
+ * Contexts for several roots, such as the efivarfs trees of containers or
+ * chroots, queried together. Each root has its own context and caches;
+ * the calls below run one task per root on a thread pool of the set, so
+ * they may be called from the asynchronous calls, and return their
+ * results by root.
+ */
+class QEFIRootSet
+{
+protected:
+    QScopedPointer<QEFIRootSetPrivate> d;
+public:
+    QEFIRootSet();
+    ~QEFIRootSet();
+
+    // The context of a root, created on first use and kept by the set
+    QSharedPointer<QEFIContext> addRoot(const QString &root);
+    void removeRoot(const QString &root);
+    QStringList roots() const;
+    QSharedPointer<QEFIContext> context(const QString &root) const;
+
+    QMap<QString, QList<QEFIVariableKey> > listVariables(const QUuid *uuid = nullptr,
+        const QString &prefix = QString()) const;
+    // A null variable where it cannot be read
+    QMap<QString, QEFIVariable> readVariable(QUuid uuid, QString name) const;
+    QMap<QString, QList<QEFIVariable> > readVariables(const QList<QEFIVariableKey> &keys) const;
+
+private:
+    Q_DISABLE_COPY(QEFIRootSet)
+};
+
+// The calls above, in a context
+QEFI_EXPORT quint16 qefi_get_variable_uint16(QEFIContext &context, QUuid uuid, QString name);
+QEFI_EXPORT QByteArray qefi_get_variable(QEFIContext &context, QUuid uuid, QString name);
+QEFI_EXPORT int qefi_get_variable_into(QEFIContext &context, QUuid uuid, QString name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes = nullptr);
+QEFI_EXPORT int qefi_get_variable_into(QEFIContext &context, QUuid uuid, QString name,
+    QByteArray &buffer, quint32 *attributes = nullptr);
+QEFI_EXPORT void qefi_set_variable_uint16(QEFIContext &context, QUuid uuid, QString name,
+    quint16 value);
+QEFI_EXPORT void qefi_set_variable(QEFIContext &context, QUuid uuid, QString name,
+    QByteArray value);
+QEFI_EXPORT QEFIVariable qefi_read_variable(QEFIContext &context, QUuid uuid, QString name,
+    int *error = nullptr);
+QEFI_EXPORT int qefi_write_variable(QEFIContext &context, const QEFIVariable &variable);
+QEFI_EXPORT int qefi_delete_variable(QEFIContext &context, QUuid uuid, QString name);
+QEFI_EXPORT int qefi_write_variable_if_changed(QEFIContext &context,
+    const QEFIVariable &variable);
+QEFI_EXPORT QList<QEFIVariableKey> qefi_list_variables(QEFIContext &context,
+    const QString &prefix = QString());
+QEFI_EXPORT QList<QEFIVariableKey> qefi_list_variables(QEFIContext &context, QUuid uuid,
+    const QString &prefix = QString());
+
 QEFI_EXPORT QString qefi_extract_name(const QByteArray &data);
 QEFI_EXPORT QString qefi_extract_path(const QByteArray &data);
 QEFI_EXPORT QByteArray qefi_extract_optional_data(const QByteArray &data);
@@ -0,0 +1,147 @@
+#include "qefi.h"
+
+#include <QtEndian>
+#include <QSet>
+
+#include <cerrno>
+#include <cstring>
+
+// EFI_SIGNATURE_LIST: SignatureType, SignatureListSize, SignatureHeaderSize, SignatureSize
+#define QEFI_SIGNATURE_LIST_HEADER_SIZE 28
+// EFI_SIGNATURE_DATA starts with the SignatureOwner GUID
+#define QEFI_SIGNATURE_OWNER_SIZE 16
+// EFI_VARIABLE_AUTHENTICATION_2: EFI_TIME, then WIN_CERTIFICATE_UEFI_GUID
+#define QEFI_EFI_TIME_SIZE 16
+#define QEFI_WIN_CERTIFICATE_UEFI_GUID_SIZE 24
+
+struct QEFISignatureList
+{
+    const char *list;
+    quint32 headerSize;
+    quint32 signatureSize;
+    quint32 count;
+
+    const char *type() const { return list; }
+    const char *header() const { return list + QEFI_SIGNATURE_LIST_HEADER_SIZE; }
+    const char *signature(quint32 index) const
+    {
+        return header() + headerSize + index * signatureSize;
+    }
+};
+
+static bool qefi_parse_signature_lists(const char *data, int size,
+    QList<QEFISignatureList> &lists)
+{
+    int offset = 0;
+    while (offset < size) {
+        if (size - offset < QEFI_SIGNATURE_LIST_HEADER_SIZE) return false;
+
+        const char *list = data + offset;
+        const quint32 listSize = qFromLittleEndian<quint32>(list + 16);
+        const quint32 headerSize = qFromLittleEndian<quint32>(list + 20);
+        const quint32 signatureSize = qFromLittleEndian<quint32>(list + 24);
+        if (listSize > (quint32)(size - offset) ||
+            signatureSize <= QEFI_SIGNATURE_OWNER_SIZE ||
+            listSize < QEFI_SIGNATURE_LIST_HEADER_SIZE ||
+            listSize - QEFI_SIGNATURE_LIST_HEADER_SIZE < headerSize) return false;
+
+        const quint32 signaturesSize = listSize -
+            QEFI_SIGNATURE_LIST_HEADER_SIZE - headerSize;
+        if (signaturesSize % signatureSize != 0) return false;
+
+        QEFISignatureList parsed;
+        parsed.list = list;
+        parsed.headerSize = headerSize;
+        parsed.signatureSize = signatureSize;
+        parsed.count = signaturesSize / signatureSize;
+        lists.append(parsed);
+
+        offset += listSize;
+    }
+    return true;
+}
+
+// Entries match like in the firmware: same SignatureType, same bytes
+// including the SignatureOwner
+static QByteArray qefi_signature_key(const QEFISignatureList &list, quint32 index)
+{
+    QByteArray key(16 + list.signatureSize, Qt::Uninitialized);
+    memcpy(key.data(), list.type(), 16);
+    memcpy(key.data() + 16, list.signature(index), list.signatureSize);
+    return key;
+}
+
+// Size of the EFI_VARIABLE_AUTHENTICATION_2 descriptor, or -1
+static int qefi_authentication_2_size(const QByteArray &payload)
+{
+    if (payload.size() < QEFI_EFI_TIME_SIZE + QEFI_WIN_CERTIFICATE_UEFI_GUID_SIZE)
+        return -1;
+    // WIN_CERTIFICATE.dwLength covers the whole certificate
+    const quint32 length = qFromLittleEndian<quint32>(
+        payload.constData() + QEFI_EFI_TIME_SIZE);
+    if (length < QEFI_WIN_CERTIFICATE_UEFI_GUID_SIZE ||
+        length > (quint32)(payload.size() - QEFI_EFI_TIME_SIZE)) return -1;
+    return QEFI_EFI_TIME_SIZE + length;
+}
+
+int qefi_append_variable(QUuid uuid, QString name, QByteArray payload,
+    quint32 attributes)
+{
+    const bool authenticated =
+        attributes & QEFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS;
+    int offset = 0;
+    if (authenticated) {
+        offset = qefi_authentication_2_size(payload);
+        if (offset < 0) return -EINVAL;
+    }
+
+    QList<QEFISignatureList> lists;
+    if (!qefi_parse_signature_lists(payload.constData() + offset,
+            payload.size() - offset, lists)) return -EINVAL;
+
+    int error;
+    QEFIVariable stored = qefi_read_variable(uuid, name, &error);
+    if (stored.isNull() && error != -ENOENT) return error;
+
+    // A stored value that cannot be parsed is left to the firmware
+    QSet<QByteArray> present;
+    QList<QEFISignatureList> storedLists;
+    const QByteArray storedData = stored.data();
+    if (qefi_parse_signature_lists(storedData.constData(), storedData.size(),
+            storedLists)) {
+        for (const QEFISignatureList &list : std::as_const(storedLists)) {
+            for (quint32 i = 0; i < list.count; i++)
+                present.insert(qefi_signature_key(list, i));
+        }
+    }
+
+    // Rebuild the lists with the missing entries only
+    QByteArray appended;
+    for (const QEFISignatureList &list : std::as_const(lists)) {
+        QList<quint32> missing;
+        for (quint32 i = 0; i < list.count; i++) {
+            const QByteArray key = qefi_signature_key(list, i);
+            if (present.contains(key)) continue;
+            present.insert(key);
+            missing.append(i);
+        }
+        if (missing.isEmpty()) continue;
+
+        const quint32 listSize = QEFI_SIGNATURE_LIST_HEADER_SIZE +
+            list.headerSize + missing.size() * list.signatureSize;
+        const int start = appended.size();
+        appended.append(list.list, QEFI_SIGNATURE_LIST_HEADER_SIZE + list.headerSize);
+        qToLittleEndian<quint32>(listSize, appended.data() + start + 16);
+        for (quint32 index : std::as_const(missing))
+            appended.append(list.signature(index), list.signatureSize);
+    }
+
+    // Nothing new for the firmware
+    if (appended.isEmpty()) return 0;
+
+    // The signature covers the original lists, send them untouched
+    if (authenticated) appended = payload;
+
+    return qefi_write_variable(QEFIVariable(uuid, name, appended,
+        attributes | QEFI_VARIABLE_APPEND_WRITE));
+}
@@ -0,0 +1,491 @@
+#include "qefi.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFutureInterface>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QtEndian>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+}
+#endif
+
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+extern "C" {
+#include <liburing.h>
+}
+
+// Utilities in qefi.cpp
+void make_efivarfs_name(const QUuid &guid, const QString &name, QByteArray &entry);
+
+// Enough for boot entries, larger variables such as db are read again
+// through the ring with a buffer QEFI_ASYNC_READ_GROWTH times larger
+#define QEFI_ASYNC_READ_SIZE 4096
+#define QEFI_ASYNC_READ_GROWTH 4
+
+enum QEFIAsyncOperation
+{
+    ASYNC_Open = 0,
+    ASYNC_Read = 1,
+    ASYNC_Close = 2
+};
+
+// A read waiting for a slot
+struct QEFIAsyncQueued
+{
+    quint64 id;
+    QEFIVariableKey key;
+    int readSize;   // Of the data, without the Attributes field
+};
+
+struct QEFIAsyncRequest
+{
+    quint64 id;
+    QUuid uuid;
+    QString name;
+    QByteArray path;
+    QByteArray data;    // Attributes field followed by the data
+    int readSize;
+    int bytes;
+    int error;
+    int pending;    // Completions still expected for the chain
+};
+#endif
+
+class QEFIAsyncReaderPrivate
+{
+public:
+    quint64 nextId = 1;
+    int eventFd = -1;
+    QList<QEFIAsyncResult> completed;
+
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    bool ringReady = false;
+    int rootFd = -1;
+    struct io_uring ring;
+    // One slot per registered file, the slot index is the direct descriptor
+    QVector<QEFIAsyncRequest> requests;
+    QVector<int> freeSlots;
+    QList<QEFIAsyncQueued> queued;
+    int inflight = 0;
+
+    void setupRing(int queueDepth);
+    void submitQueued();
+    void reapCompletions();
+    void complete(int slot);
+#endif
+
+    void notify();
+};
+
+void QEFIAsyncReaderPrivate::notify()
+{
+#ifdef Q_OS_LINUX
+    if (eventFd >= 0 && !completed.isEmpty()) eventfd_write(eventFd, 1);
+#endif
+}
+
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+static inline quint64 qefi_async_user_data(int slot, QEFIAsyncOperation op)
+{
+    return ((quint64)slot << 2) | op;
+}
+
+void QEFIAsyncReaderPrivate::setupRing(int queueDepth)
+{
+    // Only files of efivarfs can be read through the ring
+    QEFIEfivarfsBackend *efivarfs =
+        dynamic_cast<QEFIEfivarfsBackend *>(qefi_default_backend());
+    if (!efivarfs || (rootFd = efivarfs->rootDescriptor()) < 0) return;
+
+    // Every read takes three entries: openat, read and close
+    if (io_uring_queue_init(queueDepth * 3, &ring, 0) < 0) {
+        qWarning() << "io_uring is not available, reading synchronously";
+        return;
+    }
+
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+    bool supported = probe &&
+        io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+        io_uring_opcode_supported(probe, IORING_OP_READ) &&
+        io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+    if (probe) io_uring_free_probe(probe);
+
+    // Direct descriptors let the chain pass the file without a round trip
+    if (!supported ||
+        io_uring_register_files_sparse(&ring, queueDepth) < 0 ||
+        (eventFd >= 0 && io_uring_register_eventfd(&ring, eventFd) < 0)) {
+        qWarning() << "io_uring lacks direct descriptors, reading synchronously";
+        io_uring_queue_exit(&ring);
+        return;
+    }
+
+    requests.resize(queueDepth);
+    for (int slot = queueDepth - 1; slot >= 0; slot--) freeSlots.append(slot);
+    ringReady = true;
+}
+
+void QEFIAsyncReaderPrivate::submitQueued()
+{
+    int prepared = 0;
+
+    while (!queued.isEmpty() && !freeSlots.isEmpty() &&
+           io_uring_sq_space_left(&ring) >= 3) {
+        const QEFIAsyncQueued entry = queued.takeFirst();
+        int slot = freeSlots.takeLast();
+
+        QEFIAsyncRequest &request = requests[slot];
+        request.id = entry.id;
+        request.uuid = entry.key.first;
+        request.name = entry.key.second;
+        make_efivarfs_name(request.uuid, request.name, request.path);
+        request.readSize = entry.readSize;
+        request.data.resize(sizeof(quint32) + entry.readSize);
+        request.bytes = 0;
+        request.error = 0;
+        request.pending = 3;
+
+        // A failed open cancels the read, the close always runs after the read.
+        // efivarfs fetches the whole variable on each read, so it is one read.
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_openat_direct(sqe, rootFd, request.path.constData(),
+            O_RDONLY, 0, slot);
+        io_uring_sqe_set_data(sqe, (void *)(quintptr)qefi_async_user_data(slot, ASYNC_Open));
+        sqe->flags |= IOSQE_IO_LINK;
+
+        sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read(sqe, slot, request.data.data(), request.data.size(), 0);
+        io_uring_sqe_set_data(sqe, (void *)(quintptr)qefi_async_user_data(slot, ASYNC_Read));
+        sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+        sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_close_direct(sqe, slot);
+        io_uring_sqe_set_data(sqe, (void *)(quintptr)qefi_async_user_data(slot, ASYNC_Close));
+
+        prepared++;
+        inflight++;
+    }
+
+    if (prepared > 0) io_uring_submit(&ring);
+}
+
+void QEFIAsyncReaderPrivate::reapCompletions()
+{
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+        int slot = (int)(cqe->user_data >> 2);
+        QEFIAsyncOperation op = (QEFIAsyncOperation)(cqe->user_data & 0x3);
+        QEFIAsyncRequest &request = requests[slot];
+
+        if (cqe->res < 0 && cqe->res != -ECANCELED && request.error == 0)
+            request.error = cqe->res;
+        if (op == ASYNC_Read && cqe->res >= 0)
+            request.bytes = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        if (--request.pending == 0) complete(slot);
+    }
+}
+
+void QEFIAsyncReaderPrivate::complete(int slot)
+{
+    QEFIAsyncRequest &request = requests[slot];
+    QEFIAsyncResult result;
+    result.id = request.id;
+    result.error = 0;
+
+    int size = request.bytes - (int)sizeof(quint32);
+    if (request.error != 0) {
+        result.error = request.error;
+    } else if (size < 0) {
+        result.error = -EIO;
+    } else if (size == request.readSize) {
+        // The buffer is full, the variable may be larger than it. Read it
+        // again ahead of the queue rather than blocking the caller.
+        if (request.readSize > (INT_MAX - (int)sizeof(quint32)) / QEFI_ASYNC_READ_GROWTH) {
+            result.error = -EOVERFLOW;
+        } else {
+            queued.prepend({ request.id, QEFIVariableKey(request.uuid, request.name),
+                request.readSize * QEFI_ASYNC_READ_GROWTH });
+            request.data = QByteArray();
+            freeSlots.append(slot);
+            inflight--;
+            return;
+        }
+    } else {
+        // Hand the buffer over, the next request allocates its own
+        quint32 attributes;
+        memcpy(&attributes, request.data.constData(), sizeof(quint32));
+        request.data.resize(request.bytes);
+        request.data.remove(0, sizeof(quint32));
+        result.variable = QEFIVariable(request.uuid, request.name,
+            request.data, attributes);
+        request.data = QByteArray();
+    }
+
+    completed.append(result);
+    freeSlots.append(slot);
+    inflight--;
+}
+#endif
+
+QEFIAsyncReader::QEFIAsyncReader(int queueDepth)
+    : d(new QEFIAsyncReaderPrivate)
+{
+#ifdef Q_OS_LINUX
+    d->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    if (queueDepth > 0) d->setupRing(queueDepth);
+#else
+    Q_UNUSED(queueDepth);
+#endif
+}
+
+QEFIAsyncReader::~QEFIAsyncReader()
+{
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    if (d->ringReady) {
+        // The kernel may still write into the buffers of in-flight reads
+        while (d->inflight > 0) {
+            struct io_uring_cqe *cqe;
+            if (io_uring_wait_cqe(&d->ring, &cqe) < 0) break;
+            d->reapCompletions();
+        }
+        io_uring_queue_exit(&d->ring);
+    }
+#endif
+#ifdef Q_OS_LINUX
+    if (d->eventFd >= 0) close(d->eventFd);
+#endif
+}
+
+bool QEFIAsyncReader::isAsynchronous() const
+{
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    return d->ringReady;
+#else
+    return false;
+#endif
+}
+
+int QEFIAsyncReader::eventDescriptor() const
+{
+    return d->eventFd;
+}
+
+quint64 QEFIAsyncReader::submit(QUuid uuid, QString name)
+{
+    QList<QEFIVariableKey> keys;
+    keys.append(QEFIVariableKey(uuid, name));
+    return submit(keys).first();
+}
+
+QList<quint64> QEFIAsyncReader::submit(const QList<QEFIVariableKey> &keys)
+{
+    QList<quint64> ids;
+    for (const QEFIVariableKey &key : keys) {
+        quint64 id = d->nextId++;
+        ids.append(id);
+
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+        if (d->ringReady) {
+            d->queued.append({ id, key, QEFI_ASYNC_READ_SIZE });
+            continue;
+        }
+#endif
+        // Synchronous fallback
+        QEFIAsyncResult result;
+        result.id = id;
+        result.variable = qefi_read_variable(key.first, key.second,
+            &result.error);
+        d->completed.append(result);
+    }
+
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    if (d->ringReady) {
+        d->submitQueued();
+        return ids;
+    }
+#endif
+    d->notify();
+    return ids;
+}
+
+bool QEFIAsyncReader::waitForResults(int msecs)
+{
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    if (d->ringReady) {
+        d->reapCompletions();
+        d->submitQueued();
+    }
+#endif
+    if (!d->completed.isEmpty()) return true;
+
+#ifdef Q_OS_LINUX
+    if (d->eventFd >= 0) {
+        struct pollfd pfd;
+        pfd.fd = d->eventFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, msecs) <= 0) return false;
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+        if (d->ringReady) {
+            d->reapCompletions();
+            d->submitQueued();
+        }
+#endif
+    }
+#else
+    Q_UNUSED(msecs);
+#endif
+    return !d->completed.isEmpty();
+}
+
+QList<QEFIAsyncResult> QEFIAsyncReader::takeResults()
+{
+#ifdef Q_OS_LINUX
+    // Rearm the notification before collecting
+    eventfd_t value;
+    if (d->eventFd >= 0) eventfd_read(d->eventFd, &value);
+#endif
+#if defined(QEFI_USE_IO_URING) && !defined(EFIVAR_APP_DATA_DUMMY)
+    if (d->ringReady) {
+        d->reapCompletions();
+        // Slots were released, feed the reads that were waiting
+        d->submitQueued();
+    }
+#endif
+
+    QList<QEFIAsyncResult> results;
+    results.swap(d->completed);
+    return results;
+}
+
+/* Future based API */
+class QEFIThreadPool : public QThreadPool
+{
+public:
+    QEFIThreadPool()
+    {
+        // Runtime services are serialized by the kernel, more threads
+        // would only queue behind the firmware
+        setMaxThreadCount(QEFI_ASYNC_MAX_THREADS);
+    }
+};
+
+Q_GLOBAL_STATIC(QEFIThreadPool, qefi_global_thread_pool)
+
+QThreadPool *qefi_thread_pool()
+{
+    return qefi_global_thread_pool();
+}
+
+class QEFIOfflineThreadPool : public QThreadPool
+{
+public:
+    QEFIOfflineThreadPool()
+    {
+        // Image files only cost disk and CPU time
+        setMaxThreadCount(QThread::idealThreadCount());
+    }
+};
+
+Q_GLOBAL_STATIC(QEFIOfflineThreadPool, qefi_global_offline_thread_pool)
+
+QThreadPool *qefi_offline_thread_pool()
+{
+    return qefi_global_offline_thread_pool();
+}
+
+// Writes waiting for each variable, the head is the one being written
+struct QEFIOrderedWrite
+{
+    QEFIVariable variable;
+    QFutureInterface<int> promise;
+};
+
+static QMutex qefi_write_queue_mutex;
+static QHash<QEFIVariableKey, QList<QEFIOrderedWrite> > qefi_write_queues;
+
+/*
+ * A pool task writes the head of the queue of one variable, then queues
+ * itself again for the next one. A burst of writes to a variable thus takes
+ * one pool thread at a time and never blocks it waiting for another write.
+ */
+static void qefi_write_next(const QEFIVariableKey &key)
+{
+    QEFIOrderedWrite write;
+    {
+        QMutexLocker locker(&qefi_write_queue_mutex);
+        write = qefi_write_queues.value(key).first();
+    }
+
+    write.promise.reportResult(qefi_write_variable(write.variable));
+    write.promise.reportFinished();
+
+    QMutexLocker locker(&qefi_write_queue_mutex);
+    QList<QEFIOrderedWrite> &queue = qefi_write_queues[key];
+    queue.removeFirst();
+    if (queue.isEmpty()) {
+        qefi_write_queues.remove(key);
+        return;
+    }
+    QtConcurrent::run(qefi_thread_pool(), [key]() { qefi_write_next(key); });
+}
+
+static QFuture<int> qefi_write_variable_ordered(const QEFIVariable &variable)
+{
+    QEFIVariableKey key(variable.guid(), variable.name());
+    QEFIOrderedWrite write;
+    write.variable = variable;
+    write.promise.reportStarted();
+
+    QMutexLocker locker(&qefi_write_queue_mutex);
+    QList<QEFIOrderedWrite> &queue = qefi_write_queues[key];
+    queue.append(write);
+    // Otherwise the task of the variable is already on its way
+    if (queue.size() == 1)
+        QtConcurrent::run(qefi_thread_pool(), [key]() { qefi_write_next(key); });
+
+    return write.promise.future();
+}
+
+QFuture<quint16> qefi_get_variable_uint16_async(QUuid uuid, QString name)
+{
+    return QtConcurrent::run(qefi_thread_pool(), [uuid, name]() {
+        return qefi_get_variable_uint16(uuid, name);
+    });
+}
+
+QFuture<QByteArray> qefi_get_variable_async(QUuid uuid, QString name)
+{
+    return QtConcurrent::run(qefi_thread_pool(), [uuid, name]() {
+        return qefi_get_variable(uuid, name);
+    });
+}
+
+QFuture<int> qefi_set_variable_uint16_async(QUuid uuid, QString name, quint16 value)
+{
+    QByteArray data(sizeof(quint16), Qt::Uninitialized);
+    qToLittleEndian<quint16>(value, data.data());
+    return qefi_write_variable_ordered(QEFIVariable(uuid, name, data));
+}
+
+QFuture<int> qefi_set_variable_async(QUuid uuid, QString name, QByteArray value)
+{
+    return qefi_write_variable_ordered(QEFIVariable(uuid, name, value));
+}
@@ -0,0 +1,730 @@
+#include "qefi.h"
+
+#if defined(Q_OS_UNIX)
+#include <QAtomicInteger>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QReadWriteLock>
+#include <QRunnable>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QWriteLocker>
+#include <QtEndian>
+
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+#define BROKER_MAX_CLIENTS      64
+#define BROKER_MAX_MESSAGE      (16 * 1024 * 1024)
+#define BROKER_CACHE_TTL        1000
+// A client has this long to send its next request and read the response
+#define BROKER_CLIENT_TIMEOUT   30000
+#define BROKER_STREAM_VERSION   QDataStream::Qt_5_6
+
+#if defined(MSG_NOSIGNAL)
+#define BROKER_SEND_FLAGS       MSG_NOSIGNAL
+#else
+#define BROKER_SEND_FLAGS       0
+#endif
+
+enum QEFIBrokerOperation
+{
+    BROKER_Get          = 1,
+    BROKER_List         = 2,
+    BROKER_Set          = 3,
+    BROKER_Delete       = 4,
+    BROKER_Privilege    = 5
+};
+
+// A negative timeout waits forever, otherwise it is counted from timer
+static int broker_read_full(int fd, char *buffer, size_t size,
+    const QElapsedTimer &timer, int timeout)
+{
+    while (size > 0) {
+        if (timeout >= 0) {
+            const qint64 left = timeout - timer.elapsed();
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int ready = left > 0 ? poll(&pfd, 1, (int)left) : 0;
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready < 0) return -errno;
+            if (ready == 0) return -ETIMEDOUT;
+        }
+        ssize_t count = recv(fd, buffer, size, 0);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) return -errno;
+        if (count == 0) return -ECONNRESET;
+        buffer += count;
+        size -= count;
+    }
+    return 0;
+}
+
+static int broker_write_full(int fd, const char *buffer, size_t size)
+{
+    while (size > 0) {
+        ssize_t count = send(fd, buffer, size, BROKER_SEND_FLAGS);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) return -errno;
+        buffer += count;
+        size -= count;
+    }
+    return 0;
+}
+
+// Messages are a little endian length followed by a QDataStream body, the
+// whole of it is read within timeout milliseconds
+static int broker_read_message(int fd, QByteArray &message, int timeout = -1)
+{
+    QElapsedTimer timer;
+    timer.start();
+    char header[sizeof(quint32)];
+    int error = broker_read_full(fd, header, sizeof(header), timer, timeout);
+    if (error != 0) return error;
+
+    const quint32 size = qFromLittleEndian<quint32>(header);
+    if (size > BROKER_MAX_MESSAGE) return -EMSGSIZE;
+    message.resize(size);
+    return broker_read_full(fd, message.data(), size, timer, timeout);
+}
+
+static int broker_write_message(int fd, const QByteArray &message)
+{
+    // One send for the header and the body
+    QByteArray frame(sizeof(quint32), Qt::Uninitialized);
+    qToLittleEndian<quint32>(message.size(), frame.data());
+    frame.append(message);
+    return broker_write_full(fd, frame.constData(), frame.size());
+}
+
+static int broker_socket_address(const QString &path, struct sockaddr_un &address)
+{
+    const QByteArray encoded = QFile::encodeName(path);
+    if (encoded.size() >= (int)sizeof(address.sun_path)) return -ENAMETOOLONG;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, encoded.constData(), encoded.size());
+    return 0;
+}
+
+static QEFIBrokerPeer broker_peer(int fd)
+{
+    QEFIBrokerPeer peer = { -1, (quint32)-1, (quint32)-1 };
+#if defined(SO_PEERCRED)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+        peer.pid = credentials.pid;
+        peer.uid = credentials.uid;
+        peer.gid = credentials.gid;
+    }
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) == 0) {
+        peer.uid = uid;
+        peer.gid = gid;
+    }
+#endif
+    return peer;
+}
+
+/* Server */
+struct QEFIBrokerCacheEntry
+{
+    QEFIVariable variable;
+    qint64 cached;      // Clock of the server when read from the backend
+};
+
+class QEFIBrokerServerPrivate
+{
+public:
+    QEFIBrokerServer *q;
+    QEFIBackend *backend;
+    QString path;
+    int listenFd = -1;
+    int wakeFds[2] = { -1, -1 };
+    QThread *acceptThread = nullptr;
+    QThreadPool pool;
+
+    QMutex clientsMutex;
+    QSet<int> clients;
+
+    QReadWriteLock cacheLock;
+    QHash<QEFIVariableKey, QEFIBrokerCacheEntry> cache;
+    // Bumped under cacheLock by every invalidation
+    quint64 generation = 0;
+    QElapsedTimer clock;
+    QAtomicInt cacheTtl;
+    QAtomicInteger<quint64> requests;
+    QAtomicInteger<quint64> hits;
+
+    QEFIBrokerServerPrivate(QEFIBrokerServer *q, QEFIBackend *backend)
+        : q(q), backend(backend), cacheTtl(BROKER_CACHE_TTL), requests(0), hits(0)
+    {
+        clock.start();
+    }
+
+    QEFIBackend *currentBackend() const
+    {
+        return backend ? backend : qefi_default_backend();
+    }
+
+    void acceptLoop();
+    void serve(int fd);
+    QByteArray handle(const QEFIBrokerPeer &peer, const QByteArray &request);
+    int read(const QEFIBrokerPeer &peer, const QEFIVariableKey &key, QEFIVariable &variable);
+    void forget(const QEFIVariableKey &key);
+};
+
+class QEFIBrokerConnection : public QRunnable
+{
+protected:
+    QEFIBrokerServerPrivate *m_server;
+    int m_fd;
+public:
+    QEFIBrokerConnection(QEFIBrokerServerPrivate *server, int fd)
+        : m_server(server), m_fd(fd) {}
+
+    void run() override
+    {
+        m_server->serve(m_fd);
+    }
+};
+
+void QEFIBrokerServerPrivate::acceptLoop()
+{
+    struct pollfd fds[2] = {
+        { listenFd, POLLIN, 0 },
+        { wakeFds[0], POLLIN, 0 }
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // Woken up by close()
+        if (fds[1].revents) break;
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        // A client not reading its responses gives up its thread too
+        struct timeval timeout = { BROKER_CLIENT_TIMEOUT / 1000, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        {
+            // Every client holds a thread of the pool, the ones beyond are
+            // refused rather than queued behind them
+            QMutexLocker locker(&clientsMutex);
+            if (clients.size() >= BROKER_MAX_CLIENTS) {
+                ::close(fd);
+                continue;
+            }
+            clients.insert(fd);
+        }
+        pool.start(new QEFIBrokerConnection(this, fd));
+    }
+}
+
+void QEFIBrokerServerPrivate::serve(int fd)
+{
+    const QEFIBrokerPeer peer = broker_peer(fd);
+
+    // Idle clients are dropped, they connect again on their next request
+    QByteArray request;
+    while (broker_read_message(fd, request, BROKER_CLIENT_TIMEOUT) == 0) {
+        requests.fetchAndAddRelaxed(1);
+        if (broker_write_message(fd, handle(peer, request)) != 0) break;
+    }
+
+    QMutexLocker locker(&clientsMutex);
+    clients.remove(fd);
+    ::close(fd);
+}
+
+int QEFIBrokerServerPrivate::read(const QEFIBrokerPeer &peer, const QEFIVariableKey &key,
+    QEFIVariable &variable)
+{
+    if (!q->allowRead(peer, key.first, key.second)) return -EACCES;
+
+    const int ttl = cacheTtl.loadAcquire();
+    const qint64 now = clock.elapsed();
+    quint64 readGeneration;
+    {
+        QReadLocker locker(&cacheLock);
+        auto it = cache.constFind(key);
+        if (it != cache.constEnd() && (ttl < 0 || now - it->cached < ttl)) {
+            hits.fetchAndAddRelaxed(1);
+            variable = it->variable;
+            return 0;
+        }
+        readGeneration = generation;
+    }
+
+    QByteArray data;
+    quint32 attributes = 0;
+    int error = currentBackend()->getVariable(key.first, key.second, data, &attributes);
+    if (error != 0) return error;
+
+    // Deep copy, some backends return data they do not own
+    variable = QEFIVariable(key.first, key.second,
+        QByteArray(data.constData(), data.size()), attributes);
+    if (ttl == 0) return 0;
+
+    // The value may predate a write or clearCache() made meanwhile
+    QWriteLocker locker(&cacheLock);
+    if (generation == readGeneration) cache.insert(key, { variable, now });
+    return 0;
+}
+
+void QEFIBrokerServerPrivate::forget(const QEFIVariableKey &key)
+{
+    QWriteLocker locker(&cacheLock);
+    cache.remove(key);
+    generation++;
+}
+
+QByteArray QEFIBrokerServerPrivate::handle(const QEFIBrokerPeer &peer,
+    const QByteArray &request)
+{
+    QDataStream in(request);
+    in.setVersion(BROKER_STREAM_VERSION);
+    QByteArray response;
+    QDataStream out(&response, QIODevice::WriteOnly);
+    out.setVersion(BROKER_STREAM_VERSION);
+
+    quint8 operation = 0;
+    in >> operation;
+    switch (operation) {
+    case BROKER_Get: {
+        quint32 count = 0;
+        in >> count;
+        QList<QEFIVariableKey> keys;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            QEFIVariableKey key;
+            in >> key.first >> key.second;
+            keys.append(key);
+        }
+        if (in.status() != QDataStream::Ok) break;
+
+        out << (quint32)keys.size();
+        for (const QEFIVariableKey &key : std::as_const(keys)) {
+            QEFIVariable variable;
+            qint32 error = read(peer, key, variable);
+            out << error << variable.attributes() << variable.data();
+        }
+        return response;
+    }
+    case BROKER_List: {
+        bool hasUuid = false;
+        QUuid uuid;
+        QString prefix;
+        in >> hasUuid >> uuid >> prefix;
+        if (in.status() != QDataStream::Ok) break;
+
+        QList<QEFIVariableKey> variables;
+        QList<quint64> sizes;
+        qint32 error = currentBackend()->listVariables(variables, &sizes,
+            hasUuid ? &uuid : nullptr, prefix);
+        QList<int> allowed;
+        for (int i = 0; i < variables.size(); i++) {
+            if (q->allowRead(peer, variables[i].first, variables[i].second))
+                allowed.append(i);
+        }
+
+        out << error << (quint32)allowed.size();
+        for (int i : std::as_const(allowed))
+            out << variables[i].first << variables[i].second << sizes[i];
+        return response;
+    }
+    case BROKER_Set: {
+        QEFIVariableKey key;
+        QByteArray data;
+        quint32 attributes = 0;
+        in >> key.first >> key.second >> data >> attributes;
+        if (in.status() != QDataStream::Ok) break;
+
+        qint32 error = -EPERM;
+        if (q->allowWrite(peer, key.first, key.second)) {
+            // Even when failed, a backend may have written part of it
+            error = currentBackend()->setVariable(key.first, key.second, data, attributes);
+            forget(key);
+        }
+        out << error;
+        return response;
+    }
+    case BROKER_Delete: {
+        QEFIVariableKey key;
+        in >> key.first >> key.second;
+        if (in.status() != QDataStream::Ok) break;
+
+        qint32 error = -EPERM;
+        if (q->allowWrite(peer, key.first, key.second)) {
+            error = currentBackend()->deleteVariable(key.first, key.second);
+            forget(key);
+        }
+        out << error;
+        return response;
+    }
+    case BROKER_Privilege:
+        out << (qint32)(q->allowWrite(peer, QUuid(), QString()) ? 0 : -EPERM);
+        return response;
+    default:
+        break;
+    }
+
+    // An empty response tells the client the request was malformed
+    return QByteArray();
+}
+
+QEFIBrokerServer::QEFIBrokerServer(QEFIBackend *backend)
+    : d(new QEFIBrokerServerPrivate(this, backend))
+{
+    d->pool.setMaxThreadCount(BROKER_MAX_CLIENTS);
+}
+
+QEFIBrokerServer::~QEFIBrokerServer()
+{
+    close();
+}
+
+bool QEFIBrokerServer::allowRead(const QEFIBrokerPeer &peer, const QUuid &uuid,
+    const QString &name)
+{
+    Q_UNUSED(peer)
+    Q_UNUSED(uuid)
+    Q_UNUSED(name)
+    return true;
+}
+
+bool QEFIBrokerServer::allowWrite(const QEFIBrokerPeer &peer, const QUuid &uuid,
+    const QString &name)
+{
+    Q_UNUSED(uuid)
+    Q_UNUSED(name)
+    return peer.uid == 0 || peer.uid == (quint32)geteuid();
+}
+
+int QEFIBrokerServer::listen(const QString &path, int mode)
+{
+    if (d->listenFd >= 0) return -EBUSY;
+
+    struct sockaddr_un address;
+    int error = broker_socket_address(path, address);
+    if (error != 0) return error;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -errno;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // A stale socket of a previous broker
+    unlink(address.sun_path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        chmod(address.sun_path, mode) != 0 ||
+        ::listen(fd, SOMAXCONN) != 0 || pipe(d->wakeFds) != 0) {
+        error = -errno;
+        ::close(fd);
+        unlink(address.sun_path);
+        return error;
+    }
+
+    d->listenFd = fd;
+    d->path = path;
+    d->acceptThread = QThread::create([this]() { d->acceptLoop(); });
+    d->acceptThread->start();
+    return 0;
+}
+
+void QEFIBrokerServer::close()
+{
+    if (d->listenFd < 0) return;
+
+    // Stop accepting, then wake up the clients blocked in their reads
+    const char wake = 0;
+    if (write(d->wakeFds[1], &wake, 1) < 0) qWarning("Cannot wake up the broker");
+    d->acceptThread->wait();
+    delete d->acceptThread;
+    d->acceptThread = nullptr;
+    {
+        QMutexLocker locker(&d->clientsMutex);
+        for (int fd : std::as_const(d->clients)) shutdown(fd, SHUT_RDWR);
+    }
+    d->pool.waitForDone();
+
+    ::close(d->listenFd);
+    ::close(d->wakeFds[0]);
+    ::close(d->wakeFds[1]);
+    d->listenFd = d->wakeFds[0] = d->wakeFds[1] = -1;
+    unlink(QFile::encodeName(d->path).constData());
+}
+
+bool QEFIBrokerServer::isListening() const
+{
+    return d->listenFd >= 0;
+}
+
+QString QEFIBrokerServer::path() const
+{
+    return d->path;
+}
+
+void QEFIBrokerServer::clearCache()
+{
+    QWriteLocker locker(&d->cacheLock);
+    d->cache.clear();
+    d->generation++;
+}
+
+void QEFIBrokerServer::setCacheTtl(int msecs)
+{
+    d->cacheTtl.storeRelease(msecs);
+    if (msecs == 0) clearCache();
+}
+
+int QEFIBrokerServer::cacheTtl() const
+{
+    return d->cacheTtl.loadAcquire();
+}
+
+quint64 QEFIBrokerServer::requestCount() const
+{
+    return d->requests.loadAcquire();
+}
+
+quint64 QEFIBrokerServer::cacheHitCount() const
+{
+    return d->hits.loadAcquire();
+}
+
+/* Client */
+class QEFIBrokerBackendPrivate
+{
+public:
+    QString path;
+    // One request in flight on the connection
+    QMutex mutex;
+    int fd = -1;
+
+    int connect();
+    // Only an idempotent request is sent again once the broker may have seen it
+    int request(const QByteArray &message, QByteArray &response, bool idempotent = true);
+};
+
+int QEFIBrokerBackendPrivate::connect()
+{
+    if (fd >= 0) return 0;
+
+    struct sockaddr_un address;
+    int error = broker_socket_address(path, address);
+    if (error != 0) return error;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -errno;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (::connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        error = -errno;
+        ::close(fd);
+        fd = -1;
+        return error;
+    }
+    return 0;
+}
+
+int QEFIBrokerBackendPrivate::request(const QByteArray &message, QByteArray &response,
+    bool idempotent)
+{
+    QMutexLocker locker(&mutex);
+
+    // Nothing comes unsolicited, a readable connection was closed by the
+    // broker, idle or restarted since the last request
+    if (fd >= 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) > 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // A broker restarted since the last request gets one more try
+    int error = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        error = connect();
+        if (error != 0) return error;
+
+        error = broker_write_message(fd, message);
+        const bool sent = error == 0;
+        if (sent) error = broker_read_message(fd, response);
+        if (error == 0) return response.isEmpty() ? -EPROTO : 0;
+
+        ::close(fd);
+        fd = -1;
+        // The broker may have carried out a write it could not answer
+        if (sent && !idempotent) break;
+    }
+    return error;
+}
+
+static QDataStream &broker_stream(QDataStream &stream)
+{
+    stream.setVersion(BROKER_STREAM_VERSION);
+    return stream;
+}
+
+QEFIBrokerBackend::QEFIBrokerBackend(const QString &path)
+    : d(new QEFIBrokerBackendPrivate)
+{
+    d->path = path;
+}
+
+QEFIBrokerBackend::~QEFIBrokerBackend()
+{
+    if (d->fd >= 0) ::close(d->fd);
+}
+
+bool QEFIBrokerBackend::isAvailable()
+{
+    QMutexLocker locker(&d->mutex);
+    return d->connect() == 0;
+}
+
+bool QEFIBrokerBackend::hasPrivilege()
+{
+    QByteArray message, response;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    broker_stream(out) << (quint8)BROKER_Privilege;
+    if (d->request(message, response) != 0) return false;
+
+    QDataStream in(response);
+    qint32 error = -EPERM;
+    broker_stream(in) >> error;
+    return error == 0;
+}
+
+int QEFIBrokerBackend::getVariables(const QList<QEFIVariableKey> &keys,
+    QList<QEFIVariable> &variables, QList<int> *errors)
+{
+    QByteArray message, response;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    broker_stream(out) << (quint8)BROKER_Get << (quint32)keys.size();
+    for (const QEFIVariableKey &key : keys) out << key.first << key.second;
+
+    int error = d->request(message, response);
+    if (error != 0) return error;
+
+    QDataStream in(response);
+    quint32 count = 0;
+    broker_stream(in) >> count;
+    if (count != (quint32)keys.size()) return -EPROTO;
+
+    variables.clear();
+    if (errors) errors->clear();
+    for (const QEFIVariableKey &key : keys) {
+        qint32 code = 0;
+        quint32 attributes = 0;
+        QByteArray data;
+        in >> code >> attributes >> data;
+        variables.append(code == 0 ?
+            QEFIVariable(key.first, key.second, data, attributes) : QEFIVariable());
+        if (errors) errors->append(code);
+    }
+    return in.status() == QDataStream::Ok ? 0 : -EPROTO;
+}
+
+int QEFIBrokerBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    QList<QEFIVariable> variables;
+    QList<int> errors;
+    int error = getVariables({ QEFIVariableKey(uuid, name) }, variables, &errors);
+    if (error != 0) return error;
+    if (errors[0] != 0) return errors[0];
+
+    data = variables[0].data();
+    if (attributes) *attributes = variables[0].attributes();
+    return 0;
+}
+
+int QEFIBrokerBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    QByteArray message, response;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    broker_stream(out) << (quint8)BROKER_Set << uuid << name << data << attributes;
+
+    int error = d->request(message, response, false);
+    if (error != 0) return error;
+
+    QDataStream in(response);
+    qint32 code = -EPROTO;
+    broker_stream(in) >> code;
+    return code;
+}
+
+int QEFIBrokerBackend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    QByteArray message, response;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    broker_stream(out) << (quint8)BROKER_Delete << uuid << name;
+
+    int error = d->request(message, response, false);
+    if (error != 0) return error;
+
+    QDataStream in(response);
+    qint32 code = -EPROTO;
+    broker_stream(in) >> code;
+    return code;
+}
+
+int QEFIBrokerBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    QByteArray message, response;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    broker_stream(out) << (quint8)BROKER_List << (uuid != nullptr)
+        << (uuid ? *uuid : QUuid()) << prefix;
+
+    int error = d->request(message, response);
+    if (error != 0) return error;
+
+    QDataStream in(response);
+    qint32 code = -EPROTO;
+    quint32 count = 0;
+    broker_stream(in) >> code >> count;
+    if (code != 0) return code;
+
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QEFIVariableKey key;
+        quint64 size = 0;
+        in >> key.first >> key.second >> size;
+        variables.append(key);
+        if (sizes) sizes->append(size);
+    }
+    return in.status() == QDataStream::Ok ? 0 : -EPROTO;
+}
+#endif
@@ -0,0 +1,146 @@
+#include "qefi.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cerrno>
+
+struct QEFIWriteCache
+{
+    QMutex mutex;
+    QHash<QEFIVariableKey, QEFIVariable> variables;
+    QEFIWriteCounters counters = { 0, 0 };
+};
+
+class QEFIContextPrivate
+{
+public:
+    QEFIBackend *backend = nullptr;
+    QScopedPointer<QEFIBackend> ownedBackend;
+    QString root;
+    QEFIWriteCache writeCache;
+
+    static QEFIContextPrivate *get(QEFIContext &context) { return context.d.data(); }
+};
+
+QEFIContext::QEFIContext(QEFIBackend *backend)
+    : d(new QEFIContextPrivate)
+{
+    d->backend = backend;
+}
+
+QEFIContext::QEFIContext(const QString &root)
+    : d(new QEFIContextPrivate)
+{
+#if defined(Q_OS_LINUX)
+    d->ownedBackend.reset(new QEFIEfivarfsBackend(root));
+#else
+    d->ownedBackend.reset(new QEFIAppDataBackend(root));
+#endif
+    d->backend = d->ownedBackend.data();
+    d->root = root;
+}
+
+QEFIContext::~QEFIContext()
+{
+}
+
+QEFIBackend *QEFIContext::backend() const
+{
+    return d->backend ? d->backend : qefi_default_backend();
+}
+
+QString QEFIContext::root() const
+{
+    return d->root;
+}
+
+void QEFIContext::clearWriteCache()
+{
+    QMutexLocker locker(&d->writeCache.mutex);
+    d->writeCache.variables.clear();
+}
+
+QEFIWriteCounters QEFIContext::writeCounters() const
+{
+    QMutexLocker locker(&d->writeCache.mutex);
+    return d->writeCache.counters;
+}
+
+void QEFIContext::resetWriteCounters()
+{
+    QMutexLocker locker(&d->writeCache.mutex);
+    d->writeCache.counters = { 0, 0 };
+}
+
+QEFIContext *qefi_default_context()
+{
+    // Never destroyed, the calls made at exit still have their context
+    static QEFIContext *context = new QEFIContext();
+    return context;
+}
+
+void qefi_write_cache_forget(QEFIContext &context, const QUuid &uuid, const QString &name)
+{
+    QEFIWriteCache &cache = QEFIContextPrivate::get(context)->writeCache;
+    QMutexLocker locker(&cache.mutex);
+    cache.variables.remove(QEFIVariableKey(uuid, name));
+}
+
+int qefi_write_variable_if_changed(QEFIContext &context, const QEFIVariable &variable)
+{
+    if (variable.isNull()) return -EINVAL;
+
+    QEFIWriteCache &cache = QEFIContextPrivate::get(context)->writeCache;
+    const QEFIVariableKey key(variable.guid(), variable.name());
+
+    // An append always changes the variable
+    if (!(variable.attributes() & QEFI_VARIABLE_APPEND_WRITE)) {
+        QEFIVariable current;
+        {
+            QMutexLocker locker(&cache.mutex);
+            current = cache.variables.value(key);
+        }
+        // A failed read only means the value has to be written
+        if (current.isNull()) current = qefi_read_variable(context, key.first, key.second);
+
+        if (!current.isNull() && current.attributes() == variable.attributes() &&
+            current.data() == variable.data()) {
+            QMutexLocker locker(&cache.mutex);
+            cache.variables.insert(key, current);
+            cache.counters.skipped++;
+            return 0;
+        }
+    }
+
+    int error = qefi_write_variable(context, variable);
+
+    QMutexLocker locker(&cache.mutex);
+    if (error == 0) {
+        cache.counters.performed++;
+        if (!(variable.attributes() & QEFI_VARIABLE_APPEND_WRITE))
+            cache.variables.insert(key, variable);
+    }
+    return error;
+}
+
+int qefi_write_variable_if_changed(const QEFIVariable &variable)
+{
+    return qefi_write_variable_if_changed(*qefi_default_context(), variable);
+}
+
+void qefi_clear_write_cache()
+{
+    qefi_default_context()->clearWriteCache();
+}
+
+QEFIWriteCounters qefi_write_counters()
+{
+    return qefi_default_context()->writeCounters();
+}
+
+void qefi_reset_write_counters()
+{
+    qefi_default_context()->resetWriteCounters();
+}
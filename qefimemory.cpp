@@ -0,0 +1,149 @@
+#include "qefi.h"
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QThread>
+#include <QReadLocker>
+#include <QReadWriteLock>
+#include <QWriteLocker>
+
+#include <cerrno>
+#include <cstring>
+
+#define QEFI_BACKEND_OPERATIONS 4
+
+class QEFIMemoryBackendPrivate
+{
+public:
+    QReadWriteLock lock;
+    QHash<QEFIVariableKey, QEFIVariable> variables;
+    QAtomicInt latencies[QEFI_BACKEND_OPERATIONS];
+    QAtomicInteger<quint64> counts[QEFI_BACKEND_OPERATIONS];
+
+    void enter(QEFIBackendOperation operation);
+};
+
+void QEFIMemoryBackendPrivate::enter(QEFIBackendOperation operation)
+{
+    counts[operation].fetchAndAddRelaxed(1);
+    int usecs = latencies[operation].loadAcquire();
+    if (usecs > 0) QThread::usleep(usecs);
+}
+
+QEFIMemoryBackend::QEFIMemoryBackend()
+    : d(new QEFIMemoryBackendPrivate)
+{
+}
+
+QEFIMemoryBackend::~QEFIMemoryBackend()
+{
+}
+
+void QEFIMemoryBackend::setLatency(QEFIBackendOperation operation, int usecs)
+{
+    d->latencies[operation].storeRelease(usecs);
+}
+
+int QEFIMemoryBackend::latency(QEFIBackendOperation operation) const
+{
+    return d->latencies[operation].loadAcquire();
+}
+
+quint64 QEFIMemoryBackend::operationCount(QEFIBackendOperation operation) const
+{
+    return d->counts[operation].loadAcquire();
+}
+
+void QEFIMemoryBackend::resetOperationCounts()
+{
+    for (int i = 0; i < QEFI_BACKEND_OPERATIONS; i++) d->counts[i].storeRelease(0);
+}
+
+void QEFIMemoryBackend::clear()
+{
+    QWriteLocker locker(&d->lock);
+    d->variables.clear();
+}
+
+int QEFIMemoryBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    d->enter(BACKEND_Get);
+    QReadLocker locker(&d->lock);
+    auto it = d->variables.constFind(QEFIVariableKey(uuid, name));
+    if (it == d->variables.constEnd()) return -ENOENT;
+
+    // Implicitly shared, nothing is copied
+    data = it.value().data();
+    if (attributes) *attributes = it.value().attributes();
+    return 0;
+}
+
+int QEFIMemoryBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    d->enter(BACKEND_Set);
+    const QEFIVariableKey key(uuid, name);
+    QWriteLocker locker(&d->lock);
+
+    // Like the firmware: an append extends, no data deletes
+    if (attributes & QEFI_VARIABLE_APPEND_WRITE) {
+        attributes &= ~QEFI_VARIABLE_APPEND_WRITE;
+        auto it = d->variables.find(key);
+        if (it != d->variables.end()) {
+            it.value().setData(it.value().data() + data);
+            return 0;
+        }
+    } else if (data.isEmpty()) {
+        return d->variables.remove(key) > 0 ? 0 : -ENOENT;
+    }
+
+    d->variables.insert(key, QEFIVariable(uuid, name, data, attributes));
+    return 0;
+}
+
+int QEFIMemoryBackend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    d->enter(BACKEND_Delete);
+    QWriteLocker locker(&d->lock);
+    return d->variables.remove(QEFIVariableKey(uuid, name)) > 0 ? 0 : -ENOENT;
+}
+
+int QEFIMemoryBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    d->enter(BACKEND_List);
+    QReadLocker locker(&d->lock);
+    for (auto it = d->variables.constBegin(); it != d->variables.constEnd(); ++it) {
+        if (uuid && *uuid != it.key().first) continue;
+        if (!it.key().second.startsWith(prefix)) continue;
+
+        variables.append(it.key());
+        if (sizes) sizes->append(it.value().data().size());
+    }
+    return 0;
+}
+
+int QEFIMemoryBackend::variableSize(const QUuid &uuid, const QString &name,
+    quint64 *size)
+{
+    d->enter(BACKEND_Get);
+    QReadLocker locker(&d->lock);
+    auto it = d->variables.constFind(QEFIVariableKey(uuid, name));
+    if (it == d->variables.constEnd()) return -ENOENT;
+
+    *size = it.value().data().size();
+    return 0;
+}
+
+int QEFIMemoryBackend::variableAttributes(const QUuid &uuid, const QString &name,
+    quint32 *attributes)
+{
+    d->enter(BACKEND_Get);
+    QReadLocker locker(&d->lock);
+    auto it = d->variables.constFind(QEFIVariableKey(uuid, name));
+    if (it == d->variables.constEnd()) return -ENOENT;
+
+    *attributes = it.value().attributes();
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include "qefi.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryFile>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtEndian>
+
+#include <cerrno>
+
+#if defined(Q_OS_UNIX)
+extern "C" {
+#include <sys/uio.h>
+#include <unistd.h>
+}
+#endif
+
+#define PROVISION_DP_END "\x7f\xff\x04\x00"
+
+static const QUuid provision_global_guid = QUuid(
+    0x8be4df61, 0x93ca, 0x11d2, 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2c, 0x8c);
+
+static bool provision_is_boot_variable(const QString &name)
+{
+    if (name == QLatin1String("BootOrder")) return true;
+    if (name.size() != 8 || !name.startsWith(QLatin1String("Boot"))) return false;
+
+    bool isHex = false;
+    name.mid(4).toUShort(&isHex, 16);
+    return isHex;
+}
+
+QEFIProvisionImage::QEFIProvisionImage(const QString &fileName)
+    : m_fileName(fileName)
+{
+}
+
+QString QEFIProvisionImage::fileName() const
+{
+    return m_fileName;
+}
+
+void QEFIProvisionImage::setFileName(const QString &fileName)
+{
+    m_fileName = fileName;
+}
+
+bool QEFIProvisionImage::addBootEntry(quint16 id, QEFILoadOption &option)
+{
+    const QByteArray data = option.format();
+    if (data.isEmpty()) return false;
+    m_bootEntries.insert(id, data);
+    return true;
+}
+
+QMap<quint16, QByteArray> QEFIProvisionImage::bootEntries() const
+{
+    return m_bootEntries;
+}
+
+QList<quint16> QEFIProvisionImage::bootOrder() const
+{
+    return m_bootOrder;
+}
+
+void QEFIProvisionImage::setBootOrder(const QList<quint16> &bootOrder)
+{
+    m_bootOrder = bootOrder;
+}
+
+class QEFIProvisionerPrivate
+{
+public:
+    // Template with its boot variables dropped and the store reclaimed
+    QByteArray image;
+    quint64 prefixSize = 0;
+    quint64 freeSize = 0;
+    bool authenticated = true;
+
+    QByteArray encode(const QEFIProvisionImage &image) const;
+};
+
+QByteArray QEFIProvisionerPrivate::encode(const QEFIProvisionImage &image) const
+{
+    QByteArray delta;
+    const QMap<quint16, QByteArray> entries = image.bootEntries();
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QString name = QStringLiteral("Boot") +
+            QString::number(it.key(), 16).rightJustified(4, QLatin1Char('0')).toUpper();
+        delta.append(QEFIVarStoreBackend::encodeVariable(provision_global_guid,
+            name, it.value(), QEFI_VARIABLE_DEFAULT_ATTRIBUTES, authenticated));
+    }
+
+    const QList<quint16> order = image.bootOrder();
+    if (!order.isEmpty()) {
+        QByteArray data(order.size() * 2, '\0');
+        for (int i = 0; i < order.size(); i++)
+            qToLittleEndian<quint16>(order[i], data.data() + i * 2);
+        delta.append(QEFIVarStoreBackend::encodeVariable(provision_global_guid,
+            QStringLiteral("BootOrder"), data, QEFI_VARIABLE_DEFAULT_ATTRIBUTES,
+            authenticated));
+    }
+    return delta;
+}
+
+QEFIProvisioner::QEFIProvisioner()
+    : d(new QEFIProvisionerPrivate)
+{
+}
+
+QEFIProvisioner::~QEFIProvisioner()
+{
+}
+
+int QEFIProvisioner::setTemplate(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return file.exists() ? -EACCES : -ENOENT;
+    const QByteArray image = file.readAll();
+    file.close();
+
+    // The template itself is left untouched, the work is done on a copy
+    QTemporaryFile copy;
+    if (!copy.open()) return -EIO;
+    if (copy.write(image) != image.size()) return -EIO;
+    copy.close();
+
+    QEFIVarStoreBackend store;
+    int error = store.open(copy.fileName(), true);
+    if (error != 0) return error;
+
+    QList<QEFIVariableKey> keys;
+    error = store.listVariables(keys, nullptr, &provision_global_guid,
+        QStringLiteral("Boot"));
+    if (error != 0) return error;
+    for (const QEFIVariableKey &key : std::as_const(keys)) {
+        if (!provision_is_boot_variable(key.second)) continue;
+        error = store.deleteVariable(key.first, key.second);
+        if (error != 0) return error;
+    }
+    error = store.reclaim();
+    if (error != 0) return error;
+
+    d->prefixSize = store.endOffset();
+    d->freeSize = store.freeSize();
+    d->authenticated = store.isAuthenticated();
+    store.close();
+
+    if (!copy.open()) return -EIO;
+    d->image = copy.readAll();
+    return d->image.size() == image.size() ? 0 : -EIO;
+}
+
+int QEFIProvisioner::provision(const QEFIProvisionImage &image) const
+{
+    if (d->image.isEmpty()) return -EINVAL;
+
+    const QByteArray delta = d->encode(image);
+    if ((quint64)delta.size() > d->freeSize) return -ENOSPC;
+
+    QFile file(image.fileName());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return -EACCES;
+
+    // The delta takes over the erased space right after the prefix
+    const char *prefix = d->image.constData();
+    const quint64 tailOffset = d->prefixSize + delta.size();
+    const quint64 tailSize = d->image.size() - tailOffset;
+#if defined(Q_OS_UNIX)
+    struct iovec iov[3] = {
+        { (void *)prefix, (size_t)d->prefixSize },
+        { (void *)delta.constData(), (size_t)delta.size() },
+        { (void *)(prefix + tailOffset), (size_t)tailSize }
+    };
+    const ssize_t written = writev(file.handle(), iov, 3);
+    if (written != d->image.size()) return written < 0 ? -errno : -EIO;
+#else
+    QByteArray data;
+    data.reserve(d->image.size());
+    data.append(prefix, d->prefixSize);
+    data.append(delta);
+    data.append(prefix + tailOffset, tailSize);
+    if (file.write(data) != data.size()) return -EIO;
+#endif
+    return 0;
+}
+
+QList<int> QEFIProvisioner::provision(const QList<QEFIProvisionImage> &images) const
+{
+    // The template is only read, each task writes its own file
+    QList<QFuture<int> > futures;
+    for (const QEFIProvisionImage &image : images) {
+        futures.append(QtConcurrent::run(qefi_offline_thread_pool(), [this, image]() {
+            return provision(image);
+        }));
+    }
+
+    QList<int> errors;
+    for (auto &future : futures) errors.append(future.result());
+    return errors;
+}
+
+// Load option bytes for QEFILoadOption to parse
+static QByteArray provision_load_option(const QJsonObject &entry)
+{
+    QByteArray devicePath = QByteArray::fromHex(
+        entry.value(QStringLiteral("devicePath")).toString().toLatin1());
+    if (!devicePath.endsWith(QByteArray(PROVISION_DP_END, 4)))
+        devicePath.append(PROVISION_DP_END, 4);
+
+    const QString description = entry.value(QStringLiteral("description")).toString();
+    const bool active = entry.value(QStringLiteral("active")).toBool(true);
+    QByteArray data(6, '\0');
+    qToLittleEndian<quint32>(active ? QEFI_LOAD_OPTION_ACTIVE : 0, data.data());
+    qToLittleEndian<quint16>(devicePath.size(), data.data() + 4);
+    for (const QChar &c : description) {
+        char unit[2];
+        qToLittleEndian<quint16>(c.unicode(), unit);
+        data.append(unit, 2);
+    }
+    data.append(2, '\0');
+    data.append(devicePath);
+    data.append(QByteArray::fromHex(
+        entry.value(QStringLiteral("optionalData")).toString().toLatin1()));
+    return data;
+}
+
+// A JSON number from 0 to 0xffff, or -1
+static int provision_id(const QJsonValue &value)
+{
+    if (!value.isDouble()) return -1;
+    const double id = value.toDouble();
+    if (id < 0 || id > 0xffff || id != (int)id) return -1;
+    return (int)id;
+}
+
+int QEFIProvisioner::loadManifest(const QString &fileName, QList<QEFIProvisionImage> &images)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return file.exists() ? -EACCES : -ENOENT;
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (parseError.error != QJsonParseError::NoError || !document.isObject())
+        return -EINVAL;
+
+    const QDir dir = QFileInfo(fileName).dir();
+    const QJsonArray list = document.object().value(QStringLiteral("images")).toArray();
+    for (const QJsonValue &value : list) {
+        const QJsonObject object = value.toObject();
+        const QString output = object.value(QStringLiteral("file")).toString();
+        if (output.isEmpty()) return -EINVAL;
+        QEFIProvisionImage image(dir.filePath(output));
+
+        const QJsonArray entries = object.value(QStringLiteral("entries")).toArray();
+        for (const QJsonValue &entryValue : entries) {
+            const QJsonObject entry = entryValue.toObject();
+            const int id = provision_id(entry.value(QStringLiteral("id")));
+            if (id < 0) return -EINVAL;
+
+            QEFILoadOption option(provision_load_option(entry));
+            if (!option.isValidated() || !image.addBootEntry(id, option)) return -EINVAL;
+        }
+
+        QList<quint16> bootOrder;
+        const QJsonArray order = object.value(QStringLiteral("bootOrder")).toArray();
+        for (const QJsonValue &value : order) {
+            const int id = provision_id(value);
+            if (id < 0) return -EINVAL;
+            bootOrder.append(id);
+        }
+        image.setBootOrder(bootOrder);
+
+        images.append(image);
+    }
+    return 0;
+}
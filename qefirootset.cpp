@@ -0,0 +1,109 @@
+#include "qefi.h"
+
+#include <QReadLocker>
+#include <QReadWriteLock>
+#include <QThreadPool>
+#include <QWriteLocker>
+#include <QtConcurrent/QtConcurrentRun>
+
+class QEFIRootSetPrivate
+{
+public:
+    mutable QReadWriteLock lock;
+    QMap<QString, QSharedPointer<QEFIContext> > contexts;
+    // Apart from qefi_thread_pool(), the callers may be its tasks and
+    // would wait on tasks queued behind them
+    mutable QThreadPool pool;
+
+    // One task per root, the contexts stay alive while their task runs
+    template <typename T, typename F>
+    QMap<QString, T> fanOut(F call) const;
+};
+
+template <typename T, typename F>
+QMap<QString, T> QEFIRootSetPrivate::fanOut(F call) const
+{
+    QMap<QString, QSharedPointer<QEFIContext> > snapshot;
+    {
+        QReadLocker locker(&lock);
+        snapshot = contexts;
+    }
+
+    QMap<QString, QFuture<T> > futures;
+    for (auto it = snapshot.constBegin(); it != snapshot.constEnd(); ++it) {
+        QSharedPointer<QEFIContext> context = it.value();
+        futures.insert(it.key(), QtConcurrent::run(&pool, [context, call]() {
+            return call(*context);
+        }));
+    }
+
+    QMap<QString, T> results;
+    for (auto it = futures.begin(); it != futures.end(); ++it)
+        results.insert(it.key(), it.value().result());
+    return results;
+}
+
+QEFIRootSet::QEFIRootSet()
+    : d(new QEFIRootSetPrivate)
+{
+}
+
+QEFIRootSet::~QEFIRootSet()
+{
+}
+
+QSharedPointer<QEFIContext> QEFIRootSet::addRoot(const QString &root)
+{
+    QWriteLocker locker(&d->lock);
+    QSharedPointer<QEFIContext> &context = d->contexts[root];
+    if (!context) context.reset(new QEFIContext(root));
+    return context;
+}
+
+void QEFIRootSet::removeRoot(const QString &root)
+{
+    QWriteLocker locker(&d->lock);
+    d->contexts.remove(root);
+}
+
+QStringList QEFIRootSet::roots() const
+{
+    QReadLocker locker(&d->lock);
+    return d->contexts.keys();
+}
+
+QSharedPointer<QEFIContext> QEFIRootSet::context(const QString &root) const
+{
+    QReadLocker locker(&d->lock);
+    return d->contexts.value(root);
+}
+
+QMap<QString, QList<QEFIVariableKey> > QEFIRootSet::listVariables(const QUuid *uuid,
+    const QString &prefix) const
+{
+    const bool hasUuid = uuid != nullptr;
+    const QUuid guid = hasUuid ? *uuid : QUuid();
+    return d->fanOut<QList<QEFIVariableKey> >([hasUuid, guid, prefix](QEFIContext &context) {
+        return hasUuid ? qefi_list_variables(context, guid, prefix) :
+            qefi_list_variables(context, prefix);
+    });
+}
+
+QMap<QString, QEFIVariable> QEFIRootSet::readVariable(QUuid uuid, QString name) const
+{
+    return d->fanOut<QEFIVariable>([uuid, name](QEFIContext &context) {
+        return qefi_read_variable(context, uuid, name);
+    });
+}
+
+QMap<QString, QList<QEFIVariable> > QEFIRootSet::readVariables(
+    const QList<QEFIVariableKey> &keys) const
+{
+    return d->fanOut<QList<QEFIVariable> >([keys](QEFIContext &context) {
+        QList<QEFIVariable> variables;
+        variables.reserve(keys.size());
+        for (const QEFIVariableKey &key : keys)
+            variables.append(qefi_read_variable(context, key.first, key.second));
+        return variables;
+    });
+}
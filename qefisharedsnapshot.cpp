@@ -0,0 +1,432 @@
+#include "qefi.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QtEndian>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+/*
+ * Layout of the region, little endian:
+ *   header: magic, version, sequence, count, used size
+ *   count entries: GUID in EFI byte order, attributes, then the offset
+ *   and size of the UTF-16 name and of the data
+ *   names and data, each padded to 4 bytes
+ */
+#define SHARED_MAGIC                0x53464551  // "QEFS"
+#define SHARED_VERSION              1
+#define SHARED_MAGIC_OFFSET         0
+#define SHARED_VERSION_OFFSET       4
+#define SHARED_SEQUENCE_OFFSET      8
+#define SHARED_COUNT_OFFSET         12
+#define SHARED_SIZE_OFFSET          16
+#define SHARED_HEADER_SIZE          32
+
+#define SHARED_ENTRY_GUID           0
+#define SHARED_ENTRY_ATTRIBUTES     16
+#define SHARED_ENTRY_NAME_OFFSET    20
+#define SHARED_ENTRY_NAME_SIZE      24
+#define SHARED_ENTRY_DATA_OFFSET    28
+#define SHARED_ENTRY_DATA_SIZE      32
+#define SHARED_ENTRY_SIZE           40
+
+// Bounds a reader racing with a publisher that died halfway
+#define SHARED_READ_ATTEMPTS        100000
+
+typedef std::atomic<quint32> QEFISharedSequence;
+static_assert(QEFISharedSequence::is_always_lock_free,
+    "The sequence is shared between processes");
+
+static inline quint32 shared_align(quint32 size)
+{
+    return (size + 3) & ~3u;
+}
+
+// Without allocating, unlike qefi_rfc4122_to_guid()
+static void shared_guid(const QUuid &uuid, uchar *guid)
+{
+    qToLittleEndian<quint32>(uuid.data1, guid);
+    qToLittleEndian<quint16>(uuid.data2, guid + 4);
+    qToLittleEndian<quint16>(uuid.data3, guid + 6);
+    memcpy(guid + 8, uuid.data4, 8);
+}
+
+static inline QEFISharedSequence *shared_sequence(uchar *map)
+{
+    return reinterpret_cast<QEFISharedSequence *>(map + SHARED_SEQUENCE_OFFSET);
+}
+
+/* Publisher */
+class QEFISharedSnapshotPublisherPrivate
+{
+public:
+    QEFIBackend *backend;
+    // One publish at a time, readers are in other processes
+    mutable QMutex mutex;
+    QFile file;
+    uchar *map = nullptr;
+    quint32 capacity = 0;
+    QList<QEFIVariableKey> keys;
+};
+
+QEFISharedSnapshotPublisher::QEFISharedSnapshotPublisher(QEFIBackend *backend)
+    : d(new QEFISharedSnapshotPublisherPrivate)
+{
+    d->backend = backend;
+}
+
+QEFISharedSnapshotPublisher::~QEFISharedSnapshotPublisher()
+{
+    close();
+}
+
+int QEFISharedSnapshotPublisher::create(const QString &fileName, quint32 capacity)
+{
+    close();
+    if (capacity < SHARED_HEADER_SIZE) return -EINVAL;
+
+    QMutexLocker locker(&d->mutex);
+    d->file.setFileName(fileName);
+    if (!d->file.open(QIODevice::ReadWrite)) return -EACCES;
+    // A region kept from a previous publisher is reused with its sequence
+    if (d->file.size() < capacity && !d->file.resize(capacity)) {
+        d->file.close();
+        return -EIO;
+    }
+    d->capacity = qMin<qint64>(d->file.size(), 0xffffffff);
+    d->map = d->file.map(0, d->capacity);
+    if (!d->map) {
+        d->file.close();
+        return -EIO;
+    }
+
+    if (qFromLittleEndian<quint32>(d->map + SHARED_MAGIC_OFFSET) != SHARED_MAGIC ||
+        qFromLittleEndian<quint32>(d->map + SHARED_VERSION_OFFSET) != SHARED_VERSION) {
+        memset(d->map, 0, SHARED_HEADER_SIZE);
+        qToLittleEndian<quint32>(SHARED_HEADER_SIZE, d->map + SHARED_SIZE_OFFSET);
+        qToLittleEndian<quint32>(SHARED_VERSION, d->map + SHARED_VERSION_OFFSET);
+        std::atomic_thread_fence(std::memory_order_release);
+        qToLittleEndian<quint32>(SHARED_MAGIC, d->map + SHARED_MAGIC_OFFSET);
+    }
+
+    // A previous publisher died halfway, its entries are dropped before the
+    // sequence is even again or readers would spin until the next publish
+    QEFISharedSequence *sequence = shared_sequence(d->map);
+    const quint32 current = sequence->load(std::memory_order_relaxed);
+    if (current & 1) {
+        qToLittleEndian<quint32>(0, d->map + SHARED_COUNT_OFFSET);
+        qToLittleEndian<quint32>(SHARED_HEADER_SIZE, d->map + SHARED_SIZE_OFFSET);
+        sequence->store(current + 1, std::memory_order_release);
+    }
+    return 0;
+}
+
+void QEFISharedSnapshotPublisher::close()
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->map) return;
+
+    d->file.unmap(d->map);
+    d->map = nullptr;
+    d->file.close();
+}
+
+bool QEFISharedSnapshotPublisher::isOpen() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->map != nullptr;
+}
+
+void QEFISharedSnapshotPublisher::setKeys(const QList<QEFIVariableKey> &keys)
+{
+    QMutexLocker locker(&d->mutex);
+    d->keys = keys;
+}
+
+QList<QEFIVariableKey> QEFISharedSnapshotPublisher::keys() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->keys;
+}
+
+int QEFISharedSnapshotPublisher::publish()
+{
+    QEFIBackend *backend = d->backend ? d->backend : qefi_default_backend();
+
+    // Read outside of the lock, the backend may be slow
+    QList<QEFIVariable> variables;
+    for (const QEFIVariableKey &key : keys()) {
+        QByteArray data;
+        quint32 attributes = 0;
+        if (backend->getVariable(key.first, key.second, data, &attributes) == 0)
+            variables.append(QEFIVariable(key.first, key.second, data, attributes));
+    }
+    return publish(variables);
+}
+
+int QEFISharedSnapshotPublisher::publish(const QList<QEFIVariable> &variables)
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->map) return -EBADF;
+
+    quint64 size = SHARED_HEADER_SIZE + (quint64)variables.size() * SHARED_ENTRY_SIZE;
+    for (const QEFIVariable &variable : variables) {
+        size += shared_align(variable.name().size() * 2);
+        size += shared_align(variable.data().size());
+    }
+    if (size > d->capacity) return -ENOSPC;
+
+    // Odd while the region is rewritten, whatever another process left
+    QEFISharedSequence *sequence = shared_sequence(d->map);
+    const quint32 begin = sequence->load(std::memory_order_relaxed) | 1;
+    sequence->store(begin, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    quint32 offset = SHARED_HEADER_SIZE + variables.size() * SHARED_ENTRY_SIZE;
+    for (int i = 0; i < variables.size(); i++) {
+        const QEFIVariable &variable = variables[i];
+        const QString name = variable.name();
+        const QByteArray data = variable.data();
+        uchar *entry = d->map + SHARED_HEADER_SIZE + i * SHARED_ENTRY_SIZE;
+
+        shared_guid(variable.guid(), entry + SHARED_ENTRY_GUID);
+        qToLittleEndian<quint32>(variable.attributes(), entry + SHARED_ENTRY_ATTRIBUTES);
+        qToLittleEndian<quint32>(offset, entry + SHARED_ENTRY_NAME_OFFSET);
+        qToLittleEndian<quint32>(name.size() * 2, entry + SHARED_ENTRY_NAME_SIZE);
+        memcpy(d->map + offset, name.utf16(), name.size() * 2);
+        offset += shared_align(name.size() * 2);
+
+        qToLittleEndian<quint32>(offset, entry + SHARED_ENTRY_DATA_OFFSET);
+        qToLittleEndian<quint32>(data.size(), entry + SHARED_ENTRY_DATA_SIZE);
+        memcpy(d->map + offset, data.constData(), data.size());
+        offset += shared_align(data.size());
+    }
+    qToLittleEndian<quint32>(variables.size(), d->map + SHARED_COUNT_OFFSET);
+    qToLittleEndian<quint32>(offset, d->map + SHARED_SIZE_OFFSET);
+
+    sequence->store(begin + 1, std::memory_order_release);
+    return 0;
+}
+
+quint32 QEFISharedSnapshotPublisher::sequence() const
+{
+    QMutexLocker locker(&d->mutex);
+    if (!d->map) return 0;
+    return shared_sequence(d->map)->load(std::memory_order_acquire);
+}
+
+/* Reader */
+class QEFISharedSnapshotBackendPrivate
+{
+public:
+    QFile file;
+    uchar *map = nullptr;
+    quint64 mapSize = 0;
+
+    // Run read on the entries of a consistent version of the region
+    template <typename F>
+    int consistent(F read) const;
+    template <typename F>
+    int find(const QUuid &uuid, const QString &name, F copy) const;
+};
+
+template <typename F>
+int QEFISharedSnapshotBackendPrivate::consistent(F read) const
+{
+    if (!map) return -EBADF;
+
+    QEFISharedSequence *sequence = shared_sequence(map);
+    for (int attempt = 0; attempt < SHARED_READ_ATTEMPTS; attempt++) {
+        const quint32 begin = sequence->load(std::memory_order_acquire);
+        if (begin & 1) {
+            QThread::yieldCurrentThread();
+            continue;
+        }
+
+        int result = -EIO;
+        const quint32 count = qFromLittleEndian<quint32>(map + SHARED_COUNT_OFFSET);
+        if (SHARED_HEADER_SIZE + (quint64)count * SHARED_ENTRY_SIZE <= mapSize)
+            result = read(count);
+
+        // Torn reads are thrown away, the publisher went by meanwhile
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence->load(std::memory_order_relaxed) == begin) return result;
+    }
+    return -EAGAIN;
+}
+
+template <typename F>
+int QEFISharedSnapshotBackendPrivate::find(const QUuid &uuid, const QString &name,
+    F copy) const
+{
+    uchar guid[16];
+    shared_guid(uuid, guid);
+    const quint32 nameSize = name.size() * 2;
+
+    return consistent([&](quint32 count) {
+        // A handful of variables, scanned in order
+        for (quint32 i = 0; i < count; i++) {
+            const uchar *entry = map + SHARED_HEADER_SIZE + i * SHARED_ENTRY_SIZE;
+            if (memcmp(entry + SHARED_ENTRY_GUID, guid, sizeof(guid)) != 0) continue;
+            if (qFromLittleEndian<quint32>(entry + SHARED_ENTRY_NAME_SIZE) != nameSize) continue;
+
+            const quint32 nameOffset = qFromLittleEndian<quint32>(entry + SHARED_ENTRY_NAME_OFFSET);
+            if ((quint64)nameOffset + nameSize > mapSize) return -EIO;
+            if (memcmp(map + nameOffset, name.utf16(), nameSize) != 0) continue;
+
+            const quint32 dataOffset = qFromLittleEndian<quint32>(entry + SHARED_ENTRY_DATA_OFFSET);
+            const quint32 dataSize = qFromLittleEndian<quint32>(entry + SHARED_ENTRY_DATA_SIZE);
+            if ((quint64)dataOffset + dataSize > mapSize) return -EIO;
+            return copy((const char *)map + dataOffset, dataSize,
+                qFromLittleEndian<quint32>(entry + SHARED_ENTRY_ATTRIBUTES));
+        }
+        return -ENOENT;
+    });
+}
+
+QEFISharedSnapshotBackend::QEFISharedSnapshotBackend(const QString &fileName)
+    : d(new QEFISharedSnapshotBackendPrivate)
+{
+    if (!fileName.isEmpty()) open(fileName);
+}
+
+QEFISharedSnapshotBackend::~QEFISharedSnapshotBackend()
+{
+    close();
+}
+
+int QEFISharedSnapshotBackend::open(const QString &fileName)
+{
+    close();
+
+    d->file.setFileName(fileName);
+    if (!d->file.open(QIODevice::ReadOnly)) return d->file.exists() ? -EACCES : -ENOENT;
+    d->mapSize = d->file.size();
+    if (d->mapSize >= SHARED_HEADER_SIZE) d->map = d->file.map(0, d->mapSize);
+    if (!d->map ||
+        qFromLittleEndian<quint32>(d->map + SHARED_MAGIC_OFFSET) != SHARED_MAGIC ||
+        qFromLittleEndian<quint32>(d->map + SHARED_VERSION_OFFSET) != SHARED_VERSION) {
+        close();
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void QEFISharedSnapshotBackend::close()
+{
+    if (d->map) d->file.unmap(d->map);
+    d->map = nullptr;
+    d->file.close();
+}
+
+bool QEFISharedSnapshotBackend::isOpen() const
+{
+    return d->map != nullptr;
+}
+
+quint32 QEFISharedSnapshotBackend::sequence() const
+{
+    if (!d->map) return 0;
+    return shared_sequence(d->map)->load(std::memory_order_acquire);
+}
+
+bool QEFISharedSnapshotBackend::isAvailable()
+{
+    return isOpen();
+}
+
+bool QEFISharedSnapshotBackend::hasPrivilege()
+{
+    return false;
+}
+
+int QEFISharedSnapshotBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    return d->find(uuid, name, [&](const char *value, quint32 size, quint32 attr) {
+        data = QByteArray(value, size);
+        if (attributes) *attributes = attr;
+        return 0;
+    });
+}
+
+int QEFISharedSnapshotBackend::getVariableInto(const QUuid &uuid, const QString &name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes)
+{
+    return d->find(uuid, name, [&](const char *value, quint32 dataSize, quint32 attr) {
+        *size = dataSize;
+        memcpy(buffer, value, qMin<size_t>(capacity, dataSize));
+        if (attributes) *attributes = attr;
+        return 0;
+    });
+}
+
+int QEFISharedSnapshotBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    Q_UNUSED(uuid)
+    Q_UNUSED(name)
+    Q_UNUSED(data)
+    Q_UNUSED(attributes)
+    return -EROFS;
+}
+
+int QEFISharedSnapshotBackend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    Q_UNUSED(uuid)
+    Q_UNUSED(name)
+    return -EROFS;
+}
+
+int QEFISharedSnapshotBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    QList<QEFIVariableKey> keys;
+    QList<quint64> keySizes;
+    int error = d->consistent([&](quint32 count) {
+        keys.clear();
+        keySizes.clear();
+        for (quint32 i = 0; i < count; i++) {
+            const uchar *entry = d->map + SHARED_HEADER_SIZE + i * SHARED_ENTRY_SIZE;
+            const quint32 nameOffset = qFromLittleEndian<quint32>(entry + SHARED_ENTRY_NAME_OFFSET);
+            const quint32 nameSize = qFromLittleEndian<quint32>(entry + SHARED_ENTRY_NAME_SIZE);
+            if ((quint64)nameOffset + nameSize > d->mapSize) return -EIO;
+
+            keys.append(QEFIVariableKey(qefi_format_guid(entry + SHARED_ENTRY_GUID),
+                QString((const QChar *)(d->map + nameOffset), nameSize / 2)));
+            keySizes.append(qFromLittleEndian<quint32>(entry + SHARED_ENTRY_DATA_SIZE));
+        }
+        return 0;
+    });
+    if (error != 0) return error;
+
+    for (int i = 0; i < keys.size(); i++) {
+        if (uuid && *uuid != keys[i].first) continue;
+        if (!keys[i].second.startsWith(prefix)) continue;
+        variables.append(keys[i]);
+        if (sizes) sizes->append(keySizes[i]);
+    }
+    return 0;
+}
+
+int QEFISharedSnapshotBackend::variableSize(const QUuid &uuid, const QString &name,
+    quint64 *size)
+{
+    return d->find(uuid, name, [&](const char *, quint32 dataSize, quint32) {
+        *size = dataSize;
+        return 0;
+    });
+}
+
+int QEFISharedSnapshotBackend::variableAttributes(const QUuid &uuid, const QString &name,
+    quint32 *attributes)
+{
+    return d->find(uuid, name, [&](const char *, quint32, quint32 attr) {
+        *attributes = attr;
+        return 0;
+    });
+}
@@ -0,0 +1,165 @@
+#include "qefi.h"
+
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+
+struct QEFIVariableSnapshotEntry
+{
+    QUuid guid;
+    QString name;
+    quint32 attributes;
+    int offset;
+    int size;
+};
+
+static inline bool operator<(const QEFIVariableSnapshotEntry &entry,
+    const QEFIVariableKey &key)
+{
+    if (entry.guid != key.first) return entry.guid < key.first;
+    return entry.name < key.second;
+}
+
+class QEFIVariableSnapshotData : public QSharedData
+{
+public:
+    QByteArray arena;
+    QVector<QEFIVariableSnapshotEntry> index;   // Sorted by GUID then name
+
+    const QEFIVariableSnapshotEntry *find(const QUuid &guid,
+        const QString &name) const;
+};
+
+const QEFIVariableSnapshotEntry *QEFIVariableSnapshotData::find(
+    const QUuid &guid, const QString &name) const
+{
+    // The key only references the arguments, nothing is allocated
+    const QEFIVariableKey key(guid, name);
+    auto it = std::lower_bound(index.cbegin(), index.cend(), key,
+        [](const QEFIVariableSnapshotEntry &entry, const QEFIVariableKey &key) {
+            return entry < key;
+        });
+    if (it == index.cend() || it->guid != guid || it->name != name)
+        return nullptr;
+    return &(*it);
+}
+
+QEFIVariableSnapshot::QEFIVariableSnapshot()
+    : d(new QEFIVariableSnapshotData)
+{
+}
+
+QEFIVariableSnapshot::QEFIVariableSnapshot(const QEFIVariableSnapshot &other)
+    : d(other.d)
+{
+}
+
+QEFIVariableSnapshot &QEFIVariableSnapshot::operator=(const QEFIVariableSnapshot &other)
+{
+    d = other.d;
+    return *this;
+}
+
+QEFIVariableSnapshot::~QEFIVariableSnapshot()
+{
+}
+
+QEFIVariableSnapshot QEFIVariableSnapshot::load(const QList<QUuid> &guids)
+{
+    // One enumeration pass, then the reads overlap on the worker pool
+    QList<QEFIVariableKey> keys = qefi_list_variables();
+    if (!guids.isEmpty()) {
+        QList<QEFIVariableKey> filtered;
+        for (const QEFIVariableKey &key : std::as_const(keys)) {
+            if (guids.contains(key.first)) filtered.append(key);
+        }
+        keys.swap(filtered);
+    }
+
+    return fromVariables(qefi_read_variables(keys));
+}
+
+QEFIVariableSnapshot QEFIVariableSnapshot::fromVariables(
+    const QList<QEFIVariable> &variables)
+{
+    QEFIVariableSnapshot snapshot;
+    QEFIVariableSnapshotData *data = snapshot.d.data();
+
+    int total = 0;
+    for (const QEFIVariable &variable : variables) {
+        if (!variable.isNull()) total += variable.data().size();
+    }
+    data->arena.reserve(total);
+    data->index.reserve(variables.size());
+
+    for (const QEFIVariable &variable : variables) {
+        if (variable.isNull()) continue;
+
+        QEFIVariableSnapshotEntry entry;
+        entry.guid = variable.guid();
+        entry.name = variable.name();
+        entry.attributes = variable.attributes();
+        entry.offset = data->arena.size();
+        entry.size = variable.data().size();
+        data->arena.append(variable.data());
+        data->index.append(entry);
+    }
+
+    std::sort(data->index.begin(), data->index.end(),
+        [](const QEFIVariableSnapshotEntry &a, const QEFIVariableSnapshotEntry &b) {
+            return a < QEFIVariableKey(b.guid, b.name);
+        });
+
+    return snapshot;
+}
+
+int QEFIVariableSnapshot::size() const
+{
+    return d->index.size();
+}
+
+QList<QEFIVariableKey> QEFIVariableSnapshot::keys() const
+{
+    QList<QEFIVariableKey> keys;
+    keys.reserve(d->index.size());
+    for (const QEFIVariableSnapshotEntry &entry : std::as_const(d->index)) {
+        keys.append(QEFIVariableKey(entry.guid, entry.name));
+    }
+    return keys;
+}
+
+bool QEFIVariableSnapshot::contains(const QUuid &guid, const QString &name) const
+{
+    return d->find(guid, name) != nullptr;
+}
+
+const char *QEFIVariableSnapshot::constData(const QUuid &guid,
+    const QString &name, int *size, quint32 *attributes) const
+{
+    const QEFIVariableSnapshotEntry *entry = d->find(guid, name);
+    if (entry == nullptr) return nullptr;
+
+    if (size) *size = entry->size;
+    if (attributes) *attributes = entry->attributes;
+    return d->arena.constData() + entry->offset;
+}
+
+QByteArray QEFIVariableSnapshot::value(const QUuid &guid, const QString &name) const
+{
+    int size;
+    const char *data = constData(guid, name, &size);
+    if (data == nullptr) return QByteArray();
+    // A copy, it may outlive the snapshot
+    return QByteArray(data, size);
+}
+
+quint16 QEFIVariableSnapshot::valueUint16(const QUuid &guid, const QString &name) const
+{
+    int size;
+    const char *data = constData(guid, name, &size);
+    if (data == nullptr || size < (int)sizeof(quint16)) return 0;
+
+    // Read as uint16, platform-independant
+    return qFromLittleEndian<quint16>(data);
+}
@@ -0,0 +1,146 @@
+#include "qefi.h"
+
+#include <QHash>
+
+#include <algorithm>
+
+static inline quint64 qefi_store_align(quint64 size)
+{
+    return (size + QEFI_VARIABLE_STORE_ALIGNMENT - 1) &
+        ~(quint64)(QEFI_VARIABLE_STORE_ALIGNMENT - 1);
+}
+
+quint64 qefi_variable_storage_size(const QString &name, quint64 dataSize)
+{
+    // UCS-2 name with its terminator
+    const quint64 nameSize = (name.size() + 1) * 2;
+    return qefi_store_align(QEFI_AUTHENTICATED_VARIABLE_HEADER_SIZE + nameSize + dataSize);
+}
+
+QEFIVariableUsage::QEFIVariableUsage(QUuid guid, QString name, quint64 dataSize)
+    : m_guid(guid), m_name(name), m_dataSize(dataSize)
+{
+}
+
+QUuid QEFIVariableUsage::guid() const
+{
+    return m_guid;
+}
+
+QString QEFIVariableUsage::name() const
+{
+    return m_name;
+}
+
+quint64 QEFIVariableUsage::dataSize() const
+{
+    return m_dataSize;
+}
+
+quint64 QEFIVariableUsage::storageSize() const
+{
+    return qefi_variable_storage_size(m_name, m_dataSize);
+}
+
+QEFIStoreUsage::QEFIStoreUsage(quint64 storeSize)
+    : m_storeSize(storeSize)
+{
+}
+
+int QEFIStoreUsage::scan()
+{
+    int error;
+    QList<QEFIVariableUsage> variables = qefi_list_variable_usage(&error);
+    if (error != 0) return error;
+
+    m_variables = variables;
+    return 0;
+}
+
+void QEFIStoreUsage::setVariables(const QList<QEFIVariableUsage> &variables)
+{
+    m_variables = variables;
+}
+
+QList<QEFIVariableUsage> QEFIStoreUsage::variables() const
+{
+    return m_variables;
+}
+
+quint64 QEFIStoreUsage::storeSize() const
+{
+    return m_storeSize;
+}
+
+void QEFIStoreUsage::setStoreSize(quint64 storeSize)
+{
+    m_storeSize = storeSize;
+}
+
+quint64 QEFIStoreUsage::usedSize() const
+{
+    quint64 size = 0;
+    for (const QEFIVariableUsage &variable : std::as_const(m_variables))
+        size += variable.storageSize();
+    return size;
+}
+
+quint64 QEFIStoreUsage::freeSize() const
+{
+    const quint64 used = usedSize();
+    return used < m_storeSize ? m_storeSize - used : 0;
+}
+
+QMap<QUuid, quint64> QEFIStoreUsage::usageByGuid() const
+{
+    QMap<QUuid, quint64> usage;
+    for (const QEFIVariableUsage &variable : std::as_const(m_variables))
+        usage[variable.guid()] += variable.storageSize();
+    return usage;
+}
+
+QList<QEFIVariableUsage> QEFIStoreUsage::largestVariables(int count) const
+{
+    QList<QEFIVariableUsage> largest = m_variables;
+    std::stable_sort(largest.begin(), largest.end(),
+        [](const QEFIVariableUsage &a, const QEFIVariableUsage &b) {
+            return a.storageSize() > b.storageSize();
+        });
+    if (count >= 0 && count < largest.size())
+        largest.erase(largest.begin() + count, largest.end());
+    return largest;
+}
+
+quint64 QEFIStoreUsage::plannedSize(const QList<QEFIVariable> &writes) const
+{
+    QHash<QEFIVariableKey, quint64> sizes;
+    for (const QEFIVariableUsage &variable : std::as_const(m_variables))
+        sizes.insert(QEFIVariableKey(variable.guid(), variable.name()),
+            variable.dataSize());
+
+    for (const QEFIVariable &write : writes) {
+        if (write.isNull()) continue;
+        const QEFIVariableKey key(write.guid(), write.name());
+        // Writing no data deletes the variable
+        if (write.data().isEmpty() &&
+            !(write.attributes() & QEFI_VARIABLE_APPEND_WRITE)) {
+            sizes.remove(key);
+            continue;
+        }
+        quint64 &size = sizes[key];
+        if (write.attributes() & QEFI_VARIABLE_APPEND_WRITE)
+            size += write.data().size();
+        else
+            size = write.data().size();
+    }
+
+    quint64 planned = 0;
+    for (auto it = sizes.constBegin(); it != sizes.constEnd(); ++it)
+        planned += qefi_variable_storage_size(it.key().second, it.value());
+    return planned;
+}
+
+bool QEFIStoreUsage::fits(const QList<QEFIVariable> &writes) const
+{
+    return plannedSize(writes) <= m_storeSize;
+}
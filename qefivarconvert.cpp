@@ -0,0 +1,381 @@
+#include "qefi.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtEndian>
+
+#include <cerrno>
+#include <cstring>
+
+#define VARSTORE_JSON_VERSION       2
+#define VARSTORE_DEFAULT_SIZE       0x40000
+#define VARSTORE_FV_OVERHEAD        0x100
+#define VARSTORE_AWS_MAGIC          "AMZNUEFI"
+// The blob is usually handed over as base64
+#define VARSTORE_AWS_MAGIC_BASE64   "QU1aTlVFRkk"
+#define VARSTORE_AWS_CRC_OFFSET     8
+#define VARSTORE_AWS_VERSION_OFFSET 12
+#define VARSTORE_AWS_HEADER_SIZE    16
+#define VARSTORE_AWS_VERSION        0
+// EFI_TIME and the SHA-256 digest of the signer
+#define VARSTORE_AWS_AUTH_SIZE      (16 + 32)
+// FDICT in the zlib header
+#define VARSTORE_ZLIB_PRESET_DICT   0x20
+
+static const QUuid varstore_global_guid = QUuid(
+    0x8be4df61, 0x93ca, 0x11d2, 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2c, 0x8c);
+
+QEFIVarStoreFormat qefi_varstore_format(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return VARSTORE_Unknown;
+    const QByteArray head = file.read(64);
+
+    if (head.size() >= 44 && head.mid(40, 4) == QByteArray("_FVH"))
+        return VARSTORE_Edk2;
+    if (head.startsWith(VARSTORE_AWS_MAGIC) || head.startsWith(VARSTORE_AWS_MAGIC_BASE64))
+        return VARSTORE_AwsBlob;
+    if (head.trimmed().startsWith('{')) return VARSTORE_Json;
+    return VARSTORE_Unknown;
+}
+
+static int qefi_varstore_import_edk2(const QString &fileName, QEFIBackend &variables)
+{
+    QEFIVarStoreBackend store;
+    int error = store.open(fileName);
+    if (error != 0) return error;
+
+    QList<QEFIVariableKey> keys;
+    error = store.listVariables(keys);
+    if (error != 0) return error;
+
+    for (const QEFIVariableKey &key : std::as_const(keys)) {
+        int size = 0;
+        quint32 attributes = 0;
+        const char *data = store.constData(key.first, key.second, &size, &attributes);
+        if (!data) continue;
+        // Copied out of the mapping, which goes away with the store
+        error = variables.setVariable(key.first, key.second,
+            QByteArray(data, size), attributes);
+        if (error != 0) return error;
+    }
+    return 0;
+}
+
+static int qefi_varstore_import_json(const QString &fileName, QEFIBackend &variables)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return file.exists() ? -EACCES : -ENOENT;
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (parseError.error != QJsonParseError::NoError || !document.isObject())
+        return -EINVAL;
+
+    const QJsonObject root = document.object();
+    if (root.value(QStringLiteral("version")).toInt() != VARSTORE_JSON_VERSION)
+        return -ENOTSUP;
+
+    const QJsonArray list = root.value(QStringLiteral("variables")).toArray();
+    for (const QJsonValue &value : list) {
+        const QJsonObject variable = value.toObject();
+        const QString name = variable.value(QStringLiteral("name")).toString();
+        const QUuid uuid = QUuid::fromString(variable.value(QStringLiteral("guid")).toString());
+        if (name.isEmpty() || uuid.isNull()) return -EINVAL;
+
+        const QByteArray data = QByteArray::fromHex(
+            variable.value(QStringLiteral("data")).toString().toLatin1());
+        const quint32 attributes = (quint32)variable.value(QStringLiteral("attr")).toDouble();
+        int error = variables.setVariable(uuid, name, data, attributes);
+        if (error != 0) return error;
+    }
+    return 0;
+}
+
+// CRC-32 of zlib, the one in the EC2 blob header
+static quint32 varstore_crc32(const char *data, int size)
+{
+    quint32 crc = 0xffffffff;
+    for (int i = 0; i < size; i++) {
+        crc ^= (uchar)data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/*
+ * EC2 UEFI data: "AMZNUEFI", the CRC-32 of what follows, a version, then
+ * a zlib stream of little endian fields: the number of variables, then
+ * for each of them the UTF-8 name and the data prefixed by their 64 bit
+ * size, with the GUID and the attributes in between. Time based
+ * authenticated variables are followed by their timestamp and digest.
+ */
+static int qefi_varstore_import_aws(const QString &fileName, QEFIBackend &variables)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return file.exists() ? -EACCES : -ENOENT;
+    QByteArray blob = file.readAll();
+    if (!blob.startsWith(VARSTORE_AWS_MAGIC)) blob = QByteArray::fromBase64(blob.trimmed());
+
+    if (blob.size() < VARSTORE_AWS_HEADER_SIZE + 2 || !blob.startsWith(VARSTORE_AWS_MAGIC))
+        return -EINVAL;
+    const char *header = blob.constData();
+    if (qFromLittleEndian<quint32>(header + VARSTORE_AWS_CRC_OFFSET) != varstore_crc32(
+            header + VARSTORE_AWS_VERSION_OFFSET, blob.size() - VARSTORE_AWS_VERSION_OFFSET))
+        return -EINVAL;
+    if (qFromLittleEndian<quint32>(header + VARSTORE_AWS_VERSION_OFFSET) != VARSTORE_AWS_VERSION)
+        return -ENOTSUP;
+    // qUncompress() cannot be given a preset dictionary
+    if (header[VARSTORE_AWS_HEADER_SIZE + 1] & VARSTORE_ZLIB_PRESET_DICT) return -ENOTSUP;
+
+    // qUncompress() wants the size first, it only serves as a first guess
+    QByteArray stream(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(qMin(blob.size(), 0x1000000) * 4, stream.data());
+    stream.append(blob.constData() + VARSTORE_AWS_HEADER_SIZE,
+        blob.size() - VARSTORE_AWS_HEADER_SIZE);
+    const QByteArray body = qUncompress(stream);
+    if (body.isEmpty()) return -EINVAL;
+
+    QDataStream in(body);
+    in.setByteOrder(QDataStream::LittleEndian);
+    quint64 count = 0;
+    in >> count;
+    for (quint64 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        quint64 size = 0;
+        in >> size;
+        if (size > (quint64)body.size()) return -EINVAL;
+        QByteArray name((int)size, Qt::Uninitialized);
+        in.readRawData(name.data(), name.size());
+
+        char guid[16];
+        quint32 attributes = 0;
+        in.readRawData(guid, sizeof(guid));
+        in >> attributes >> size;
+        if (size > (quint64)body.size()) return -EINVAL;
+        QByteArray data((int)size, Qt::Uninitialized);
+        in.readRawData(data.data(), data.size());
+        if (attributes & QEFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS)
+            in.skipRawData(VARSTORE_AWS_AUTH_SIZE);
+        if (in.status() != QDataStream::Ok) break;
+
+        int error = variables.setVariable(qefi_format_guid((const quint8 *)guid),
+            QString::fromUtf8(name), data, attributes);
+        if (error != 0) return error;
+    }
+    return in.status() == QDataStream::Ok ? 0 : -EINVAL;
+}
+
+int qefi_varstore_import(const QString &fileName, QEFIBackend &variables,
+    QEFIVarStoreFormat format)
+{
+    if (format == VARSTORE_Unknown) format = qefi_varstore_format(fileName);
+
+    switch (format) {
+    case VARSTORE_Edk2:
+        return qefi_varstore_import_edk2(fileName, variables);
+    case VARSTORE_Json:
+        return qefi_varstore_import_json(fileName, variables);
+    case VARSTORE_AwsBlob:
+        return qefi_varstore_import_aws(fileName, variables);
+    default:
+        break;
+    }
+    return QFileInfo::exists(fileName) ? -EINVAL : -ENOENT;
+}
+
+static bool qefi_varstore_is_load_option(const QUuid &uuid, const QString &name)
+{
+    if (uuid != varstore_global_guid) return false;
+
+    static const char *prefixes[] = { "Boot", "Driver", "SysPrep", "PlatformRecovery" };
+    for (const char *prefix : prefixes) {
+        const QLatin1String start(prefix);
+        if (name.size() != start.size() + 4 || !name.startsWith(start)) continue;
+
+        bool isHex = false;
+        name.mid(start.size()).toUShort(&isHex, 16);
+        return isHex;
+    }
+    return false;
+}
+
+static int qefi_varstore_export_json(QEFIBackend &variables,
+    const QList<QEFIVariableKey> &keys, const QString &fileName, int flags)
+{
+    QJsonArray list;
+    for (const QEFIVariableKey &key : keys) {
+        QByteArray data;
+        quint32 attributes = 0;
+        int error = variables.getVariable(key.first, key.second, data, &attributes);
+        if (error != 0) return error;
+
+        QJsonObject variable;
+        variable.insert(QStringLiteral("name"), key.second);
+        variable.insert(QStringLiteral("guid"), key.first.toString(QUuid::WithoutBraces));
+        variable.insert(QStringLiteral("attr"), (qint64)attributes);
+        variable.insert(QStringLiteral("data"), QString::fromLatin1(data.toHex()));
+
+        // Extra keys, ignored when read back
+        if ((flags & QEFI_VARSTORE_PRETTY) &&
+            qefi_varstore_is_load_option(key.first, key.second)) {
+            QEFILoadOption option(data);
+            if (option.isValidated()) {
+                variable.insert(QStringLiteral("description"), option.name());
+                variable.insert(QStringLiteral("path"), option.path());
+            }
+        }
+        list.append(variable);
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("version"), VARSTORE_JSON_VERSION);
+    root.insert(QStringLiteral("variables"), list);
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return -EACCES;
+    const QByteArray json = QJsonDocument(root).toJson((flags & QEFI_VARSTORE_PRETTY) ?
+        QJsonDocument::Indented : QJsonDocument::Compact);
+    if (file.write(json) != json.size()) return -EIO;
+    return 0;
+}
+
+static int qefi_varstore_export_edk2(QEFIBackend &variables,
+    const QList<QEFIVariableKey> &keys, const QList<quint64> &sizes,
+    const QString &fileName)
+{
+    quint64 needed = 0;
+    for (int i = 0; i < keys.size(); i++)
+        needed += qefi_variable_storage_size(keys[i].second, sizes[i]);
+    if (needed + VARSTORE_FV_OVERHEAD > 0xffffffff) return -EFBIG;
+
+    int error = QEFIVarStoreBackend::create(fileName,
+        qMax<quint64>(VARSTORE_DEFAULT_SIZE, needed + VARSTORE_FV_OVERHEAD));
+    if (error != 0) return error;
+
+    QEFIVarStoreBackend store;
+    error = store.open(fileName, true);
+    if (error != 0) return error;
+
+    for (const QEFIVariableKey &key : keys) {
+        QByteArray data;
+        quint32 attributes = 0;
+        error = variables.getVariable(key.first, key.second, data, &attributes);
+        if (error != 0) return error;
+        error = store.setVariable(key.first, key.second, data, attributes);
+        if (error != 0) return error;
+    }
+    return 0;
+}
+
+// Written in base64, as taken by the EC2 API
+static int qefi_varstore_export_aws(QEFIBackend &variables,
+    const QList<QEFIVariableKey> &keys, const QString &fileName)
+{
+    QByteArray body;
+    QDataStream out(&body, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << (quint64)keys.size();
+    for (const QEFIVariableKey &key : keys) {
+        QByteArray data;
+        quint32 attributes = 0;
+        int error = variables.getVariable(key.first, key.second, data, &attributes);
+        if (error != 0) return error;
+
+        const QByteArray name = key.second.toUtf8();
+        const QByteArray guid = qefi_rfc4122_to_guid(key.first.toRfc4122());
+        out << (quint64)name.size();
+        out.writeRawData(name.constData(), name.size());
+        out.writeRawData(guid.constData(), guid.size());
+        out << attributes << (quint64)data.size();
+        out.writeRawData(data.constData(), data.size());
+        // The backend does not keep them
+        if (attributes & QEFI_VARIABLE_TIME_BASED_AUTHENTICATED_WRITE_ACCESS)
+            out.writeRawData(QByteArray(VARSTORE_AWS_AUTH_SIZE, '\0').constData(),
+                VARSTORE_AWS_AUTH_SIZE);
+    }
+
+    // Without the size prepended by qCompress()
+    QByteArray blob(VARSTORE_AWS_HEADER_SIZE, '\0');
+    memcpy(blob.data(), VARSTORE_AWS_MAGIC, 8);
+    qToLittleEndian<quint32>(VARSTORE_AWS_VERSION, blob.data() + VARSTORE_AWS_VERSION_OFFSET);
+    blob.append(qCompress(body).mid(4));
+    qToLittleEndian<quint32>(varstore_crc32(blob.constData() + VARSTORE_AWS_VERSION_OFFSET,
+        blob.size() - VARSTORE_AWS_VERSION_OFFSET), blob.data() + VARSTORE_AWS_CRC_OFFSET);
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return -EACCES;
+    const QByteArray text = blob.toBase64();
+    if (file.write(text) != text.size()) return -EIO;
+    return 0;
+}
+
+int qefi_varstore_export(QEFIBackend &variables, const QString &fileName,
+    QEFIVarStoreFormat format, int flags)
+{
+    QList<QEFIVariableKey> keys;
+    QList<quint64> sizes;
+    int error = variables.listVariables(keys, &sizes);
+    if (error != 0) return error;
+
+    switch (format) {
+    case VARSTORE_Edk2:
+        return qefi_varstore_export_edk2(variables, keys, sizes, fileName);
+    case VARSTORE_Json:
+        return qefi_varstore_export_json(variables, keys, fileName, flags);
+    case VARSTORE_AwsBlob:
+        return qefi_varstore_export_aws(variables, keys, fileName);
+    default:
+        break;
+    }
+    return -EINVAL;
+}
+
+int qefi_varstore_convert(const QString &input, const QString &output,
+    QEFIVarStoreFormat format, int flags)
+{
+    QEFIMemoryBackend variables;
+    int error = qefi_varstore_import(input, variables);
+    if (error != 0) return error;
+    return qefi_varstore_export(variables, output, format, flags);
+}
+
+QList<int> qefi_varstore_convert(const QStringList &inputs, const QString &outputDir,
+    QEFIVarStoreFormat format, int flags)
+{
+    const QDir dir(outputDir);
+    QString suffix = QStringLiteral(".fd");
+    if (format == VARSTORE_Json) suffix = QStringLiteral(".json");
+    else if (format == VARSTORE_AwsBlob) suffix = QStringLiteral(".b64");
+
+    // One file per task, each with its own variable set
+    QList<int> errors;
+    QList<QFuture<int> > futures;
+    QSet<QString> outputs;
+    for (const QString &input : inputs) {
+        const QString output = dir.filePath(QFileInfo(input).completeBaseName() + suffix);
+        // Inputs with the same base name would write the same file
+        if (outputs.contains(output)) {
+            errors.append(-EEXIST);
+            futures.append(QFuture<int>());
+            continue;
+        }
+        outputs.insert(output);
+        errors.append(0);
+        futures.append(QtConcurrent::run(qefi_offline_thread_pool(), [=]() {
+            return qefi_varstore_convert(input, output, format, flags);
+        }));
+    }
+
+    for (int i = 0; i < futures.size(); i++) {
+        if (errors[i] == 0) errors[i] = futures[i].result();
+    }
+    return errors;
+}
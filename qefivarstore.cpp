@@ -0,0 +1,562 @@
+#include "qefi.h"
+
+#include <QFile>
+#include <QHash>
+#include <QReadLocker>
+#include <QReadWriteLock>
+#include <QVector>
+#include <QWriteLocker>
+#include <QtEndian>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+/* EFI_FIRMWARE_VOLUME_HEADER */
+#define VARSTORE_FV_LENGTH_OFFSET           32
+#define VARSTORE_FV_SIGNATURE_OFFSET        40
+#define VARSTORE_FV_ATTRIBUTES_OFFSET       44
+#define VARSTORE_FV_HEADER_LENGTH_OFFSET    48
+#define VARSTORE_FV_CHECKSUM_OFFSET         50
+#define VARSTORE_FV_REVISION_OFFSET         55
+#define VARSTORE_FV_BLOCK_MAP_OFFSET        56
+#define VARSTORE_FV_SIGNATURE               0x4856465f  // "_FVH"
+
+/* VARIABLE_STORE_HEADER */
+#define VARSTORE_HEADER_SIZE                28
+#define VARSTORE_SIZE_OFFSET                16
+#define VARSTORE_FORMAT_OFFSET              20
+#define VARSTORE_STATE_OFFSET               21
+#define VARSTORE_FORMATTED                  0x5a
+#define VARSTORE_HEALTHY                    0xfe
+
+/* VARIABLE_HEADER and AUTHENTICATED_VARIABLE_HEADER */
+#define VARSTORE_START_ID                   0x55aa
+#define VARSTORE_VARIABLE_HEADER_SIZE       32
+#define VARSTORE_AUTH_VARIABLE_HEADER_SIZE  60
+
+#define VAR_IN_DELETED_TRANSITION           0xfe
+#define VAR_DELETED                         0xfd
+#define VAR_HEADER_VALID_ONLY               0x7f
+#define VAR_ADDED                           0x3f
+
+// The data follows the name, only headers are aligned (HEADER_ALIGNMENT)
+#define VARSTORE_ALIGNMENT                  4
+#define VARSTORE_BLOCK_SIZE                 0x1000
+
+static const QUuid varstore_nv_data_fv_guid = QUuid(
+    0xfff12b8d, 0x7696, 0x4c8b, 0xa9, 0x85, 0x27, 0x47, 0x07, 0x5b, 0x4f, 0x50);
+static const QUuid varstore_authenticated_guid = QUuid(
+    0xaaf32c78, 0x947b, 0x439a, 0xa1, 0x80, 0x2e, 0x14, 0x4e, 0xc3, 0x77, 0x92);
+static const QUuid varstore_variable_guid = QUuid(
+    0xddcf3616, 0x3275, 0x4164, 0x98, 0xb6, 0xfe, 0x85, 0x70, 0x7f, 0xfe, 0x7d);
+
+static inline quint64 varstore_align(quint64 offset)
+{
+    return (offset + VARSTORE_ALIGNMENT - 1) & ~(quint64)(VARSTORE_ALIGNMENT - 1);
+}
+
+static inline bool varstore_is_live(quint8 state)
+{
+    return state == VAR_ADDED ||
+        state == (VAR_ADDED & VAR_IN_DELETED_TRANSITION);
+}
+
+// Field offsets of the two variable header layouts
+struct QEFIVarStoreLayout
+{
+    int headerSize;
+    int nameSizeOffset;
+    int dataSizeOffset;
+    int guidOffset;
+};
+
+static const QEFIVarStoreLayout varstore_layout = { VARSTORE_VARIABLE_HEADER_SIZE, 8, 12, 16 };
+static const QEFIVarStoreLayout varstore_auth_layout = { VARSTORE_AUTH_VARIABLE_HEADER_SIZE, 36, 40, 44 };
+
+struct QEFIVarStoreRecord
+{
+    quint64 offset;     // Of the header
+    quint64 dataOffset;
+    quint32 dataSize;
+    quint32 attributes;
+};
+
+class QEFIVarStoreBackendPrivate
+{
+public:
+    QReadWriteLock lock;
+    QFile file;
+    uchar *map = nullptr;
+    quint64 mapSize = 0;
+    bool writable = false;
+    const QEFIVarStoreLayout *layout = &varstore_auth_layout;
+    quint64 storeBegin = 0;     // First variable
+    quint64 storeEnd = 0;       // End of the variable store
+    quint64 end = 0;            // End of the last record
+    QHash<QEFIVariableKey, QEFIVarStoreRecord> index;
+
+    int scan();
+    int append(const QUuid &uuid, const QString &name, const char *data,
+        quint32 dataSize, quint32 attributes, const QEFIVarStoreRecord *previous);
+    void setState(quint64 offset, quint8 state);
+};
+
+int QEFIVarStoreBackendPrivate::scan()
+{
+    index.clear();
+    if (mapSize < VARSTORE_FV_BLOCK_MAP_OFFSET) return -EINVAL;
+    if (qFromLittleEndian<quint32>(map + VARSTORE_FV_SIGNATURE_OFFSET) != VARSTORE_FV_SIGNATURE)
+        return -EINVAL;
+
+    const quint16 headerLength = qFromLittleEndian<quint16>(map + VARSTORE_FV_HEADER_LENGTH_OFFSET);
+    if ((quint64)headerLength + VARSTORE_HEADER_SIZE > mapSize) return -EINVAL;
+
+    const uchar *store = map + headerLength;
+    const QUuid signature = qefi_format_guid(store);
+    if (signature == varstore_authenticated_guid) layout = &varstore_auth_layout;
+    else if (signature == varstore_variable_guid) layout = &varstore_layout;
+    else return -EINVAL;
+
+    const quint32 storeSize = qFromLittleEndian<quint32>(store + VARSTORE_SIZE_OFFSET);
+    if (store[VARSTORE_FORMAT_OFFSET] != VARSTORE_FORMATTED ||
+        store[VARSTORE_STATE_OFFSET] != VARSTORE_HEALTHY ||
+        storeSize < VARSTORE_HEADER_SIZE ||
+        (quint64)headerLength + storeSize > mapSize) return -EINVAL;
+
+    storeBegin = varstore_align(headerLength + VARSTORE_HEADER_SIZE);
+    storeEnd = headerLength + storeSize;
+
+    quint64 offset = storeBegin;
+    while (offset + layout->headerSize <= storeEnd) {
+        const uchar *header = map + offset;
+        // Erased flash ends the list
+        if (qFromLittleEndian<quint16>(header) != VARSTORE_START_ID) break;
+
+        const quint32 nameSize = qFromLittleEndian<quint32>(header + layout->nameSizeOffset);
+        const quint32 dataSize = qFromLittleEndian<quint32>(header + layout->dataSizeOffset);
+        const quint64 nameOffset = offset + layout->headerSize;
+        const quint64 dataOffset = nameOffset + nameSize;
+        const quint64 next = varstore_align(dataOffset + dataSize);
+        if (nameSize > storeEnd || dataSize > storeEnd || next > storeEnd) break;
+
+        const quint8 state = header[2];
+        if (varstore_is_live(state) && nameSize >= 2) {
+            // NameSize counts the terminator
+            const QEFIVariableKey key(qefi_format_guid(header + layout->guidOffset),
+                QString((const QChar *)(map + nameOffset), nameSize / 2 - 1));
+
+            // A copy in deleted transition only counts if no added one exists
+            auto it = index.constFind(key);
+            if (it == index.constEnd() || state == VAR_ADDED) {
+                QEFIVarStoreRecord record;
+                record.offset = offset;
+                record.dataOffset = dataOffset;
+                record.dataSize = dataSize;
+                record.attributes = qFromLittleEndian<quint32>(header + 4);
+                index.insert(key, record);
+            }
+        }
+        offset = next;
+    }
+    end = offset;
+
+    return 0;
+}
+
+void QEFIVarStoreBackendPrivate::setState(quint64 offset, quint8 state)
+{
+    // Like flash, a state only clears bits
+    map[offset + 2] &= state;
+}
+
+// Header and name of a record, the header not valid yet
+static void varstore_write_header(uchar *header, const QEFIVarStoreLayout *layout,
+    const QUuid &uuid, const QString &name, quint32 dataSize, quint32 attributes)
+{
+    const quint32 nameSize = (name.size() + 1) * 2;
+    memset(header, 0, layout->headerSize);
+    qToLittleEndian<quint16>(VARSTORE_START_ID, header);
+    header[2] = VAR_HEADER_VALID_ONLY;
+    qToLittleEndian<quint32>(attributes, header + 4);
+    qToLittleEndian<quint32>(nameSize, header + layout->nameSizeOffset);
+    qToLittleEndian<quint32>(dataSize, header + layout->dataSizeOffset);
+    const QByteArray guid = qefi_rfc4122_to_guid(uuid.toRfc4122());
+    memcpy(header + layout->guidOffset, guid.constData(), guid.size());
+
+    uchar *nameData = header + layout->headerSize;
+    memcpy(nameData, name.utf16(), nameSize - 2);
+    nameData[nameSize - 2] = 0;
+    nameData[nameSize - 1] = 0;
+}
+
+int QEFIVarStoreBackendPrivate::append(const QUuid &uuid, const QString &name,
+    const char *data, quint32 dataSize, quint32 attributes,
+    const QEFIVarStoreRecord *previous)
+{
+    const quint32 nameSize = (name.size() + 1) * 2;
+    const quint64 dataOffset = end + layout->headerSize + nameSize;
+    const quint64 next = varstore_align(dataOffset + dataSize);
+    // A reclaim pass is needed to reuse the deleted records
+    if (next > storeEnd) return -ENOSPC;
+
+    uchar *header = map + end;
+    varstore_write_header(header, layout, uuid, name, dataSize, attributes);
+    if (previous && layout == &varstore_auth_layout) {
+        // Keep MonotonicCount, TimeStamp and PubKeyIndex of the replaced copy
+        memcpy(header + 8, map + previous->offset + 8, 28);
+    }
+    memcpy(map + dataOffset, data, dataSize);
+
+    // Same sequence as the firmware: the old copy is in transition while
+    // the new one gets valid, then deleted
+    if (previous) setState(previous->offset, VAR_IN_DELETED_TRANSITION);
+    setState(end, VAR_ADDED);
+    if (previous) setState(previous->offset, VAR_DELETED);
+
+    QEFIVarStoreRecord record;
+    record.offset = end;
+    record.dataOffset = dataOffset;
+    record.dataSize = dataSize;
+    record.attributes = attributes;
+    index.insert(QEFIVariableKey(uuid, name), record);
+    end = next;
+
+    return 0;
+}
+
+QEFIVarStoreBackend::QEFIVarStoreBackend()
+    : d(new QEFIVarStoreBackendPrivate)
+{
+}
+
+QEFIVarStoreBackend::~QEFIVarStoreBackend()
+{
+    close();
+}
+
+int QEFIVarStoreBackend::open(const QString &fileName, bool writable)
+{
+    close();
+
+    QWriteLocker locker(&d->lock);
+    d->file.setFileName(fileName);
+    if (!d->file.open(writable ? QIODevice::ReadWrite : QIODevice::ReadOnly))
+        return d->file.exists() ? -EACCES : -ENOENT;
+
+    d->mapSize = d->file.size();
+    d->map = d->file.map(0, d->mapSize);
+    if (!d->map) {
+        d->file.close();
+        return -EIO;
+    }
+    d->writable = writable;
+
+    int error = d->scan();
+    if (error != 0) {
+        d->file.unmap(d->map);
+        d->map = nullptr;
+        d->file.close();
+    }
+    return error;
+}
+
+void QEFIVarStoreBackend::close()
+{
+    QWriteLocker locker(&d->lock);
+    if (!d->map) return;
+
+    d->file.unmap(d->map);
+    d->map = nullptr;
+    d->file.close();
+    d->index.clear();
+}
+
+bool QEFIVarStoreBackend::isOpen() const
+{
+    return d->map != nullptr;
+}
+
+bool QEFIVarStoreBackend::isAuthenticated() const
+{
+    return d->layout == &varstore_auth_layout;
+}
+
+quint64 QEFIVarStoreBackend::storeSize() const
+{
+    QReadLocker locker(&d->lock);
+    return d->storeEnd - d->storeBegin;
+}
+
+quint64 QEFIVarStoreBackend::usedSize() const
+{
+    QReadLocker locker(&d->lock);
+    return d->end - d->storeBegin;
+}
+
+quint64 QEFIVarStoreBackend::freeSize() const
+{
+    QReadLocker locker(&d->lock);
+    return d->storeEnd - d->end;
+}
+
+quint64 QEFIVarStoreBackend::endOffset() const
+{
+    QReadLocker locker(&d->lock);
+    return d->end;
+}
+
+QByteArray QEFIVarStoreBackend::encodeVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes, bool authenticated)
+{
+    const QEFIVarStoreLayout *layout = authenticated ? &varstore_auth_layout : &varstore_layout;
+    const quint32 nameSize = (name.size() + 1) * 2;
+    const quint64 dataOffset = layout->headerSize + nameSize;
+
+    // Padding is left erased, as written by the firmware
+    QByteArray record(varstore_align(dataOffset + data.size()), (char)0xff);
+    uchar *header = (uchar *)record.data();
+    varstore_write_header(header, layout, uuid, name, data.size(), attributes);
+    memcpy(header + dataOffset, data.constData(), data.size());
+    header[2] = VAR_ADDED;
+    return record;
+}
+
+const char *QEFIVarStoreBackend::constData(const QUuid &uuid, const QString &name,
+    int *size, quint32 *attributes) const
+{
+    QReadLocker locker(&d->lock);
+    auto it = d->index.constFind(QEFIVariableKey(uuid, name));
+    if (it == d->index.constEnd()) return nullptr;
+
+    if (size) *size = it.value().dataSize;
+    if (attributes) *attributes = it.value().attributes;
+    return (const char *)d->map + it.value().dataOffset;
+}
+
+int QEFIVarStoreBackend::reclaim(quint64 *reclaimed)
+{
+    QWriteLocker locker(&d->lock);
+    if (!d->map) return -EBADF;
+    if (!d->writable) return -EROFS;
+
+    // The index only holds live records, visit them in store order
+    QVector<QHash<QEFIVariableKey, QEFIVarStoreRecord>::iterator> records;
+    records.reserve(d->index.size());
+    for (auto it = d->index.begin(); it != d->index.end(); ++it) records.append(it);
+    std::sort(records.begin(), records.end(), [](
+        const QHash<QEFIVariableKey, QEFIVarStoreRecord>::iterator &a,
+        const QHash<QEFIVariableKey, QEFIVarStoreRecord>::iterator &b) {
+        return a.value().offset < b.value().offset;
+    });
+
+    // Records only move down, each one keeps its 4 byte alignment
+    quint64 offset = d->storeBegin;
+    for (auto &it : records) {
+        QEFIVarStoreRecord &record = it.value();
+        const quint64 size = varstore_align(record.dataOffset + record.dataSize) - record.offset;
+        if (record.offset != offset) {
+            memmove(d->map + offset, d->map + record.offset, size);
+            record.dataOffset -= record.offset - offset;
+            record.offset = offset;
+        }
+        // A copy left in deleted transition is the only one now
+        d->map[offset + 2] = VAR_ADDED;
+        offset += size;
+    }
+
+    memset(d->map + offset, 0xff, d->end - offset);
+    if (reclaimed) *reclaimed = d->end - offset;
+    d->end = offset;
+
+    return 0;
+}
+
+int qefi_varstore_reclaim(const QString &fileName, quint64 *reclaimed)
+{
+    QEFIVarStoreBackend backend;
+    int error = backend.open(fileName, true);
+    if (error != 0) return error;
+    return backend.reclaim(reclaimed);
+}
+
+QList<int> qefi_varstore_reclaim(const QStringList &fileNames, QList<quint64> *reclaimed)
+{
+    // One image per task, they share nothing
+    QList<QFuture<QPair<int, quint64> > > futures;
+    for (const QString &fileName : fileNames) {
+        futures.append(QtConcurrent::run(qefi_offline_thread_pool(), [fileName]() {
+            quint64 size = 0;
+            int error = qefi_varstore_reclaim(fileName, &size);
+            return qMakePair(error, size);
+        }));
+    }
+
+    QList<int> errors;
+    if (reclaimed) reclaimed->clear();
+    for (auto &future : futures) {
+        const QPair<int, quint64> result = future.result();
+        errors.append(result.first);
+        if (reclaimed) reclaimed->append(result.second);
+    }
+    return errors;
+}
+
+bool QEFIVarStoreBackend::isAvailable()
+{
+    return isOpen();
+}
+
+bool QEFIVarStoreBackend::hasPrivilege()
+{
+    return d->writable;
+}
+
+int QEFIVarStoreBackend::getVariable(const QUuid &uuid, const QString &name,
+    QByteArray &data, quint32 *attributes)
+{
+    int size = 0;
+    const char *value = constData(uuid, name, &size, attributes);
+    if (!value) return isOpen() ? -ENOENT : -EBADF;
+
+    // A copy, the mapping changes on reclaim() and goes away on close()
+    data = QByteArray(value, size);
+    return 0;
+}
+
+int QEFIVarStoreBackend::getVariableInto(const QUuid &uuid, const QString &name,
+    char *buffer, size_t capacity, size_t *size, quint32 *attributes)
+{
+    int dataSize = 0;
+    const char *value = constData(uuid, name, &dataSize, attributes);
+    if (!value) return isOpen() ? -ENOENT : -EBADF;
+
+    *size = dataSize;
+    memcpy(buffer, value, qMin(capacity, *size));
+    return 0;
+}
+
+int QEFIVarStoreBackend::setVariable(const QUuid &uuid, const QString &name,
+    const QByteArray &data, quint32 attributes)
+{
+    QWriteLocker locker(&d->lock);
+    if (!d->map) return -EBADF;
+    if (!d->writable) return -EROFS;
+
+    const QEFIVariableKey key(uuid, name);
+    auto it = d->index.constFind(key);
+    const bool exists = it != d->index.constEnd();
+    QEFIVarStoreRecord previous;
+    if (exists) previous = it.value();
+
+    // No data deletes, like SetVariable()
+    if (data.isEmpty() && !(attributes & QEFI_VARIABLE_APPEND_WRITE)) {
+        if (!exists) return -ENOENT;
+        d->setState(previous.offset, VAR_DELETED);
+        d->index.remove(key);
+        return 0;
+    }
+
+    if (attributes & QEFI_VARIABLE_APPEND_WRITE) {
+        attributes &= ~QEFI_VARIABLE_APPEND_WRITE;
+        if (exists) {
+            QByteArray value((const char *)d->map + previous.dataOffset, previous.dataSize);
+            value.append(data);
+            return d->append(uuid, name, value.constData(), value.size(),
+                previous.attributes, &previous);
+        }
+    }
+
+    return d->append(uuid, name, data.constData(), data.size(), attributes,
+        exists ? &previous : nullptr);
+}
+
+int QEFIVarStoreBackend::deleteVariable(const QUuid &uuid, const QString &name)
+{
+    QWriteLocker locker(&d->lock);
+    if (!d->map) return -EBADF;
+    if (!d->writable) return -EROFS;
+
+    const QEFIVariableKey key(uuid, name);
+    auto it = d->index.constFind(key);
+    if (it == d->index.constEnd()) return -ENOENT;
+
+    d->setState(it.value().offset, VAR_DELETED);
+    d->index.remove(key);
+    return 0;
+}
+
+int QEFIVarStoreBackend::listVariables(QList<QEFIVariableKey> &variables,
+    QList<quint64> *sizes, const QUuid *uuid, const QString &prefix)
+{
+    QReadLocker locker(&d->lock);
+    if (!d->map) return -EBADF;
+
+    for (auto it = d->index.constBegin(); it != d->index.constEnd(); ++it) {
+        if (uuid && *uuid != it.key().first) continue;
+        if (!it.key().second.startsWith(prefix)) continue;
+
+        variables.append(it.key());
+        if (sizes) sizes->append(it.value().dataSize);
+    }
+    return 0;
+}
+
+int QEFIVarStoreBackend::variableSize(const QUuid &uuid, const QString &name,
+    quint64 *size)
+{
+    int dataSize = 0;
+    if (!constData(uuid, name, &dataSize)) return isOpen() ? -ENOENT : -EBADF;
+    *size = dataSize;
+    return 0;
+}
+
+int QEFIVarStoreBackend::variableAttributes(const QUuid &uuid, const QString &name,
+    quint32 *attributes)
+{
+    if (!constData(uuid, name, nullptr, attributes)) return isOpen() ? -ENOENT : -EBADF;
+    return 0;
+}
+
+int QEFIVarStoreBackend::create(const QString &fileName, quint32 storeSize,
+    bool authenticated)
+{
+    // Volume header with a block map of one run and its terminator
+    const quint16 headerLength = VARSTORE_FV_BLOCK_MAP_OFFSET + 16;
+    const quint64 volumeSize = (headerLength + (quint64)storeSize +
+        VARSTORE_BLOCK_SIZE - 1) & ~(quint64)(VARSTORE_BLOCK_SIZE - 1);
+
+    QByteArray image(volumeSize, (char)0xff);
+    uchar *fv = (uchar *)image.data();
+    memset(fv, 0, headerLength);
+    const QByteArray fvGuid = qefi_rfc4122_to_guid(varstore_nv_data_fv_guid.toRfc4122());
+    memcpy(fv + 16, fvGuid.constData(), 16);
+    qToLittleEndian<quint64>(volumeSize, fv + VARSTORE_FV_LENGTH_OFFSET);
+    qToLittleEndian<quint32>(VARSTORE_FV_SIGNATURE, fv + VARSTORE_FV_SIGNATURE_OFFSET);
+    qToLittleEndian<quint32>(0x0004feff, fv + VARSTORE_FV_ATTRIBUTES_OFFSET);
+    qToLittleEndian<quint16>(headerLength, fv + VARSTORE_FV_HEADER_LENGTH_OFFSET);
+    fv[VARSTORE_FV_REVISION_OFFSET] = 2;
+    qToLittleEndian<quint32>(volumeSize / VARSTORE_BLOCK_SIZE, fv + VARSTORE_FV_BLOCK_MAP_OFFSET);
+    qToLittleEndian<quint32>(VARSTORE_BLOCK_SIZE, fv + VARSTORE_FV_BLOCK_MAP_OFFSET + 4);
+
+    // The 16 bit words of the header sum to zero
+    quint16 sum = 0;
+    for (int i = 0; i < headerLength; i += 2) sum += qFromLittleEndian<quint16>(fv + i);
+    qToLittleEndian<quint16>((quint16)(0x10000 - sum), fv + VARSTORE_FV_CHECKSUM_OFFSET);
+
+    uchar *store = fv + headerLength;
+    memset(store, 0, VARSTORE_HEADER_SIZE);
+    const QByteArray storeGuid = qefi_rfc4122_to_guid((authenticated ?
+        varstore_authenticated_guid : varstore_variable_guid).toRfc4122());
+    memcpy(store, storeGuid.constData(), 16);
+    qToLittleEndian<quint32>(volumeSize - headerLength, store + VARSTORE_SIZE_OFFSET);
+    store[VARSTORE_FORMAT_OFFSET] = VARSTORE_FORMATTED;
+    store[VARSTORE_STATE_OFFSET] = VARSTORE_HEALTHY;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return -EACCES;
+    if (file.write(image) != image.size()) return -EIO;
+    return 0;
+}
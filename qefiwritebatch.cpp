@@ -0,0 +1,187 @@
+#include "qefi.h"
+
+#include <QDebug>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cerrno>
+
+enum QEFIWriteBatchStage
+{
+    STAGE_Entries   = 0,
+    STAGE_Orders    = 1,
+    STAGE_BootNext  = 2,
+    STAGE_Deletions = 3
+};
+
+struct QEFIWriteBatchStep
+{
+    QEFIVariableKey key;
+    QEFIVariable variable;  // Null for a deletion
+    QEFIVariable previous;  // Null when the variable did not exist
+    int stage;
+};
+
+static int qefi_write_batch_stage(const QString &name)
+{
+    if (name == QLatin1String("BootNext")) return STAGE_BootNext;
+    // BootOrder, DriverOrder, SysPrepOrder, PlatformRecoveryOrder...
+    if (name.endsWith(QLatin1String("Order"))) return STAGE_Orders;
+    return STAGE_Entries;
+}
+
+static bool qefi_write_batch_is_stored(const QEFIVariable &stored,
+    const QEFIVariable &variable)
+{
+    // An append always changes the variable
+    if (stored.isNull() || (variable.attributes() & QEFI_VARIABLE_APPEND_WRITE))
+        return false;
+    return stored.attributes() == variable.attributes() &&
+        stored.data() == variable.data();
+}
+
+QEFIWriteBatch::QEFIWriteBatch()
+    : m_written(0), m_skipped(0)
+{
+}
+
+void QEFIWriteBatch::setVariable(const QEFIVariable &variable)
+{
+    if (variable.isNull()) return;
+
+    const QEFIVariableKey key(variable.guid(), variable.name());
+    m_deletions.removeAll(key);
+    for (int i = 0; i < m_writes.size(); i++) {
+        if (m_writes[i].guid() == key.first && m_writes[i].name() == key.second) {
+            // The last staged value wins
+            m_writes[i] = variable;
+            return;
+        }
+    }
+    m_writes.append(variable);
+}
+
+void QEFIWriteBatch::setVariable(QUuid uuid, QString name, QByteArray value,
+    quint32 attributes)
+{
+    setVariable(QEFIVariable(uuid, name, value, attributes));
+}
+
+void QEFIWriteBatch::setVariableUint16(QUuid uuid, QString name, quint16 value)
+{
+    QByteArray data(sizeof(quint16), Qt::Uninitialized);
+    qToLittleEndian<quint16>(value, data.data());
+    setVariable(QEFIVariable(uuid, name, data));
+}
+
+void QEFIWriteBatch::removeVariable(QUuid uuid, QString name)
+{
+    for (int i = 0; i < m_writes.size(); i++) {
+        if (m_writes[i].guid() == uuid && m_writes[i].name() == name) {
+            m_writes.removeAt(i);
+            break;
+        }
+    }
+    const QEFIVariableKey key(uuid, name);
+    if (!m_deletions.contains(key)) m_deletions.append(key);
+}
+
+int QEFIWriteBatch::size() const
+{
+    return m_writes.size() + m_deletions.size();
+}
+
+void QEFIWriteBatch::clear()
+{
+    m_writes.clear();
+    m_deletions.clear();
+}
+
+int QEFIWriteBatch::commit()
+{
+    m_written = 0;
+    m_skipped = 0;
+
+    QList<QEFIWriteBatchStep> steps;
+    for (const QEFIVariable &variable : std::as_const(m_writes)) {
+        QEFIWriteBatchStep step;
+        step.key = QEFIVariableKey(variable.guid(), variable.name());
+        step.variable = variable;
+        step.stage = qefi_write_batch_stage(variable.name());
+        steps.append(step);
+    }
+    for (const QEFIVariableKey &key : std::as_const(m_deletions)) {
+        QEFIWriteBatchStep step;
+        step.key = key;
+        step.stage = STAGE_Deletions;
+        steps.append(step);
+    }
+    // Keep the staging order inside a stage
+    std::stable_sort(steps.begin(), steps.end(),
+        [](const QEFIWriteBatchStep &a, const QEFIWriteBatchStep &b) {
+            return a.stage < b.stage;
+        });
+
+    // Capture everything before the first write, so a read failure
+    // aborts the batch while nothing is changed yet
+    for (QEFIWriteBatchStep &step : steps) {
+        int error;
+        step.previous = qefi_read_variable(step.key.first, step.key.second, &error);
+        if (step.previous.isNull() && error != -ENOENT) {
+            qCritical() << "Cannot capture" << step.key.second << "error" << error;
+            return error;
+        }
+    }
+
+    QList<int> done;
+    int error = 0;
+    for (int i = 0; i < steps.size(); i++) {
+        const QEFIWriteBatchStep &step = steps[i];
+        if (step.variable.isNull()) {
+            if (step.previous.isNull()) {
+                m_skipped++;
+                continue;
+            }
+            error = qefi_delete_variable(step.key.first, step.key.second);
+        } else {
+            if (qefi_write_batch_is_stored(step.previous, step.variable)) {
+                m_skipped++;
+                continue;
+            }
+            error = qefi_write_variable(step.variable);
+        }
+
+        if (error != 0) {
+            qCritical() << "Cannot commit" << step.key.second << "error" << error;
+            break;
+        }
+        done.append(i);
+        m_written++;
+    }
+
+    if (error != 0) {
+        // Restore the captured values, last step first
+        for (int i = done.size() - 1; i >= 0; i--) {
+            const QEFIWriteBatchStep &step = steps[done[i]];
+            int rc = step.previous.isNull() ?
+                qefi_delete_variable(step.key.first, step.key.second) :
+                qefi_write_variable(step.previous);
+            if (rc != 0) {
+                qCritical() << "Cannot restore" << step.key.second << "error" << rc;
+            }
+        }
+        m_written = 0;
+    }
+
+    return error;
+}
+
+int QEFIWriteBatch::writtenCount() const
+{
+    return m_written;
+}
+
+int QEFIWriteBatch::skippedCount() const
+{
+    return m_skipped;
+}
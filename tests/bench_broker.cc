@@ -0,0 +1,100 @@
+#include <QtTest/QtTest>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
+#include "../qefi.h"
+
+#define BENCH_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+#define BENCH_VARIABLES 32
+#define BENCH_BATCH 16
+#define BENCH_REQUESTS_PER_CLIENT 2000
+
+// A client of its own, as a separate tool would have
+class BenchClient : public QRunnable
+{
+protected:
+    const QString &m_path;
+    const QList<QEFIVariableKey> &m_keys;
+    QAtomicInt &m_failures;
+public:
+    BenchClient(const QString &path, const QList<QEFIVariableKey> &keys,
+        QAtomicInt &failures)
+        : m_path(path), m_keys(keys), m_failures(failures) {}
+
+    void run() override
+    {
+        QEFIBrokerBackend client(m_path);
+        QList<QEFIVariable> variables;
+        for (int i = 0; i < BENCH_REQUESTS_PER_CLIENT; i++) {
+            const int first = (i * BENCH_BATCH) % (m_keys.size() - BENCH_BATCH);
+            if (client.getVariables(m_keys.mid(first, BENCH_BATCH), variables) != 0 ||
+                variables.size() != BENCH_BATCH) m_failures.ref();
+        }
+    }
+};
+
+class BenchBroker : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QEFIMemoryBackend m_variables;
+    QEFIBrokerServer *m_server = nullptr;
+    QString m_path;
+    QList<QEFIVariableKey> m_keys;
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void benchmarkConcurrentClients();
+};
+
+void BenchBroker::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    const QUuid guid = QUuid::fromString(QLatin1String(BENCH_GUID));
+    for (int i = 0; i < BENCH_VARIABLES; i++) {
+        m_keys.append(QEFIVariableKey(guid, QStringLiteral("Var%1").arg(i)));
+        QCOMPARE(m_variables.setVariable(guid, m_keys.last().second,
+            QByteArray(64, (char)i), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    }
+
+    m_path = m_dir.filePath(QStringLiteral("broker.sock"));
+    m_server = new QEFIBrokerServer(&m_variables);
+    QCOMPARE(m_server->listen(m_path), 0);
+}
+
+void BenchBroker::cleanupTestCase()
+{
+    delete m_server;
+}
+
+void BenchBroker::benchmarkConcurrentClients()
+{
+    for (int clients = 1; clients <= 32; clients *= 2) {
+        QThreadPool pool;
+        pool.setMaxThreadCount(clients);
+        QAtomicInt failures;
+        const quint64 requests = m_server->requestCount();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < clients; i++)
+            pool.start(new BenchClient(m_path, m_keys, failures));
+        pool.waitForDone();
+        const double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+
+        QCOMPARE(failures.loadAcquire(), 0);
+        QCOMPARE(m_server->requestCount() - requests,
+            (quint64)clients * BENCH_REQUESTS_PER_CLIENT);
+        const double rate = clients * BENCH_REQUESTS_PER_CLIENT / seconds;
+        qInfo("%d clients: %.0f requests/s, %.0f variables/s", clients, rate,
+            rate * BENCH_BATCH);
+    }
+    qInfo("cache hits: %llu", (unsigned long long)m_server->cacheHitCount());
+}
+
+QTEST_MAIN(BenchBroker)
+
+#include "bench_broker.moc"
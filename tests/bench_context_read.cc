@@ -0,0 +1,110 @@
+#include <QtTest/QtTest>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
+#include "../qefi.h"
+
+#define BENCH_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+#define BENCH_VARIABLES 64
+#define BENCH_READS_PER_THREAD 20000
+
+class BenchReader : public QRunnable
+{
+protected:
+    QEFIContext &m_context;
+    const QList<QEFIVariableKey> &m_keys;
+    QAtomicInt &m_failures;
+public:
+    BenchReader(QEFIContext &context, const QList<QEFIVariableKey> &keys,
+        QAtomicInt &failures)
+        : m_context(context), m_keys(keys), m_failures(failures) {}
+
+    void run() override
+    {
+        for (int i = 0; i < BENCH_READS_PER_THREAD; i++) {
+            const QEFIVariableKey &key = m_keys[i % m_keys.size()];
+            if (qefi_get_variable_uint16(m_context, key.first, key.second) !=
+                (quint16)(i % m_keys.size())) m_failures.ref();
+        }
+    }
+};
+
+class BenchContextRead : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QList<QEFIVariableKey> m_keys;
+
+    double readsPerSecond(QEFIContext &context, int threads);
+private slots:
+    void initTestCase();
+    void benchmarkSharedContext();
+    void benchmarkMemoryContext();
+};
+
+void BenchContextRead::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    const QUuid guid = QUuid::fromString(QLatin1String(BENCH_GUID));
+    for (int i = 0; i < BENCH_VARIABLES; i++)
+        m_keys.append(QEFIVariableKey(guid, QStringLiteral("Var%1").arg(i)));
+}
+
+// Every thread reads through the same context
+double BenchContextRead::readsPerSecond(QEFIContext &context, int threads)
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    QAtomicInt failures;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < threads; i++) pool.start(new BenchReader(context, m_keys, failures));
+    pool.waitForDone();
+    const qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+
+    if (failures.loadAcquire() != 0) return -1;
+    return (double)threads * BENCH_READS_PER_THREAD * 1e9 / elapsed;
+}
+
+void BenchContextRead::benchmarkSharedContext()
+{
+    QEFIContext context(m_dir.path() + QLatin1Char('/'));
+    QCOMPARE(context.root(), m_dir.path() + QLatin1Char('/'));
+    for (int i = 0; i < m_keys.size(); i++)
+        qefi_set_variable_uint16(context, m_keys[i].first, m_keys[i].second, i);
+
+    const int cores = QThread::idealThreadCount();
+    const double single = readsPerSecond(context, 1);
+    QVERIFY(single > 0);
+    for (int threads = 1; threads <= cores; threads *= 2) {
+        const double rate = readsPerSecond(context, threads);
+        QVERIFY(rate > 0);
+        qInfo("%d threads: %.0f reads/s, %.2fx", threads, rate, rate / single);
+    }
+}
+
+void BenchContextRead::benchmarkMemoryContext()
+{
+    QEFIMemoryBackend backend;
+    QEFIContext context(&backend);
+    QCOMPARE(context.backend(), (QEFIBackend *)&backend);
+    for (int i = 0; i < m_keys.size(); i++)
+        qefi_set_variable_uint16(context, m_keys[i].first, m_keys[i].second, i);
+
+    const int cores = QThread::idealThreadCount();
+    const double single = readsPerSecond(context, 1);
+    QVERIFY(single > 0);
+    for (int threads = 1; threads <= cores; threads *= 2) {
+        const double rate = readsPerSecond(context, threads);
+        QVERIFY(rate > 0);
+        qInfo("%d threads, memory: %.0f reads/s, %.2fx", threads, rate, rate / single);
+    }
+}
+
+QTEST_MAIN(BenchContextRead)
+
+#include "bench_context_read.moc"
@@ -0,0 +1,79 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QFile>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include "../qefi.h"
+
+#define BENCH_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+
+// The lookup before it was rewritten, kept here as the baseline:
+// the full path is rebuilt and resolved from / on every call
+static int legacy_open_read(const QString &root, const QUuid &guid,
+    const QString &name, char *buffer, size_t size)
+{
+    const QString &path = QString("%1%2-%3").arg(root).arg(name)
+        .arg(guid.toString(QUuid::WithoutBraces));
+    int fd = open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t rc = read(fd, buffer, size);
+    close(fd);
+    return rc < 0 ? -1 : 0;
+}
+
+class BenchEfivarfsOpen : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QString m_root;
+    QUuid m_guid;
+private slots:
+    void initTestCase();
+    void benchmarkLegacyOpen();
+    void benchmarkOpen();
+};
+
+void BenchEfivarfsOpen::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_root = m_dir.path() + QLatin1Char('/');
+    m_guid = QUuid::fromString(QLatin1String(BENCH_GUID));
+    // Must be set before the first call into the library
+    qputenv("EFIVARFS_PATH", QFile::encodeName(m_root));
+
+    QFile bootCurrent(m_root + QStringLiteral("BootCurrent-" BENCH_GUID));
+    QVERIFY(bootCurrent.open(QIODevice::WriteOnly));
+    bootCurrent.write(QByteArray("\x07\x00\x00\x00\x01\x00", 6));
+    bootCurrent.close();
+}
+
+void BenchEfivarfsOpen::benchmarkLegacyOpen()
+{
+    const QString name = QStringLiteral("BootCurrent");
+    char buffer[6];
+    QCOMPARE(legacy_open_read(m_root, m_guid, name, buffer, sizeof(buffer)), 0);
+
+    QBENCHMARK {
+        legacy_open_read(m_root, m_guid, name, buffer, sizeof(buffer));
+    }
+}
+
+void BenchEfivarfsOpen::benchmarkOpen()
+{
+    // Same open and read, relative to the cached root descriptor
+    const QString name = QStringLiteral("BootCurrent");
+    QCOMPARE(qefi_get_variable_uint16(m_guid, name), (quint16)1);
+
+    QBENCHMARK {
+        qefi_get_variable_uint16(m_guid, name);
+    }
+}
+
+QTEST_MAIN(BenchEfivarfsOpen)
+
+#include "bench_efivarfs_open.moc"
@@ -0,0 +1,341 @@
+// The interposed libc calls must not be replaced by fortified inlines
+#undef _FORTIFY_SOURCE
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QFileInfo>
+#include <QFile>
+
+extern "C" {
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+#include "../qefi.h"
+
+/*
+ * The calls below are interposed so that the syscalls and the heap
+ * allocations made by one read can be counted, without strace or perf.
+ */
+static bool counting = false;
+static quint64 syscall_count = 0;
+static quint64 allocation_count = 0;
+
+#define QEFI_BENCH_NEXT(name) \
+    ((__typeof__(&name))dlsym(RTLD_NEXT, #name))
+#define QEFI_BENCH_COUNT_SYSCALL() \
+    do { if (counting) syscall_count++; } while (0)
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+    if (counting) allocation_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) __THROW
+{
+    if (counting) allocation_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+    if (counting) allocation_count++;
+    return __libc_realloc(ptr, size);
+}
+
+int open(const char *path, int flags, ...)
+{
+    static auto next = QEFI_BENCH_NEXT(open);
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    static auto next = QEFI_BENCH_NEXT(open64);
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(path, flags, mode);
+}
+
+// The library resolves entries relative to the root descriptor
+int openat(int dirfd, const char *path, int flags, ...)
+{
+    static auto next = QEFI_BENCH_NEXT(openat);
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+    static auto next = QEFI_BENCH_NEXT(openat64);
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(dirfd, path, flags, mode);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    static auto next = QEFI_BENCH_NEXT(read);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(fd, buf, count);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    static auto next = QEFI_BENCH_NEXT(readv);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(fd, iov, iovcnt);
+}
+
+int fstat(int fd, struct stat *st) __THROW
+{
+    static auto next = QEFI_BENCH_NEXT(fstat);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(fd, st);
+}
+
+int fstat64(int fd, struct stat64 *st) __THROW
+{
+    static auto next = QEFI_BENCH_NEXT(fstat64);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(fd, st);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags) __THROW
+{
+    static auto next = QEFI_BENCH_NEXT(fstatat);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(dirfd, path, st, flags);
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *st, int flags) __THROW
+{
+    static auto next = QEFI_BENCH_NEXT(fstatat64);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(dirfd, path, st, flags);
+}
+
+int stat64(const char *path, struct stat64 *st) __THROW
+{
+    static auto next = QEFI_BENCH_NEXT(stat64);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(path, st);
+}
+
+int statx(int dirfd, const char *path, int flags,
+    unsigned int mask, struct statx *st) __THROW
+{
+    static auto next = QEFI_BENCH_NEXT(statx);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(dirfd, path, flags, mask, st);
+}
+
+int close(int fd)
+{
+    static auto next = QEFI_BENCH_NEXT(close);
+    QEFI_BENCH_COUNT_SYSCALL();
+    return next(fd);
+}
+}
+
+#define BENCH_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+#define BENCH_COUNTED_READS 1000
+
+// The read path before it was rewritten, kept here as the baseline
+static QByteArray legacy_get_variable(const QString &root,
+    const QUuid &guid, const QString &name)
+{
+    const QString &path = QString("%1%2-%3").arg(root).arg(name)
+        .arg(guid.toString(QUuid::WithoutBraces));
+    QFileInfo fileInfo(path);
+    if (!fileInfo.exists()) return QByteArray();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+
+    uint32_t attributes;
+    if (file.read((char *)&attributes, sizeof(uint32_t)) != sizeof(uint32_t))
+        return QByteArray();
+
+    qint64 size = file.size() - sizeof(uint32_t);
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (file.read((char *)data, size) != size) {
+        free(data);
+        return QByteArray();
+    }
+
+    QByteArray value;
+    for (qint64 i = 0; i < size; i++) {
+        value.append(data[i]);
+    }
+    free(data);
+    return value;
+}
+
+class BenchEfivarfsRead : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QString m_root;
+    QUuid m_guid;
+    QByteArray m_bootOrder;
+
+    template <typename F> void report(const char *label, F read);
+private slots:
+    void initTestCase();
+    void benchmarkLegacyRead();
+    void benchmarkRead();
+    void benchmarkReadUint16();
+    void benchmarkReadInto();
+};
+
+template <typename F>
+void BenchEfivarfsRead::report(const char *label, F read)
+{
+    syscall_count = allocation_count = 0;
+    counting = true;
+    for (int i = 0; i < BENCH_COUNTED_READS; i++) read();
+    counting = false;
+
+    qInfo("%s: %.1f syscalls, %.1f allocations per read", label,
+        (double)syscall_count / BENCH_COUNTED_READS,
+        (double)allocation_count / BENCH_COUNTED_READS);
+}
+
+void BenchEfivarfsRead::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_root = m_dir.path() + QLatin1Char('/');
+    m_guid = QUuid::fromString(QLatin1String(BENCH_GUID));
+    // Must be set before the first call into the library
+    qputenv("EFIVARFS_PATH", QFile::encodeName(m_root));
+
+    for (int i = 0; i < 32; i++) {
+        m_bootOrder.append((char)i);
+        m_bootOrder.append((char)0);
+    }
+
+    QByteArray attributes("\x07\x00\x00\x00", 4);
+    QFile bootOrder(m_root + QStringLiteral("BootOrder-" BENCH_GUID));
+    QVERIFY(bootOrder.open(QIODevice::WriteOnly));
+    bootOrder.write(attributes + m_bootOrder);
+    bootOrder.close();
+
+    QFile bootCurrent(m_root + QStringLiteral("BootCurrent-" BENCH_GUID));
+    QVERIFY(bootCurrent.open(QIODevice::WriteOnly));
+    bootCurrent.write(attributes + QByteArray("\x01\x00", 2));
+    bootCurrent.close();
+}
+
+void BenchEfivarfsRead::benchmarkLegacyRead()
+{
+    const QString name = QStringLiteral("BootOrder");
+    QCOMPARE(legacy_get_variable(m_root, m_guid, name), m_bootOrder);
+
+    report("legacy qefi_get_variable", [&]() {
+        legacy_get_variable(m_root, m_guid, name);
+    });
+    QBENCHMARK {
+        legacy_get_variable(m_root, m_guid, name);
+    }
+}
+
+void BenchEfivarfsRead::benchmarkRead()
+{
+    const QString name = QStringLiteral("BootOrder");
+    QCOMPARE(qefi_get_variable(m_guid, name), m_bootOrder);
+
+    report("qefi_get_variable", [&]() {
+        qefi_get_variable(m_guid, name);
+    });
+    QBENCHMARK {
+        qefi_get_variable(m_guid, name);
+    }
+}
+
+void BenchEfivarfsRead::benchmarkReadUint16()
+{
+    const QString name = QStringLiteral("BootCurrent");
+    QCOMPARE(qefi_get_variable_uint16(m_guid, name), (quint16)1);
+
+    report("qefi_get_variable_uint16", [&]() {
+        qefi_get_variable_uint16(m_guid, name);
+    });
+    QBENCHMARK {
+        qefi_get_variable_uint16(m_guid, name);
+    }
+}
+
+void BenchEfivarfsRead::benchmarkReadInto()
+{
+    const QString name = QStringLiteral("BootOrder");
+    char small[4];
+    size_t size = 0;
+    QCOMPARE(qefi_get_variable_into(m_guid, name, small, sizeof(small), &size), -ENOBUFS);
+    QCOMPARE(size, (size_t)m_bootOrder.size());
+
+    char buffer[256];
+    QCOMPARE(qefi_get_variable_into(m_guid, name, buffer, sizeof(buffer), &size), 0);
+    QCOMPARE(QByteArray(buffer, size), m_bootOrder);
+
+    // Grown by the first read only
+    QByteArray scratch;
+    QCOMPARE(qefi_get_variable_into(m_guid, name, scratch), 0);
+    QCOMPARE(scratch, m_bootOrder);
+
+    report("qefi_get_variable_into", [&]() {
+        qefi_get_variable_into(m_guid, name, buffer, sizeof(buffer), &size);
+    });
+    QCOMPARE(allocation_count, (quint64)0);
+    report("qefi_get_variable_into QByteArray", [&]() {
+        qefi_get_variable_into(m_guid, name, scratch);
+    });
+    QCOMPARE(allocation_count, (quint64)0);
+
+    QBENCHMARK {
+        qefi_get_variable_into(m_guid, name, buffer, sizeof(buffer), &size);
+    }
+}
+
+QTEST_MAIN(BenchEfivarfsRead)
+
+#include "bench_efivarfs_read.moc"
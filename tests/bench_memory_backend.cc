@@ -0,0 +1,115 @@
+#include <QtTest/QtTest>
+#include <QElapsedTimer>
+
+#include "test_data.h"
+#include "../qefi.h"
+
+#define BENCH_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+#define BENCH_BOOT_ENTRIES 32
+// A slow SetVariable, as seen on real firmware
+#define BENCH_SET_LATENCY_USECS 20000
+
+static QString boot_name(quint16 id)
+{
+    return QStringLiteral("Boot") +
+        QString::number(id, 16).rightJustified(4, QLatin1Char('0')).toUpper();
+}
+
+class BenchMemoryBackend : public QObject
+{
+    Q_OBJECT
+private:
+    QEFIMemoryBackend m_backend;
+    QUuid m_guid;
+    QList<QEFIVariable> m_entries;
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void benchmarkParseBootEntries();
+    void benchmarkWriteBatch();
+    void benchmarkWriteIfChanged();
+};
+
+void BenchMemoryBackend::initTestCase()
+{
+    m_guid = QUuid::fromString(QLatin1String(BENCH_GUID));
+    qefi_set_default_backend(&m_backend);
+
+    const QByteArray boot((const char *)test_boot_data, TEST_BOOT_DATA_LENGTH);
+    QByteArray order;
+    for (int i = 0; i < BENCH_BOOT_ENTRIES; i++) {
+        m_entries.append(QEFIVariable(m_guid, boot_name(i), boot));
+        order.append((char)i);
+        order.append((char)0);
+    }
+    m_entries.append(QEFIVariable(m_guid, QStringLiteral("BootOrder"), order));
+}
+
+void BenchMemoryBackend::cleanupTestCase()
+{
+    qefi_set_default_backend(nullptr);
+}
+
+void BenchMemoryBackend::benchmarkParseBootEntries()
+{
+    m_backend.clear();
+    m_backend.setLatency(BACKEND_Set, 0);
+    for (const QEFIVariable &entry : std::as_const(m_entries))
+        QCOMPARE(qefi_write_variable(entry), 0);
+
+    QBENCHMARK {
+        const QByteArray order = qefi_get_variable(m_guid, QStringLiteral("BootOrder"));
+        for (int i = 0; i + 1 < order.size(); i += 2) {
+            const quint16 id = qFromLittleEndian<quint16>(order.constData() + i);
+            QEFILoadOption option(qefi_get_variable(m_guid, boot_name(id)));
+            QVERIFY(option.isValidated());
+        }
+    }
+}
+
+void BenchMemoryBackend::benchmarkWriteBatch()
+{
+    m_backend.clear();
+    m_backend.setLatency(BACKEND_Set, BENCH_SET_LATENCY_USECS);
+
+    QEFIWriteBatch batch;
+    for (const QEFIVariable &entry : std::as_const(m_entries)) batch.setVariable(entry);
+
+    QElapsedTimer timer;
+    m_backend.resetOperationCounts();
+    timer.start();
+    QCOMPARE(batch.commit(), 0);
+    qInfo("First commit: %d writes in %lld ms", batch.writtenCount(),
+        (long long)timer.elapsed());
+    QCOMPARE(m_backend.operationCount(BACKEND_Set), (quint64)m_entries.size());
+
+    // Nothing changed, no SetVariable at all
+    m_backend.resetOperationCounts();
+    timer.restart();
+    QCOMPARE(batch.commit(), 0);
+    qInfo("Second commit: %d skipped in %lld ms", batch.skippedCount(),
+        (long long)timer.elapsed());
+    QCOMPARE(m_backend.operationCount(BACKEND_Set), (quint64)0);
+}
+
+void BenchMemoryBackend::benchmarkWriteIfChanged()
+{
+    m_backend.clear();
+    m_backend.setLatency(BACKEND_Set, BENCH_SET_LATENCY_USECS);
+    qefi_clear_write_cache();
+    for (const QEFIVariable &entry : std::as_const(m_entries))
+        QCOMPARE(qefi_write_variable_if_changed(entry), 0);
+
+    // Served by the write cache, neither reads nor writes reach the backend
+    m_backend.resetOperationCounts();
+    QBENCHMARK {
+        for (const QEFIVariable &entry : std::as_const(m_entries))
+            qefi_write_variable_if_changed(entry);
+    }
+    QCOMPARE(m_backend.operationCount(BACKEND_Set), (quint64)0);
+    QCOMPARE(m_backend.operationCount(BACKEND_Get), (quint64)0);
+}
+
+QTEST_MAIN(BenchMemoryBackend)
+
+#include "bench_memory_backend.moc"
@@ -0,0 +1,141 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QFile>
+
+#include <cerrno>
+
+#include "../qefi.h"
+
+#define TEST_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+
+class TestAsyncReader : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QUuid m_guid;
+
+    void writeVariable(const QString &name, const QByteArray &data);
+    QList<QEFIAsyncResult> collect(QEFIAsyncReader &reader, int count);
+private slots:
+    void initTestCase();
+    void test_async_read();
+    void test_async_read_large();
+    void test_async_read_queued();
+};
+
+void TestAsyncReader::writeVariable(const QString &name, const QByteArray &data)
+{
+    QFile file(m_dir.path() + QLatin1Char('/') + name +
+        QStringLiteral("-" TEST_GUID));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(QByteArray("\x07\x00\x00\x00", 4) + data);
+}
+
+QList<QEFIAsyncResult> TestAsyncReader::collect(QEFIAsyncReader &reader, int count)
+{
+    QList<QEFIAsyncResult> results;
+    while (results.size() < count && reader.waitForResults(5000)) {
+        results.append(reader.takeResults());
+    }
+    return results;
+}
+
+void TestAsyncReader::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_guid = QUuid::fromString(QLatin1String(TEST_GUID));
+    // Must be set before the first call into the library
+    qputenv("EFIVARFS_PATH", QFile::encodeName(m_dir.path() + QLatin1Char('/')));
+
+    for (int i = 0; i < 32; i++) {
+        writeVariable(QStringLiteral("Boot%1").arg(i, 4, 16, QLatin1Char('0')),
+            QByteArray(16 + i, (char)i));
+    }
+}
+
+void TestAsyncReader::test_async_read()
+{
+    QEFIAsyncReader reader;
+    QVERIFY(reader.eventDescriptor() >= 0);
+#if defined(QEFI_USE_IO_URING)
+    QVERIFY(reader.isAsynchronous());
+#else
+    QVERIFY(!reader.isAsynchronous());
+#endif
+
+    QList<QEFIVariableKey> keys;
+    for (int i = 0; i < 32; i++) {
+        keys.append(QEFIVariableKey(m_guid,
+            QStringLiteral("Boot%1").arg(i, 4, 16, QLatin1Char('0'))));
+    }
+    keys.append(QEFIVariableKey(m_guid, QStringLiteral("Missing")));
+    QList<quint64> ids = reader.submit(keys);
+    QCOMPARE(ids.size(), keys.size());
+
+    QList<QEFIAsyncResult> results = collect(reader, keys.size());
+    QCOMPARE(results.size(), keys.size());
+    for (const QEFIAsyncResult &result : results) {
+        int index = ids.indexOf(result.id);
+        QVERIFY(index >= 0);
+        if (index == 32) {
+            QCOMPARE(result.error, -ENOENT);
+            QVERIFY(result.variable.isNull());
+            continue;
+        }
+        QCOMPARE(result.error, 0);
+        QCOMPARE(result.variable.name(), keys[index].second);
+        QCOMPARE(result.variable.attributes(), (quint32)0x07);
+        QCOMPARE(result.variable.data(), QByteArray(16 + index, (char)index));
+    }
+}
+
+void TestAsyncReader::test_async_read_large()
+{
+    // Around the sizes of the ring buffers: a full buffer is read again
+    // into a larger one, a shorter one is handed over as is
+    const int sizes[] = { 4095, 4096, 4097, 16384, 65537 };
+    QList<QEFIVariableKey> keys;
+    for (int size : sizes) {
+        const QString name = QStringLiteral("Large%1").arg(size);
+        writeVariable(name, QByteArray(size, (char)size));
+        keys.append(QEFIVariableKey(m_guid, name));
+    }
+
+    QEFIAsyncReader reader;
+#if defined(QEFI_USE_IO_URING)
+    QVERIFY(reader.isAsynchronous());
+#endif
+    QList<quint64> ids = reader.submit(keys);
+    QList<QEFIAsyncResult> results = collect(reader, keys.size());
+    QCOMPARE(results.size(), keys.size());
+    for (const QEFIAsyncResult &result : results) {
+        int index = ids.indexOf(result.id);
+        QVERIFY(index >= 0);
+        QCOMPARE(result.error, 0);
+        QCOMPARE(result.variable.attributes(), (quint32)0x07);
+        QCOMPARE(result.variable.data(), QByteArray(sizes[index], (char)sizes[index]));
+    }
+}
+
+void TestAsyncReader::test_async_read_queued()
+{
+    // More reads than slots in the ring
+    QEFIAsyncReader reader(4);
+    QList<QEFIVariableKey> keys;
+    for (int i = 0; i < 32; i++) {
+        keys.append(QEFIVariableKey(m_guid,
+            QStringLiteral("Boot%1").arg(i, 4, 16, QLatin1Char('0'))));
+    }
+    reader.submit(keys);
+
+    QList<QEFIAsyncResult> results = collect(reader, keys.size());
+    QCOMPARE(results.size(), keys.size());
+    for (const QEFIAsyncResult &result : results) {
+        QCOMPARE(result.error, 0);
+    }
+}
+
+QTEST_MAIN(TestAsyncReader)
+
+#include "test_async_reader.moc"
@@ -0,0 +1,382 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+
+#include <cerrno>
+#include <cstdint>
+
+#include "test_data.h"
+#include "../qefi.h"
+
+class TestBackend : public QObject
+{
+    Q_OBJECT
+private:
+    void exercise(QEFIBackend &backend);
+private slots:
+    void test_memory_backend();
+    void test_efivarfs_backend();
+    void test_app_data_backend();
+    void test_app_data_packed_backend();
+    void test_varstore_backend();
+    void test_varstore_image();
+    void test_varstore_fixture();
+    void test_varstore_reclaim();
+    void test_default_backend();
+    void test_ordered_async_writes();
+};
+
+void TestBackend::exercise(QEFIBackend &backend)
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QUuid vendor = QUuid::fromString(
+        QLatin1String("605dab50-e046-4300-abb6-3dd810dd8b23"));
+
+    QByteArray data;
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0001"), data), -ENOENT);
+
+    QCOMPARE(backend.setVariable(global, QStringLiteral("Boot0001"),
+        QByteArray(32, 'a'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(backend.setVariable(global, QStringLiteral("BootOrder"),
+        QByteArray("\x01\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(backend.setVariable(vendor, QStringLiteral("Boot0002"),
+        QByteArray(8, 'b'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+
+    quint32 attributes = 0;
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0001"), data, &attributes), 0);
+    QCOMPARE(data, QByteArray(32, 'a'));
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+
+    // A buffer too small still reports the full size
+    char buffer[4];
+    size_t size = 0;
+    QCOMPARE(backend.getVariableInto(global, QStringLiteral("Boot0001"),
+        buffer, sizeof(buffer), &size), 0);
+    QCOMPARE(size, (size_t)32);
+    QCOMPARE(QByteArray(buffer, sizeof(buffer)), QByteArray(4, 'a'));
+
+    quint64 dataSize = 0;
+    QCOMPARE(backend.variableSize(vendor, QStringLiteral("Boot0002"), &dataSize), 0);
+    QCOMPARE(dataSize, (quint64)8);
+
+    QList<QEFIVariableKey> variables;
+    QList<quint64> sizes;
+    QCOMPARE(backend.listVariables(variables, &sizes, &global, QStringLiteral("Boot")), 0);
+    QCOMPARE(variables.size(), 2);
+    QCOMPARE(sizes.size(), 2);
+    QVERIFY(variables.contains(QEFIVariableKey(global, QStringLiteral("Boot0001"))));
+    QVERIFY(variables.contains(QEFIVariableKey(global, QStringLiteral("BootOrder"))));
+
+    QCOMPARE(backend.deleteVariable(global, QStringLiteral("Boot0001")), 0);
+    QCOMPARE(backend.deleteVariable(global, QStringLiteral("Boot0001")), -ENOENT);
+}
+
+void TestBackend::test_memory_backend()
+{
+    QEFIMemoryBackend backend;
+    exercise(backend);
+}
+
+void TestBackend::test_efivarfs_backend()
+{
+#if defined(Q_OS_LINUX)
+    // The getdents64 listing on a plain directory standing for efivarfs
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QEFIEfivarfsBackend backend(dir.path() + QLatin1Char('/'));
+    exercise(backend);
+    QVERIFY(QFile::exists(dir.filePath(
+        QStringLiteral("BootOrder-8be4df61-93ca-11d2-aa0d-00e098032c8c"))));
+
+    // Reads past the stack buffer are sized by the variable, not the capacity
+    const QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    const QByteArray db(8192, 'd');
+    QCOMPARE(backend.setVariable(global, QStringLiteral("db"), db,
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QByteArray buffer(16384, '\0');
+    size_t size = 0;
+    QCOMPARE(backend.getVariableInto(global, QStringLiteral("db"),
+        buffer.data(), SIZE_MAX, &size), 0);
+    QCOMPARE(size, (size_t)db.size());
+    QCOMPARE(buffer.left(db.size()), db);
+    QCOMPARE(backend.getVariableInto(global, QStringLiteral("db"),
+        buffer.data(), 6000, &size), 0);
+    QCOMPARE(size, (size_t)db.size());
+    QCOMPARE(buffer.left(6000), db.left(6000));
+#else
+    QSKIP("efivarfs is only on Linux");
+#endif
+}
+
+void TestBackend::test_app_data_backend()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QEFIAppDataBackend backend(dir.path());
+    exercise(backend);
+}
+
+void TestBackend::test_app_data_packed_backend()
+{
+    QUuid vendor = QUuid::fromString(
+        QLatin1String("605dab50-e046-4300-abb6-3dd810dd8b23"));
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QEFIAppDataBackend backend(dir.path(), true);
+    QVERIFY(backend.isPacked());
+    exercise(backend);
+
+    // Enough variables to grow the store a few times
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < 4000; i++) {
+        QCOMPARE(backend.setVariable(vendor, QStringLiteral("Var%1").arg(i),
+            QByteArray(32, (char)i), QEFI_VARIABLE_NON_VOLATILE), 0);
+    }
+    qInfo("4000 packed writes: %lld ms", timer.elapsed());
+    QVERIFY(QFile::exists(dir.filePath(QStringLiteral("variables.fd"))));
+
+    // Read back by another instance, with the attributes
+    QEFIAppDataBackend reopened(dir.path(), true);
+    QList<QEFIVariableKey> variables;
+    QCOMPARE(reopened.listVariables(variables, nullptr, &vendor), 0);
+    QCOMPARE(variables.size(), 4000);
+    QByteArray data;
+    quint32 attributes = 0;
+    QCOMPARE(reopened.getVariable(vendor, QStringLiteral("Var1234"), data, &attributes), 0);
+    QCOMPARE(data, QByteArray(32, (char)1234));
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_NON_VOLATILE);
+}
+
+void TestBackend::test_varstore_backend()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("VARS.fd"));
+    QCOMPARE(QEFIVarStoreBackend::create(fileName), 0);
+
+    QEFIVarStoreBackend backend;
+    QCOMPARE(backend.open(fileName, true), 0);
+    QVERIFY(backend.isAuthenticated());
+    exercise(backend);
+}
+
+void TestBackend::test_varstore_image()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("VARS.fd"));
+    QCOMPARE(QEFIVarStoreBackend::create(fileName, 0x1000, false), 0);
+
+    QEFIVarStoreBackend backend;
+    QCOMPARE(backend.open(fileName), 0);
+    QVERIFY(!backend.isAuthenticated());
+    QCOMPARE(backend.usedSize(), (quint64)0);
+    QCOMPARE(backend.setVariable(global, QStringLiteral("BootNext"),
+        QByteArray("\x01\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), -EROFS);
+
+    QCOMPARE(backend.open(fileName, true), 0);
+    QCOMPARE(backend.setVariable(global, QStringLiteral("BootNext"),
+        QByteArray("\x01\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    // Header, "BootNext" with its terminator then the data, the next header
+    // aligned to 4
+    const quint64 recordSize = 32 + 18 + 2;
+    QCOMPARE(backend.usedSize(), recordSize);
+
+    // A replacement is appended, the old record stays as deleted
+    QCOMPARE(backend.setVariable(global, QStringLiteral("BootNext"),
+        QByteArray("\x02\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(backend.usedSize(), 2 * recordSize);
+    QCOMPARE(backend.setVariable(global, QStringLiteral("BootNext"),
+        QByteArray("\x03\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES |
+        QEFI_VARIABLE_APPEND_WRITE), 0);
+
+    int size = 0;
+    const char *value = backend.constData(global, QStringLiteral("BootNext"), &size);
+    QVERIFY(value);
+    QCOMPARE(QByteArray(value, size), QByteArray("\x02\x00\x03\x00", 4));
+
+    QCOMPARE(backend.setVariable(global, QStringLiteral("Large"),
+        QByteArray((int)backend.freeSize(), 'a'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), -ENOSPC);
+
+    // The image is parsed again from the file
+    backend.close();
+    QCOMPARE(backend.open(fileName), 0);
+    QByteArray data;
+    QCOMPARE(backend.getVariable(global, QStringLiteral("BootNext"), data), 0);
+    QCOMPARE(data, QByteArray("\x02\x00\x03\x00", 4));
+    QList<QEFIVariableKey> variables;
+    QCOMPARE(backend.listVariables(variables), 0);
+    QCOMPARE(variables.size(), 1);
+
+    QFile garbage(dir.filePath(QStringLiteral("garbage.fd")));
+    QVERIFY(garbage.open(QIODevice::WriteOnly));
+    garbage.write(QByteArray(0x1000, '\0'));
+    garbage.close();
+    QCOMPARE(backend.open(garbage.fileName()), -EINVAL);
+    QVERIFY(!backend.isOpen());
+}
+
+void TestBackend::test_varstore_fixture()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QFile file(dir.filePath(QStringLiteral("OVMF_VARS.fd")));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write((const char *)test_varstore_data, TEST_VARSTORE_DATA_LENGTH);
+    file.write(QByteArray(TEST_VARSTORE_VOLUME_SIZE - TEST_VARSTORE_DATA_LENGTH, (char)0xff));
+    file.close();
+
+    QEFIVarStoreBackend backend;
+    QCOMPARE(backend.open(file.fileName(), true), 0);
+    QVERIFY(backend.isAuthenticated());
+    QCOMPARE(backend.endOffset(), (quint64)TEST_VARSTORE_DATA_LENGTH);
+
+    // "Boot0001" has a name of 18 bytes, its data is not shifted
+    QByteArray data;
+    quint32 attributes = 0;
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0001"), data, &attributes), 0);
+    QCOMPARE(data, QByteArray("\x01\x02\x03\x04\x05\x06\x07", 7));
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(data, QByteArray("\x05\x00", 2));
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Lang"), data), 0);
+    QCOMPARE(data, QByteArray("eng\0", 4));
+    QList<QEFIVariableKey> variables;
+    QCOMPARE(backend.listVariables(variables), 0);
+    QCOMPARE(variables.size(), 3);
+
+    // Records are written the way the firmware writes them
+    const QByteArray boot0001((const char *)test_varstore_data + TEST_VARSTORE_BOOT0001_OFFSET,
+        TEST_VARSTORE_BOOT0001_LENGTH);
+    QCOMPARE(QEFIVarStoreBackend::encodeVariable(global, QStringLiteral("Boot0001"),
+        QByteArray("\x01\x02\x03\x04\x05\x06\x07", 7),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES), boot0001);
+
+    QCOMPARE(backend.setVariable(global, QStringLiteral("Boot0002"),
+        QByteArray(7, 'b'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(backend.endOffset(), (quint64)TEST_VARSTORE_DATA_LENGTH + 60 + 18 + 7 + 3);
+    backend.close();
+
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray image = file.readAll();
+    const int name = TEST_VARSTORE_DATA_LENGTH + 60;
+    QCOMPARE(image.mid(name, 18), QByteArray((const char *)u"Boot0002", 18));
+    QCOMPARE(image.mid(name + 18, 7), QByteArray(7, 'b'));
+    QCOMPARE(image.mid(name + 18 + 7, 3), QByteArray(3, (char)0xff));
+}
+
+void TestBackend::test_varstore_reclaim()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QStringList fileNames;
+    for (int i = 0; i < 4; i++) {
+        const QString fileName = dir.filePath(QStringLiteral("VARS%1.fd").arg(i));
+        QCOMPARE(QEFIVarStoreBackend::create(fileName, 0x1000), 0);
+
+        QEFIVarStoreBackend backend;
+        QCOMPARE(backend.open(fileName, true), 0);
+        QCOMPARE(backend.setVariable(global, QStringLiteral("Boot0001"),
+            QByteArray(30, 'a'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+        QCOMPARE(backend.setVariable(global, QStringLiteral("Boot0002"),
+            QByteArray(3, 'b'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+        QCOMPARE(backend.setVariable(global, QStringLiteral("Boot0001"),
+            QByteArray(31, 'c'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+        QCOMPARE(backend.setVariable(global, QStringLiteral("Boot0003"),
+            QByteArray(5, 'd'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+        QCOMPARE(backend.deleteVariable(global, QStringLiteral("Boot0003")), 0);
+        fileNames.append(fileName);
+    }
+
+    // The first Boot0001 and Boot0003, each a 60 byte header, 18 bytes of
+    // name and their data, padded up to the next header
+    const quint64 expected = (60 + 18 + 30) + (60 + 18 + 5 + 1);
+
+    QEFIVarStoreBackend backend;
+    QCOMPARE(backend.open(fileNames.first(), true), 0);
+    const quint64 used = backend.usedSize();
+    quint64 reclaimed = 0;
+    QCOMPARE(backend.reclaim(&reclaimed), 0);
+    QCOMPARE(reclaimed, expected);
+    QCOMPARE(backend.usedSize(), used - expected);
+    QByteArray data;
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0001"), data), 0);
+    QCOMPARE(data, QByteArray(31, 'c'));
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0002"), data), 0);
+    QCOMPARE(data, QByteArray(3, 'b'));
+    backend.close();
+
+    QList<quint64> sizes;
+    QCOMPARE(qefi_varstore_reclaim(fileNames, &sizes), QList<int>({ 0, 0, 0, 0 }));
+    QCOMPARE(sizes, QList<quint64>({ 0, expected, expected, expected }));
+
+    // Compacted records parse back the same
+    QCOMPARE(backend.open(fileNames.last()), 0);
+    QCOMPARE(backend.usedSize(), used - expected);
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0001"), data), 0);
+    QCOMPARE(data, QByteArray(31, 'c'));
+    QCOMPARE(backend.getVariable(global, QStringLiteral("Boot0003"), data), -ENOENT);
+}
+
+void TestBackend::test_default_backend()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QEFIMemoryBackend backend;
+
+    qefi_set_default_backend(&backend);
+    QCOMPARE(qefi_default_backend(), (QEFIBackend *)&backend);
+    qefi_set_variable_uint16(global, QStringLiteral("BootNext"), 3);
+    QCOMPARE(qefi_get_variable_uint16(global, QStringLiteral("BootNext")), (quint16)3);
+    QCOMPARE(qefi_list_variables(global).size(), 1);
+
+    QByteArray data;
+    QCOMPARE(backend.getVariable(global, QStringLiteral("BootNext"), data), 0);
+    QCOMPARE(data, QByteArray("\x03\x00", 2));
+
+    qefi_set_default_backend(nullptr);
+    QCOMPARE(qefi_default_backend(), qefi_system_backend());
+}
+
+void TestBackend::test_ordered_async_writes()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QEFIMemoryBackend backend;
+    backend.setVariable(global, QStringLiteral("BootCurrent"), QByteArray("\x01\x00", 2),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    backend.setLatency(BACKEND_Set, 5000);
+    qefi_set_default_backend(&backend);
+
+    QList<QFuture<int> > writes;
+    for (quint16 i = 0; i < 32; i++) {
+        writes.append(qefi_set_variable_uint16_async(global,
+            QStringLiteral("Timeout"), i));
+    }
+
+    // The burst holds one pool thread, the read does not wait behind it
+    QCOMPARE(qefi_get_variable_uint16_async(global,
+        QStringLiteral("BootCurrent")).result(), (quint16)1);
+    QVERIFY(!writes.last().isFinished());
+
+    for (QFuture<int> &write : writes) {
+        QCOMPARE(write.result(), 0);
+    }
+    QCOMPARE(qefi_get_variable_uint16(global, QStringLiteral("Timeout")), (quint16)31);
+
+    qefi_set_default_backend(nullptr);
+}
+
+QTEST_MAIN(TestBackend)
+
+#include "test_backend.moc"
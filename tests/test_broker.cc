@@ -0,0 +1,278 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+#include "../qefi.h"
+
+// Refuses writes to "Protected" and reads of "Secret"
+class TestBrokerServer : public QEFIBrokerServer
+{
+public:
+    TestBrokerServer(QEFIBackend *backend) : QEFIBrokerServer(backend) {}
+    QEFIBrokerPeer lastPeer;
+protected:
+    bool allowRead(const QEFIBrokerPeer &peer, const QUuid &uuid,
+        const QString &name) override
+    {
+        Q_UNUSED(uuid)
+        lastPeer = peer;
+        return name != QLatin1String("Secret");
+    }
+
+    bool allowWrite(const QEFIBrokerPeer &peer, const QUuid &uuid,
+        const QString &name) override
+    {
+        return name != QLatin1String("Protected") &&
+            QEFIBrokerServer::allowWrite(peer, uuid, name);
+    }
+};
+
+// Failed checks return early, the thread still has to finish
+struct TestThreadDeleter
+{
+    static void cleanup(QThread *thread)
+    {
+        if (thread) thread->wait();
+        delete thread;
+    }
+};
+
+class TestBroker : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QUuid m_guid;
+    QEFIMemoryBackend m_variables;
+    QScopedPointer<TestBrokerServer> m_server;
+    QString m_path;
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void test_read_write();
+    void test_policy();
+    void test_warm_cache();
+    void test_cache_ttl();
+    void test_default_backend();
+    void test_restart();
+    void test_write_not_resent();
+};
+
+void TestBroker::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_guid = QUuid::fromString(QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    m_path = m_dir.filePath(QStringLiteral("broker.sock"));
+    m_server.reset(new TestBrokerServer(&m_variables));
+    QCOMPARE(m_server->listen(m_path), 0);
+    QVERIFY(m_server->isListening());
+    QCOMPARE(m_server->listen(m_path), -EBUSY);
+
+    QCOMPARE(m_variables.setVariable(m_guid, QStringLiteral("Protected"),
+        QByteArray("p"), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(m_variables.setVariable(m_guid, QStringLiteral("Secret"),
+        QByteArray("s"), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+}
+
+void TestBroker::cleanupTestCase()
+{
+    m_server.reset();
+    QVERIFY(!QFile::exists(m_path));
+}
+
+void TestBroker::test_read_write()
+{
+    QEFIBrokerBackend client(m_path);
+    QVERIFY(client.isAvailable());
+    QVERIFY(client.hasPrivilege());
+
+    QCOMPARE(client.setVariable(m_guid, QStringLiteral("Boot0001"),
+        QByteArray(40, 'a'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(client.setVariable(m_guid, QStringLiteral("Boot0002"),
+        QByteArray(8, 'b'), QEFI_VARIABLE_NON_VOLATILE), 0);
+
+    QByteArray data;
+    quint32 attributes = 0;
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Boot0002"), data, &attributes), 0);
+    QCOMPARE(data, QByteArray(8, 'b'));
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_NON_VOLATILE);
+
+    QList<QEFIVariable> variables;
+    QList<int> errors;
+    QCOMPARE(client.getVariables({ QEFIVariableKey(m_guid, QStringLiteral("Boot0001")),
+        QEFIVariableKey(m_guid, QStringLiteral("Boot0003")) }, variables, &errors), 0);
+    QCOMPARE(errors, QList<int>({ 0, -ENOENT }));
+    QCOMPARE(variables[0].data(), QByteArray(40, 'a'));
+    QVERIFY(variables[1].isNull());
+
+    QList<QEFIVariableKey> keys;
+    QList<quint64> sizes;
+    QCOMPARE(client.listVariables(keys, &sizes, &m_guid, QStringLiteral("Boot")), 0);
+    QCOMPARE(keys.size(), 2);
+    QCOMPARE(sizes.size(), 2);
+
+    QCOMPARE(client.deleteVariable(m_guid, QStringLiteral("Boot0001")), 0);
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Boot0001"), data), -ENOENT);
+    QCOMPARE(client.deleteVariable(m_guid, QStringLiteral("Boot0002")), 0);
+}
+
+void TestBroker::test_policy()
+{
+    QEFIBrokerBackend client(m_path);
+    QByteArray data;
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Protected"), data), 0);
+    QCOMPARE(client.setVariable(m_guid, QStringLiteral("Protected"),
+        QByteArray("x"), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), -EPERM);
+    QCOMPARE(client.deleteVariable(m_guid, QStringLiteral("Protected")), -EPERM);
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Secret"), data), -EACCES);
+
+    // Hidden from enumerations too
+    QList<QEFIVariableKey> keys;
+    QCOMPARE(client.listVariables(keys), 0);
+    QVERIFY(keys.contains(QEFIVariableKey(m_guid, QStringLiteral("Protected"))));
+    QVERIFY(!keys.contains(QEFIVariableKey(m_guid, QStringLiteral("Secret"))));
+
+    // The credentials come from the socket
+    QCOMPARE(m_server->lastPeer.uid, (quint32)geteuid());
+}
+
+void TestBroker::test_warm_cache()
+{
+    QEFIBrokerBackend first(m_path);
+    QEFIBrokerBackend second(m_path);
+    QCOMPARE(first.setVariable(m_guid, QStringLiteral("Timeout"),
+        QByteArray("\x05\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+
+    m_variables.resetOperationCounts();
+    QByteArray data;
+    QCOMPARE(first.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    const quint64 hits = m_server->cacheHitCount();
+    QCOMPARE(second.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(m_server->cacheHitCount(), hits + 1);
+    QCOMPARE(m_variables.operationCount(BACKEND_Get), (quint64)1);
+
+    // A write through the broker is seen by the other clients
+    QCOMPARE(first.setVariable(m_guid, QStringLiteral("Timeout"),
+        QByteArray("\x07\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(second.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(data, QByteArray("\x07\x00", 2));
+
+    // Others are only seen once the cache is dropped
+    QCOMPARE(m_variables.setVariable(m_guid, QStringLiteral("Timeout"),
+        QByteArray("\x09\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    m_server->clearCache();
+    QCOMPARE(second.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(data, QByteArray("\x09\x00", 2));
+}
+
+void TestBroker::test_cache_ttl()
+{
+    QEFIBrokerBackend client(m_path);
+    QCOMPARE(m_server->cacheTtl(), 1000);
+    QCOMPARE(client.setVariable(m_guid, QStringLiteral("Timeout"),
+        QByteArray("\x05\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+
+    // Writes behind the broker show up once the cached value expires
+    m_server->setCacheTtl(50);
+    QByteArray data;
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(m_variables.setVariable(m_guid, QStringLiteral("Timeout"),
+        QByteArray("\x06\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QTest::qSleep(100);
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(data, QByteArray("\x06\x00", 2));
+
+    // Every read goes to the backend without the cache
+    m_server->setCacheTtl(0);
+    m_variables.resetOperationCounts();
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(m_variables.operationCount(BACKEND_Get), (quint64)2);
+
+    m_server->setCacheTtl(1000);
+}
+
+void TestBroker::test_default_backend()
+{
+    QEFIBrokerBackend client(m_path);
+    qefi_set_default_backend(&client);
+    qefi_set_variable_uint16(m_guid, QStringLiteral("BootNext"), 4);
+    QCOMPARE(qefi_get_variable_uint16(m_guid, QStringLiteral("BootNext")), (quint16)4);
+    qefi_set_default_backend(nullptr);
+
+    QByteArray data;
+    QCOMPARE(m_variables.getVariable(m_guid, QStringLiteral("BootNext"), data), 0);
+}
+
+void TestBroker::test_restart()
+{
+    QEFIBrokerBackend client(m_path);
+    QByteArray data;
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Protected"), data), 0);
+
+    m_server->close();
+    QVERIFY(!m_server->isListening());
+    // The socket is gone with the broker
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Protected"), data), -ENOENT);
+
+    // The client connects again on its own
+    QCOMPARE(m_server->listen(m_path), 0);
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("Protected"), data), 0);
+}
+
+void TestBroker::test_write_not_resent()
+{
+    // A broker reading one request per connection and never answering
+    const QByteArray path = QFile::encodeName(m_dir.filePath(QStringLiteral("mute.sock")));
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    QVERIFY(path.size() < (int)sizeof(address.sun_path));
+    memcpy(address.sun_path, path.constData(), path.size());
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    QVERIFY(listenFd >= 0);
+    QCOMPARE(::bind(listenFd, (struct sockaddr *)&address, sizeof(address)), 0);
+    QCOMPARE(::listen(listenFd, 4), 0);
+
+    QAtomicInt received(0);
+    QScopedPointer<QThread, TestThreadDeleter> broker(QThread::create([&]() {
+        struct pollfd pfd = { listenFd, POLLIN, 0 };
+        while (poll(&pfd, 1, 500) > 0) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) break;
+            char buffer[4096];
+            if (recv(fd, buffer, sizeof(buffer), 0) > 0) received.fetchAndAddRelaxed(1);
+            ::close(fd);
+        }
+    }));
+    broker->start();
+
+    QEFIBrokerBackend client(QFile::decodeName(path));
+    QCOMPARE(client.setVariable(m_guid, QStringLiteral("BootNext"),
+        QByteArray("\x01\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), -ECONNRESET);
+    QCOMPARE(received.loadAcquire(), 1);
+    QCOMPARE(client.deleteVariable(m_guid, QStringLiteral("BootNext")), -ECONNRESET);
+    QCOMPARE(received.loadAcquire(), 2);
+
+    // Reads get their second try
+    QByteArray data;
+    QCOMPARE(client.getVariable(m_guid, QStringLiteral("BootNext"), data), -ECONNRESET);
+    QCOMPARE(received.loadAcquire(), 4);
+
+    broker->wait();
+    ::close(listenFd);
+    unlink(path.constData());
+}
+
+QTEST_MAIN(TestBroker)
+
+#include "test_broker.moc"
@@ -105,3 +105,74 @@ const unsigned char test_boot_data2[TEST_BOOT_DATA2_LENGTH] = {
 
 const char* test_boot_name2 = "Windows Boot Manager";
 const char* test_boot_path2 = "\\EFI\\Microsoft\\Boot\\bootmgfw.efi";
+
+/*
+ * Start of an x86 OVMF_VARS.fd: the data of a record follows its name
+ * without padding, only the next header is aligned to 4 bytes. The rest
+ * of the volume is erased (0xff).
+ */
+#define TEST_VARSTORE_VOLUME_SIZE 0x2000
+#define TEST_VARSTORE_DATA_LENGTH 424
+#define TEST_VARSTORE_BOOT0001_OFFSET 100
+#define TEST_VARSTORE_BOOT0001_LENGTH 88
+const unsigned char test_varstore_data[TEST_VARSTORE_DATA_LENGTH] = {
+    // EFI_FIRMWARE_VOLUME_HEADER of 0x2000 bytes
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x8d, 0x2b, 0xf1, 0xff, 0x96, 0x76, 0x8b, 0x4c,
+    0xa9, 0x85, 0x27, 0x47, 0x07, 0x5b, 0x4f, 0x50, 0x00, 0x20, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x5f, 0x46, 0x56, 0x48, 0xff, 0xfe, 0x04, 0x00,
+    0x48, 0x00, 0x39, 0xd9, 0x00, 0x00, 0x00, 0x02, 0x02, 0x00, 0x00, 0x00,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+
+    // Authenticated VARIABLE_STORE_HEADER
+    0x78, 0x2c, 0xf3, 0xaa, 0x7b, 0x94, 0x9a, 0x43, 0xa1, 0x80, 0x2e, 0x14,
+    0x4e, 0xc3, 0x77, 0x92, 0xb8, 0x1f, 0x00, 0x00, 0x5a, 0xfe, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+
+    // "Boot0001": header, 18 bytes of name, 7 of data
+    0xaa, 0x55, 0x3f, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x12, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x61, 0xdf, 0xe4, 0x8b,
+    0xca, 0x93, 0xd2, 0x11, 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2c, 0x8c,
+    0x42, 0x00, 0x6f, 0x00, 0x6f, 0x00, 0x74, 0x00, 0x30, 0x00, 0x30, 0x00,
+    0x30, 0x00, 0x31, 0x00, 0x00, 0x00,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    // Padding up to the next header only
+    0xff, 0xff, 0xff,
+
+    // "Timeout" replaced, so deleted
+    0xaa, 0x55, 0x3c, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x61, 0xdf, 0xe4, 0x8b,
+    0xca, 0x93, 0xd2, 0x11, 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2c, 0x8c,
+    0x54, 0x00, 0x69, 0x00, 0x6d, 0x00, 0x65, 0x00, 0x6f, 0x00, 0x75, 0x00,
+    0x74, 0x00, 0x00, 0x00,
+    0x01, 0x00,
+    // Padding up to the next header only
+    0xff, 0xff,
+
+    // "Timeout": 16 bytes of name
+    0xaa, 0x55, 0x3f, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x61, 0xdf, 0xe4, 0x8b,
+    0xca, 0x93, 0xd2, 0x11, 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2c, 0x8c,
+    0x54, 0x00, 0x69, 0x00, 0x6d, 0x00, 0x65, 0x00, 0x6f, 0x00, 0x75, 0x00,
+    0x74, 0x00, 0x00, 0x00,
+    0x05, 0x00,
+    // Padding up to the next header only
+    0xff, 0xff,
+
+    // "Lang": 10 bytes of name
+    0xaa, 0x55, 0x3f, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x0a, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x61, 0xdf, 0xe4, 0x8b,
+    0xca, 0x93, 0xd2, 0x11, 0xaa, 0x0d, 0x00, 0xe0, 0x98, 0x03, 0x2c, 0x8c,
+    0x4c, 0x00, 0x61, 0x00, 0x6e, 0x00, 0x67, 0x00, 0x00, 0x00,
+    0x65, 0x6e, 0x67, 0x00,
+    // Padding up to the next header only
+    0xff, 0xff,
+};
@@ -2,6 +2,9 @@
 #include <QtTest/QtTest>
 #include <QDebug>
 #include <QDir>
+#include <QStandardPaths>
+
+#include <cerrno>
 
 #include "test_data.h"
 #include "../qefi.h"
@@ -13,6 +16,15 @@ private slots:
     void initTestCase();
     void test_qefi_data_read_write();
     void test_qefi_uint16_read_write();
+    void test_qefi_list_variables();
+    void test_qefi_variable_read_write();
+    void test_qefi_read_variables();
+    void test_qefi_async_read_write();
+    void test_qefi_write_batch();
+    void test_qefi_write_batch_rollback();
+    void test_qefi_append_variable();
+    void test_qefi_write_variable_if_changed();
+    void test_qefi_store_usage();
     void cleanupTestCase();
 };
 
@@ -57,6 +69,272 @@ void TestDummyBackend::test_qefi_uint16_read_write()
     QVERIFY(res == 0xFFEE);
 }
 
+void TestDummyBackend::test_qefi_list_variables()
+{
+    QUuid uuid = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    qefi_set_variable_uint16(uuid, QStringLiteral("Boot0001"), 0x0001);
+    qefi_set_variable_uint16(uuid, QStringLiteral("Boot0002"), 0x0002);
+    qefi_set_variable_uint16(uuid, QStringLiteral("Timeout"), 5);
+
+    QList<QEFIVariableKey> boots = qefi_list_variables(uuid, QStringLiteral("Boot"));
+    QCOMPARE(boots.size(), 2);
+    QVERIFY(boots.contains(QEFIVariableKey(uuid, QStringLiteral("Boot0001"))));
+    QVERIFY(boots.contains(QEFIVariableKey(uuid, QStringLiteral("Boot0002"))));
+
+    QList<QEFIVariableKey> all = qefi_list_variables(uuid);
+    QCOMPARE(all.size(), 3);
+
+    // Variables written by the other tests use the null GUID
+    QList<QEFIVariableKey> others = qefi_list_variables(QStringLiteral("BootOrder"));
+    QCOMPARE(others.size(), 1);
+    QCOMPARE(others[0].first, QUuid());
+}
+
+void TestDummyBackend::test_qefi_variable_read_write()
+{
+    QByteArray data("\x03\x00", 2);
+    QEFIVariable variable(QUuid(), QStringLiteral("BootNext"), data);
+    QCOMPARE(qefi_write_variable(variable), 0);
+
+    QEFIVariable res = qefi_read_variable(QUuid(), QStringLiteral("BootNext"));
+    QVERIFY(!res.isNull());
+    QCOMPARE(res.data(), data);
+    QCOMPARE(res.attributes(), (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+
+    // Copies share the data until one of them is modified
+    QEFIVariable copy(res);
+    copy.setData(QByteArray("\x04\x00", 2));
+    QCOMPARE(res.data(), data);
+
+    QVERIFY(qefi_read_variable(QUuid(), QStringLiteral("Missing")).isNull());
+    QVERIFY(qefi_write_variable(QEFIVariable()) < 0);
+}
+
+void TestDummyBackend::test_qefi_read_variables()
+{
+    QUuid uuid = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QList<QEFIVariableKey> keys;
+    for (int i = 0; i < 16; i++) {
+        QString name = QStringLiteral("Boot%1").arg(i, 4, 16, QLatin1Char('0'));
+        qefi_set_variable_uint16(uuid, name, i);
+        keys.append(QEFIVariableKey(uuid, name));
+    }
+    keys.append(QEFIVariableKey(uuid, QStringLiteral("Missing")));
+
+    QList<int> errors;
+    QList<QEFIVariable> variables = qefi_read_variables(keys, &errors, 4);
+    QCOMPARE(variables.size(), keys.size());
+    QCOMPARE(errors.size(), keys.size());
+    for (int i = 0; i < 16; i++) {
+        QCOMPARE(errors[i], 0);
+        QCOMPARE(variables[i].name(), keys[i].second);
+        QCOMPARE(variables[i].data(), QByteArray(1, (char)i) + QByteArray(1, 0));
+    }
+    QVERIFY(errors[16] < 0);
+    QVERIFY(variables[16].isNull());
+}
+
+void TestDummyBackend::test_qefi_async_read_write()
+{
+    QList<QFuture<int> > writes;
+    for (quint16 i = 0; i < 64; i++) {
+        writes.append(qefi_set_variable_uint16_async(QUuid(),
+            QStringLiteral("Timeout"), i));
+    }
+    for (QFuture<int> &write : writes) {
+        QCOMPARE(write.result(), 0);
+    }
+
+    // The writes landed in the order they were issued
+    QFuture<quint16> value = qefi_get_variable_uint16_async(QUuid(),
+        QStringLiteral("Timeout"));
+    QCOMPARE(value.result(), (quint16)63);
+
+    QByteArray data("\x01\x00\x02\x00", 4);
+    QCOMPARE(qefi_set_variable_async(QUuid(), QStringLiteral("BootOrder"),
+        data).result(), 0);
+    QCOMPARE(qefi_get_variable_async(QUuid(), QStringLiteral("BootOrder")).result(),
+        data);
+}
+
+void TestDummyBackend::test_qefi_write_batch()
+{
+    QUuid uuid = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QByteArray entry(32, (char)0x42);
+    QByteArray order("\x20\x00\x01\x00", 4);
+
+    QEFIWriteBatch batch;
+    batch.setVariable(uuid, QStringLiteral("BootOrder"), order);
+    batch.setVariable(uuid, QStringLiteral("Boot0020"), entry);
+    batch.setVariableUint16(uuid, QStringLiteral("BootNext"), 0x20);
+    QCOMPARE(batch.size(), 3);
+    QCOMPARE(batch.commit(), 0);
+    QCOMPARE(batch.writtenCount(), 3);
+    QCOMPARE(qefi_get_variable(uuid, QStringLiteral("Boot0020")), entry);
+    QCOMPARE(qefi_get_variable(uuid, QStringLiteral("BootOrder")), order);
+
+    // Nothing changed, nothing is written again
+    QCOMPARE(batch.commit(), 0);
+    QCOMPARE(batch.writtenCount(), 0);
+    QCOMPARE(batch.skippedCount(), 3);
+
+    batch.clear();
+    batch.removeVariable(uuid, QStringLiteral("Boot0020"));
+    batch.setVariable(uuid, QStringLiteral("BootOrder"), QByteArray("\x01\x00", 2));
+    QCOMPARE(batch.commit(), 0);
+    QVERIFY(qefi_read_variable(uuid, QStringLiteral("Boot0020")).isNull());
+}
+
+void TestDummyBackend::test_qefi_write_batch_rollback()
+{
+    QUuid uuid = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QByteArray order("\x01\x00", 2);
+    qefi_set_variable(uuid, QStringLiteral("BootOrder"), order);
+
+    QEFIWriteBatch batch;
+    batch.setVariable(uuid, QStringLiteral("Boot0030"), QByteArray(8, 'a'));
+    batch.setVariable(uuid, QStringLiteral("BootOrder"), QByteArray("\x30\x00", 2));
+    // The dummy backend cannot store a name with a path separator
+    batch.setVariable(uuid, QStringLiteral("Boot/0031"), QByteArray(8, 'b'));
+    QVERIFY(batch.commit() < 0);
+    QCOMPARE(batch.writtenCount(), 0);
+
+    // Everything is back as it was
+    QVERIFY(qefi_read_variable(uuid, QStringLiteral("Boot0030")).isNull());
+    QCOMPARE(qefi_get_variable(uuid, QStringLiteral("BootOrder")), order);
+}
+
+// EFI_CERT_SHA256_GUID list with one SHA-256 entry per byte in hashes
+static QByteArray sha256_signature_list(const QByteArray &hashes)
+{
+    const QByteArray type = QUuid::fromString(
+        QLatin1String("c1c41626-504c-4092-aca9-41f936934328")).toRfc4122();
+    const QByteArray owner(16, (char)0x77);
+    const quint32 signatureSize = 16 + 32;
+
+    QByteArray list = qefi_rfc4122_to_guid(type);
+    QByteArray sizes(12, (char)0);
+    qToLittleEndian<quint32>(28 + hashes.size() * signatureSize, sizes.data());
+    qToLittleEndian<quint32>(signatureSize, sizes.data() + 8);
+    list.append(sizes);
+    for (char hash : hashes) {
+        list.append(owner);
+        list.append(QByteArray(32, hash));
+    }
+    return list;
+}
+
+void TestDummyBackend::test_qefi_append_variable()
+{
+    QUuid uuid = QUuid::fromString(
+        QLatin1String("d719b2cb-3d3a-4596-a3bc-dad00e67656f"));
+    const QString name = QStringLiteral("dbxTest");
+    qefi_delete_variable(uuid, name);
+
+    QCOMPARE(qefi_append_variable(uuid, name, sha256_signature_list("ab")), 0);
+    QCOMPARE(qefi_get_variable(uuid, name), sha256_signature_list("ab"));
+
+    // Only the entries not stored yet are sent
+    QCOMPARE(qefi_append_variable(uuid, name, sha256_signature_list("bcc")), 0);
+    QCOMPARE(qefi_get_variable(uuid, name),
+        sha256_signature_list("ab") + sha256_signature_list("c"));
+
+    // Nothing new, nothing written
+    QCOMPARE(qefi_append_variable(uuid, name, sha256_signature_list("ca")), 0);
+    QCOMPARE(qefi_get_variable(uuid, name),
+        sha256_signature_list("ab") + sha256_signature_list("c"));
+
+    // Truncated list
+    QCOMPARE(qefi_append_variable(uuid, name, sha256_signature_list("d").left(40)),
+        -EINVAL);
+}
+
+void TestDummyBackend::test_qefi_write_variable_if_changed()
+{
+    QUuid uuid = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    const QString name = QStringLiteral("Boot0040");
+    qefi_delete_variable(uuid, name);
+    qefi_reset_write_counters();
+
+    QEFIVariable variable(uuid, name, QByteArray(16, 'a'));
+    QCOMPARE(qefi_write_variable_if_changed(variable), 0);
+    QCOMPARE(qefi_write_variable_if_changed(variable), 0);
+    QCOMPARE(qefi_write_counters().performed, (quint64)1);
+    QCOMPARE(qefi_write_counters().skipped, (quint64)1);
+
+    // A write through another call drops the cached value
+    qefi_set_variable(uuid, name, QByteArray(16, 'b'));
+    QCOMPARE(qefi_write_variable_if_changed(variable), 0);
+    QCOMPARE(qefi_get_variable(uuid, name), QByteArray(16, 'a'));
+    QCOMPARE(qefi_write_counters().performed, (quint64)2);
+
+    // Not seen by the cache until cleared
+    QVERIFY(QFile::remove(QDir(QStandardPaths::writableLocation(
+        QStandardPaths::AppDataLocation)).absoluteFilePath(
+        QStringLiteral("8be4df61-93ca-11d2-aa0d-00e098032c8cBoot0040.bin"))));
+    QCOMPARE(qefi_write_variable_if_changed(variable), 0);
+    QCOMPARE(qefi_write_counters().skipped, (quint64)2);
+    qefi_clear_write_cache();
+    QCOMPARE(qefi_write_variable_if_changed(variable), 0);
+    QCOMPARE(qefi_write_counters().performed, (quint64)3);
+    QCOMPARE(qefi_get_variable(uuid, name), QByteArray(16, 'a'));
+}
+
+void TestDummyBackend::test_qefi_store_usage()
+{
+    // Header, "Boot0001" with its terminator and the data, padded to 4 bytes
+    QCOMPARE(qefi_variable_storage_size(QStringLiteral("Boot0001"), 0), (quint64)60 + 18 + 2);
+    QCOMPARE(qefi_variable_storage_size(QStringLiteral("Boot0001"), 5), (quint64)60 + 18 + 5 + 1);
+    // Like the records of the edk2 fixture
+    QCOMPARE(qefi_variable_storage_size(QStringLiteral("Boot0001"), 7), (quint64)60 + 18 + 7 + 3);
+
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QUuid security = QUuid::fromString(
+        QLatin1String("d719b2cb-3d3a-4596-a3bc-dad00e67656f"));
+    QList<QEFIVariableUsage> variables;
+    variables.append(QEFIVariableUsage(global, QStringLiteral("Boot0001"), 100));
+    variables.append(QEFIVariableUsage(global, QStringLiteral("BootOrder"), 2));
+    variables.append(QEFIVariableUsage(security, QStringLiteral("dbx"), 4000));
+
+    QEFIStoreUsage usage(5000);
+    usage.setVariables(variables);
+    const quint64 used = (60 + 18 + 100 + 2) + (60 + 20 + 2 + 2) + (60 + 8 + 4000);
+    QCOMPARE(usage.usedSize(), used);
+    QCOMPARE(usage.freeSize(), 5000 - used);
+    QCOMPARE(usage.usageByGuid().value(security), (quint64)(60 + 8 + 4000));
+    QCOMPARE(usage.largestVariables(1).size(), 1);
+    QCOMPARE(usage.largestVariables(1).first().name(), QStringLiteral("dbx"));
+
+    // Replacing a variable only counts the difference
+    QList<QEFIVariable> writes;
+    writes.append(QEFIVariable(global, QStringLiteral("Boot0001"), QByteArray(200, 'a')));
+    QCOMPARE(usage.plannedSize(writes), used + 100);
+    QVERIFY(usage.fits(writes));
+
+    writes.append(QEFIVariable(security, QStringLiteral("dbx"), QByteArray(800, 'a'),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES | QEFI_VARIABLE_APPEND_WRITE));
+    QCOMPARE(usage.plannedSize(writes), used + 100 + 800);
+    QVERIFY(!usage.fits(writes));
+
+    // One enumeration pass over the backend
+    qefi_set_variable(global, QStringLiteral("Boot0050"), QByteArray(10, 'a'));
+    QVERIFY(usage.scan() == 0);
+    bool found = false;
+    for (const QEFIVariableUsage &variable : usage.variables()) {
+        if (variable.guid() == global && variable.name() == QStringLiteral("Boot0050")) {
+            QCOMPARE(variable.dataSize(), (quint64)10);
+            found = true;
+        }
+    }
+    QVERIFY(found);
+}
+
 QTEST_MAIN(TestDummyBackend)
 
 #include "test_dummy_backend.moc"
@@ -0,0 +1,115 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QFile>
+
+#include <cerrno>
+
+#include "../qefi.h"
+
+#define TEST_GUID "8be4df61-93ca-11d2-aa0d-00e098032c8c"
+
+class TestEfivarfsWrite : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QUuid m_guid;
+
+    QString path(const QString &name) const;
+    QByteArray content(const QString &name) const;
+private slots:
+    void initTestCase();
+    void test_write_new();
+    void test_overwrite_in_place();
+    void test_overwrite_shrink();
+    void test_write_large();
+    void test_append_new();
+    void test_write_error();
+};
+
+QString TestEfivarfsWrite::path(const QString &name) const
+{
+    return m_dir.path() + QLatin1Char('/') + name + QStringLiteral("-" TEST_GUID);
+}
+
+QByteArray TestEfivarfsWrite::content(const QString &name) const
+{
+    QFile file(path(name));
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+    return file.readAll();
+}
+
+void TestEfivarfsWrite::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_guid = QUuid::fromString(QLatin1String(TEST_GUID));
+    // Must be set before the first call into the library
+    qputenv("EFIVARFS_PATH", QFile::encodeName(m_dir.path() + QLatin1Char('/')));
+}
+
+void TestEfivarfsWrite::test_write_new()
+{
+    const QString name = QStringLiteral("Boot0001");
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(8, 'a'))), 0);
+    QCOMPARE(content(name), QByteArray("\x07\x00\x00\x00", 4) + QByteArray(8, 'a'));
+}
+
+void TestEfivarfsWrite::test_overwrite_in_place()
+{
+    const QString name = QStringLiteral("Boot0002");
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(8, 'a'))), 0);
+    QFile file(path(name));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(8, 'b'))), 0);
+    QEFIVariable variable = qefi_read_variable(m_guid, name);
+    QCOMPARE(variable.data(), QByteArray(8, 'b'));
+    QCOMPARE(variable.attributes(), (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    // The file was overwritten, not unlinked and re-created
+    QCOMPARE(file.readAll().mid(4), QByteArray(8, 'b'));
+}
+
+void TestEfivarfsWrite::test_overwrite_shrink()
+{
+    const QString name = QStringLiteral("Boot0003");
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(64, 'a'))), 0);
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(4, 'b'))), 0);
+    QCOMPARE(qefi_get_variable(m_guid, name), QByteArray(4, 'b'));
+}
+
+void TestEfivarfsWrite::test_write_large()
+{
+    // Larger than the stack buffer of the write path
+    const QString name = QStringLiteral("db");
+    QByteArray data(3 * 4096 + 17, 'x');
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, data)), 0);
+    QCOMPARE(qefi_get_variable(m_guid, name), data);
+}
+
+void TestEfivarfsWrite::test_append_new()
+{
+    // The first append creates the file with its Attributes field
+    const QString name = QStringLiteral("dbx");
+    const quint32 attributes = QEFI_VARIABLE_DEFAULT_ATTRIBUTES | QEFI_VARIABLE_APPEND_WRITE;
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(8, 'c'),
+        attributes)), 0);
+    QCOMPARE(content(name), QByteArray("\x07\x00\x00\x00", 4) + QByteArray(8, 'c'));
+
+    QCOMPARE(qefi_write_variable(QEFIVariable(m_guid, name, QByteArray(4, 'd'),
+        attributes)), 0);
+    QEFIVariable variable = qefi_read_variable(m_guid, name);
+    QCOMPARE(variable.data(), QByteArray(8, 'c') + QByteArray(4, 'd'));
+    QCOMPARE(variable.attributes(), (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+}
+
+void TestEfivarfsWrite::test_write_error()
+{
+    // A name with a path separator points into a missing directory
+    int error = qefi_write_variable(QEFIVariable(m_guid,
+        QStringLiteral("Missing/Boot0004"), QByteArray(2, 'a')));
+    QCOMPARE(error, -ENOENT);
+}
+
+QTEST_MAIN(TestEfivarfsWrite)
+
+#include "test_efivarfs_write.moc"
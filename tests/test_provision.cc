@@ -0,0 +1,159 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include <cerrno>
+
+#include "test_data.h"
+#include "../qefi.h"
+
+class TestProvision : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir m_dir;
+    QString m_template;
+    QUuid m_global;
+    QUuid m_vendor;
+private slots:
+    void initTestCase();
+    void test_provision();
+    void test_manifest();
+    void test_manifest_boot_order();
+    void test_no_space();
+};
+
+void TestProvision::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_global = QUuid::fromString(QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    m_vendor = QUuid::fromString(QLatin1String("605dab50-e046-4300-abb6-3dd810dd8b23"));
+
+    // A template with a boot entry of its own and vendor data to keep
+    m_template = m_dir.filePath(QStringLiteral("OVMF_VARS.fd"));
+    QCOMPARE(QEFIVarStoreBackend::create(m_template, 0x2000), 0);
+    QEFIVarStoreBackend store;
+    QCOMPARE(store.open(m_template, true), 0);
+    QCOMPARE(store.setVariable(m_global, QStringLiteral("Boot0000"),
+        QByteArray((const char *)test_boot_data2, TEST_BOOT_DATA2_LENGTH),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(store.setVariable(m_global, QStringLiteral("BootOrder"),
+        QByteArray("\x00\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(store.setVariable(m_vendor, QStringLiteral("VendorData"),
+        QByteArray(64, 'v'), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+}
+
+void TestProvision::test_provision()
+{
+    QEFIProvisioner provisioner;
+    QCOMPARE(provisioner.setTemplate(m_template), 0);
+
+    QEFILoadOption option(QByteArray((const char *)test_boot_data, TEST_BOOT_DATA_LENGTH));
+    QList<QEFIProvisionImage> images;
+    for (int i = 0; i < 32; i++) {
+        QEFIProvisionImage image(m_dir.filePath(QStringLiteral("vm%1.fd").arg(i)));
+        option.setName(QStringLiteral("VM %1").arg(i));
+        QVERIFY(image.addBootEntry(0x1a, option));
+        image.setBootOrder({ 0x1a });
+        images.append(image);
+    }
+
+    QList<int> errors = provisioner.provision(images);
+    QCOMPARE(errors.size(), images.size());
+    for (int i = 0; i < images.size(); i++) {
+        QCOMPARE(errors[i], 0);
+        QCOMPARE(QFileInfo(images[i].fileName()).size(), QFileInfo(m_template).size());
+
+        QEFIVarStoreBackend store;
+        QCOMPARE(store.open(images[i].fileName()), 0);
+        QByteArray data;
+        QCOMPARE(store.getVariable(m_global, QStringLiteral("Boot001A"), data), 0);
+        QCOMPARE(QEFILoadOption(data).name(), QStringLiteral("VM %1").arg(i));
+        QCOMPARE(store.getVariable(m_global, QStringLiteral("BootOrder"), data), 0);
+        QCOMPARE(data, QByteArray("\x1a\x00", 2));
+        QCOMPARE(store.getVariable(m_vendor, QStringLiteral("VendorData"), data), 0);
+        QCOMPARE(data, QByteArray(64, 'v'));
+        // The boot entry of the template is replaced
+        QCOMPARE(store.getVariable(m_global, QStringLiteral("Boot0000"), data), -ENOENT);
+    }
+
+    // The template is left as it was
+    QEFIVarStoreBackend store;
+    QCOMPARE(store.open(m_template), 0);
+    QByteArray data;
+    QCOMPARE(store.getVariable(m_global, QStringLiteral("Boot0000"), data), 0);
+}
+
+void TestProvision::test_manifest()
+{
+    const QString manifest = m_dir.filePath(QStringLiteral("manifest.json"));
+    QFile file(manifest);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    // rEFInd entry of the test data: a hard drive then a file path node
+    const QByteArray bootData((const char *)test_boot_data, TEST_BOOT_DATA_LENGTH);
+    const int pathOffset = 6 + qefi_loadopt_description_length(bootData) + 2;
+    const QByteArray devicePath = bootData.mid(pathOffset,
+        qefi_loadopt_dp_list_length(bootData));
+    file.write(QByteArray("{ \"images\": [ { \"file\": \"manifest-vm.fd\", "
+        "\"bootOrder\": [ 2, 1 ], \"entries\": [ "
+        "{ \"id\": 1, \"description\": \"Disk\", \"devicePath\": \"") +
+        devicePath.toHex() + QByteArray("\" }, "
+        "{ \"id\": 2, \"description\": \"Hidden\", \"devicePath\": \"") +
+        devicePath.toHex() + QByteArray("\", \"active\": false, "
+        "\"optionalData\": \"0102\" } ] } ] }"));
+    file.close();
+
+    QList<QEFIProvisionImage> images;
+    QCOMPARE(QEFIProvisioner::loadManifest(manifest, images), 0);
+    QCOMPARE(images.size(), 1);
+    QCOMPARE(images[0].fileName(), m_dir.filePath(QStringLiteral("manifest-vm.fd")));
+    QCOMPARE(images[0].bootEntries().size(), 2);
+    QCOMPARE(images[0].bootOrder(), QList<quint16>({ 2, 1 }));
+
+    QEFIProvisioner provisioner;
+    QCOMPARE(provisioner.setTemplate(m_template), 0);
+    QCOMPARE(provisioner.provision(images[0]), 0);
+
+    QEFIVarStoreBackend store;
+    QCOMPARE(store.open(images[0].fileName()), 0);
+    QByteArray data;
+    QCOMPARE(store.getVariable(m_global, QStringLiteral("Boot0002"), data), 0);
+    QEFILoadOption option(data);
+    QVERIFY(option.isValidated());
+    QCOMPARE(option.name(), QStringLiteral("Hidden"));
+    QVERIFY(!option.isVisible());
+    QCOMPARE(option.optionalData(), QByteArray("\x01\x02", 2));
+    QCOMPARE(store.getVariable(m_global, QStringLiteral("BootOrder"), data), 0);
+    QCOMPARE(data, QByteArray("\x02\x00\x01\x00", 4));
+}
+
+void TestProvision::test_manifest_boot_order()
+{
+    const QString manifest = m_dir.filePath(QStringLiteral("order.json"));
+    const QList<QByteArray> invalid = { "-1", "70000", "1.5", "\"0001\"", "null" };
+    for (const QByteArray &id : invalid) {
+        QFile file(manifest);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write("{ \"images\": [ { \"file\": \"order-vm.fd\", \"bootOrder\": [ 1, " +
+            id + " ] } ] }");
+        file.close();
+
+        QList<QEFIProvisionImage> images;
+        QCOMPARE(QEFIProvisioner::loadManifest(manifest, images), -EINVAL);
+    }
+}
+
+void TestProvision::test_no_space()
+{
+    QEFIProvisioner provisioner;
+    QEFIProvisionImage image(m_dir.filePath(QStringLiteral("large.fd")));
+    QCOMPARE(provisioner.provision(image), -EINVAL);
+    QCOMPARE(provisioner.setTemplate(m_template), 0);
+
+    QEFILoadOption option(QByteArray((const char *)test_boot_data, TEST_BOOT_DATA_LENGTH));
+    for (int i = 0; i < 0x100; i++) QVERIFY(image.addBootEntry(i, option));
+    QCOMPARE(provisioner.provision(image), -ENOSPC);
+}
+
+QTEST_MAIN(TestProvision)
+
+#include "test_provision.moc"
@@ -0,0 +1,136 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include "../qefi.h"
+
+// Fans out from a task of the library thread pool
+class TestFanOutTask : public QRunnable
+{
+    QEFIRootSet *m_set;
+    QUuid m_guid;
+    QAtomicInt *m_done;
+public:
+    TestFanOutTask(QEFIRootSet *set, const QUuid &guid, QAtomicInt *done)
+        : m_set(set), m_guid(guid), m_done(done) {}
+
+    void run() override
+    {
+        if (m_set->readVariable(m_guid, QStringLiteral("BootCurrent")).size() == 3)
+            m_done->fetchAndAddRelaxed(1);
+    }
+};
+
+class TestRootSet : public QObject
+{
+    Q_OBJECT
+private:
+    QUuid m_guid;
+    QTemporaryDir m_dirs[3];
+    QStringList m_roots;
+private slots:
+    void initTestCase();
+    void test_isolated_contexts();
+    void test_fan_out();
+    void test_remove_root();
+    void test_fan_out_from_pool();
+};
+
+void TestRootSet::initTestCase()
+{
+    m_guid = QUuid::fromString(QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    for (QTemporaryDir &dir : m_dirs) {
+        QVERIFY(dir.isValid());
+        m_roots.append(dir.path() + QLatin1Char('/'));
+    }
+}
+
+void TestRootSet::test_isolated_contexts()
+{
+    QEFIContext first(m_roots[0]);
+    QEFIContext second(m_roots[1]);
+    QCOMPARE(first.root(), m_roots[0]);
+
+    qefi_set_variable_uint16(first, m_guid, QStringLiteral("Timeout"), 1);
+    qefi_set_variable_uint16(second, m_guid, QStringLiteral("Timeout"), 2);
+    QCOMPARE(qefi_get_variable_uint16(first, m_guid, QStringLiteral("Timeout")), (quint16)1);
+    QCOMPARE(qefi_get_variable_uint16(second, m_guid, QStringLiteral("Timeout")), (quint16)2);
+
+    // A write skipped in one context is still done in the other
+    const QEFIVariable timeout(m_guid, QStringLiteral("Timeout"), QByteArray("\x01\x00", 2));
+    QCOMPARE(qefi_write_variable_if_changed(first, timeout), 0);
+    QCOMPARE(qefi_write_variable_if_changed(second, timeout), 0);
+    QCOMPARE(first.writeCounters().skipped, (quint64)1);
+    QCOMPARE(first.writeCounters().performed, (quint64)0);
+    QCOMPARE(second.writeCounters().skipped, (quint64)0);
+    QCOMPARE(second.writeCounters().performed, (quint64)1);
+    QCOMPARE(qefi_get_variable_uint16(second, m_guid, QStringLiteral("Timeout")), (quint16)1);
+
+    QCOMPARE(qefi_delete_variable(first, m_guid, QStringLiteral("Timeout")), 0);
+    QCOMPARE(qefi_delete_variable(second, m_guid, QStringLiteral("Timeout")), 0);
+}
+
+void TestRootSet::test_fan_out()
+{
+    QEFIRootSet set;
+    for (int i = 0; i < m_roots.size(); i++) {
+        QSharedPointer<QEFIContext> context = set.addRoot(m_roots[i]);
+        QCOMPARE(set.addRoot(m_roots[i]), context);
+        qefi_set_variable_uint16(*context, m_guid, QStringLiteral("BootCurrent"), i);
+        for (int j = 0; j <= i; j++) {
+            qefi_set_variable_uint16(*context, m_guid,
+                QStringLiteral("Boot000%1").arg(j), j);
+        }
+    }
+    QCOMPARE(set.roots().size(), m_roots.size());
+
+    const QMap<QString, QList<QEFIVariableKey> > lists =
+        set.listVariables(&m_guid, QStringLiteral("Boot0"));
+    QCOMPARE(lists.size(), m_roots.size());
+    for (int i = 0; i < m_roots.size(); i++)
+        QCOMPARE(lists.value(m_roots[i]).size(), i + 1);
+
+    const QMap<QString, QEFIVariable> current =
+        set.readVariable(m_guid, QStringLiteral("BootCurrent"));
+    for (int i = 0; i < m_roots.size(); i++)
+        QCOMPARE(current.value(m_roots[i]).data(), QByteArray(1, (char)i) + QByteArray(1, '\0'));
+
+    QList<QEFIVariableKey> keys;
+    keys << QEFIVariableKey(m_guid, QStringLiteral("Boot0000"))
+         << QEFIVariableKey(m_guid, QStringLiteral("Boot0002"));
+    const QMap<QString, QList<QEFIVariable> > values = set.readVariables(keys);
+    QCOMPARE(values.value(m_roots[0]).size(), 2);
+    QVERIFY(!values.value(m_roots[0])[0].isNull());
+    QVERIFY(values.value(m_roots[0])[1].isNull());
+    QVERIFY(!values.value(m_roots[2])[1].isNull());
+}
+
+void TestRootSet::test_remove_root()
+{
+    QEFIRootSet set;
+    QSharedPointer<QEFIContext> context = set.addRoot(m_roots[0]);
+    set.addRoot(m_roots[1]);
+    set.removeRoot(m_roots[0]);
+
+    QCOMPARE(set.roots(), QStringList(m_roots[1]));
+    QVERIFY(set.context(m_roots[0]).isNull());
+    // Still usable by whoever holds it
+    QCOMPARE(context->root(), m_roots[0]);
+    QCOMPARE(set.readVariable(m_guid, QStringLiteral("BootCurrent")).size(), 1);
+}
+
+void TestRootSet::test_fan_out_from_pool()
+{
+    QEFIRootSet set;
+    for (const QString &root : std::as_const(m_roots)) set.addRoot(root);
+
+    // Every thread of the pool waits on its fan out
+    QAtomicInt done(0);
+    for (int i = 0; i < QEFI_ASYNC_MAX_THREADS; i++)
+        qefi_thread_pool()->start(new TestFanOutTask(&set, m_guid, &done));
+    QVERIFY(qefi_thread_pool()->waitForDone(10000));
+    QCOMPARE(done.loadAcquire(), QEFI_ASYNC_MAX_THREADS);
+}
+
+QTEST_MAIN(TestRootSet)
+
+#include "test_root_set.moc"
@@ -0,0 +1,193 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <atomic>
+
+#include "../qefi.h"
+
+class TestSharedSnapshot : public QObject
+{
+    Q_OBJECT
+private:
+    QUuid m_guid;
+    QTemporaryDir m_dir;
+    QString m_fileName;
+private slots:
+    void initTestCase();
+    void test_publish();
+    void test_read_only();
+    void test_capacity();
+    void test_concurrent_publish();
+    void test_dead_publisher();
+};
+
+void TestSharedSnapshot::initTestCase()
+{
+    m_guid = QUuid::fromString(QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QVERIFY(m_dir.isValid());
+    m_fileName = m_dir.filePath(QStringLiteral("snapshot"));
+}
+
+void TestSharedSnapshot::test_publish()
+{
+    QEFIMemoryBackend source;
+    source.setVariable(m_guid, QStringLiteral("BootCurrent"), QByteArray("\x01\x00", 2),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    source.setVariable(m_guid, QStringLiteral("Timeout"), QByteArray("\x05\x00", 2),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+
+    QEFISharedSnapshotPublisher publisher(&source);
+    QCOMPARE(publisher.create(m_fileName), 0);
+    QList<QEFIVariableKey> keys;
+    keys << QEFIVariableKey(m_guid, QStringLiteral("BootCurrent"))
+         << QEFIVariableKey(m_guid, QStringLiteral("Timeout"))
+         << QEFIVariableKey(m_guid, QStringLiteral("Missing"));
+    publisher.setKeys(keys);
+    QCOMPARE(publisher.publish(), 0);
+
+    QEFISharedSnapshotBackend reader(m_fileName);
+    QVERIFY(reader.isOpen());
+    QCOMPARE(reader.sequence(), publisher.sequence());
+    const quint32 sequence = reader.sequence();
+    QCOMPARE(sequence % 2, (quint32)0);
+
+    QByteArray data;
+    quint32 attributes = 0;
+    QCOMPARE(reader.getVariable(m_guid, QStringLiteral("BootCurrent"), data, &attributes), 0);
+    QCOMPARE(data, QByteArray("\x01\x00", 2));
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    QCOMPARE(reader.getVariable(m_guid, QStringLiteral("Missing"), data), -ENOENT);
+
+    char buffer[1];
+    size_t size = 0;
+    QCOMPARE(reader.getVariableInto(m_guid, QStringLiteral("Timeout"),
+        buffer, sizeof(buffer), &size), 0);
+    QCOMPARE(size, (size_t)2);
+    QCOMPARE(buffer[0], '\x05');
+
+    QList<QEFIVariableKey> listed;
+    QList<quint64> sizes;
+    QCOMPARE(reader.listVariables(listed, &sizes), 0);
+    QCOMPARE(listed.size(), 2);
+    QCOMPARE(listed[0], keys[0]);
+    QCOMPARE(sizes[1], (quint64)2);
+
+    // Readers see the next publish without reopening
+    source.setVariable(m_guid, QStringLiteral("Timeout"), QByteArray("\x0a\x00", 2),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    QCOMPARE(publisher.publish(), 0);
+    QCOMPARE(reader.sequence(), sequence + 2);
+    QCOMPARE(reader.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(data, QByteArray("\x0a\x00", 2));
+}
+
+void TestSharedSnapshot::test_read_only()
+{
+    QEFISharedSnapshotBackend reader(m_fileName);
+    QVERIFY(reader.isOpen());
+    QVERIFY(!reader.hasPrivilege());
+    QCOMPARE(reader.setVariable(m_guid, QStringLiteral("Timeout"), QByteArray(2, '\0'),
+        QEFI_VARIABLE_DEFAULT_ATTRIBUTES), -EROFS);
+    QCOMPARE(reader.deleteVariable(m_guid, QStringLiteral("Timeout")), -EROFS);
+
+    QEFISharedSnapshotBackend missing;
+    QCOMPARE(missing.open(m_dir.filePath(QStringLiteral("missing"))), -ENOENT);
+    QVERIFY(!missing.isAvailable());
+}
+
+void TestSharedSnapshot::test_capacity()
+{
+    const QString fileName = m_dir.filePath(QStringLiteral("small"));
+    QEFISharedSnapshotPublisher publisher;
+    QCOMPARE(publisher.create(fileName, 256), 0);
+
+    QList<QEFIVariable> variables;
+    variables << QEFIVariable(m_guid, QStringLiteral("Small"), QByteArray(16, 'a'));
+    QCOMPARE(publisher.publish(variables), 0);
+    const quint32 sequence = publisher.sequence();
+
+    // Nothing is published when it does not fit
+    variables << QEFIVariable(m_guid, QStringLiteral("Large"), QByteArray(512, 'b'));
+    QCOMPARE(publisher.publish(variables), -ENOSPC);
+    QCOMPARE(publisher.sequence(), sequence);
+
+    QEFISharedSnapshotBackend reader(fileName);
+    quint64 size = 0;
+    QCOMPARE(reader.variableSize(m_guid, QStringLiteral("Small"), &size), 0);
+    QCOMPARE(size, (quint64)16);
+    QCOMPARE(reader.variableSize(m_guid, QStringLiteral("Large"), &size), -ENOENT);
+}
+
+void TestSharedSnapshot::test_concurrent_publish()
+{
+    const QString fileName = m_dir.filePath(QStringLiteral("concurrent"));
+    QEFISharedSnapshotPublisher publisher;
+    QCOMPARE(publisher.create(fileName), 0);
+    QList<QEFIVariable> variables;
+    variables << QEFIVariable(m_guid, QStringLiteral("Counter"), QByteArray(64, '\0'));
+    QCOMPARE(publisher.publish(variables), 0);
+
+    std::atomic<bool> done(false);
+    QThread *thread = QThread::create([&]() {
+        for (int i = 1; i < 10000; i++) {
+            variables[0].setData(QByteArray(64, (char)i));
+            publisher.publish(variables);
+        }
+        done.store(true);
+    });
+    thread->start();
+
+    // Every read is a whole publish, never a mix of two
+    QEFISharedSnapshotBackend reader(fileName);
+    char buffer[64];
+    int reads = 0;
+    while (!done.load()) {
+        size_t size = 0;
+        QCOMPARE(reader.getVariableInto(m_guid, QStringLiteral("Counter"),
+            buffer, sizeof(buffer), &size), 0);
+        QCOMPARE(size, sizeof(buffer));
+        QCOMPARE(QByteArray(buffer, sizeof(buffer)), QByteArray(64, buffer[0]));
+        reads++;
+    }
+    thread->wait();
+    delete thread;
+    QVERIFY(reads > 0);
+}
+
+void TestSharedSnapshot::test_dead_publisher()
+{
+    const QString fileName = m_dir.filePath(QStringLiteral("dead"));
+    QList<QEFIVariable> variables;
+    variables << QEFIVariable(m_guid, QStringLiteral("Timeout"), QByteArray("\x05\x00", 2));
+    {
+        QEFISharedSnapshotPublisher publisher;
+        QCOMPARE(publisher.create(fileName), 0);
+        QCOMPARE(publisher.publish(variables), 0);
+    }
+
+    // Left odd by a publisher killed in the middle of a publish
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.seek(8));
+    QCOMPARE(file.write("\x05\x00\x00\x00", 4), (qint64)4);
+    file.close();
+
+    QEFISharedSnapshotPublisher publisher;
+    QCOMPARE(publisher.create(fileName), 0);
+    QCOMPARE(publisher.sequence(), (quint32)6);
+
+    // The torn entries are gone rather than served
+    QEFISharedSnapshotBackend reader(fileName);
+    QByteArray data;
+    QCOMPARE(reader.getVariable(m_guid, QStringLiteral("Timeout"), data), -ENOENT);
+
+    QCOMPARE(publisher.publish(variables), 0);
+    QCOMPARE(reader.sequence(), (quint32)8);
+    QCOMPARE(reader.getVariable(m_guid, QStringLiteral("Timeout"), data), 0);
+    QCOMPARE(data, QByteArray("\x05\x00", 2));
+}
+
+QTEST_MAIN(TestSharedSnapshot)
+
+#include "test_shared_snapshot.moc"
@@ -0,0 +1,107 @@
+#include <QtTest/QtTest>
+
+#include "../qefi.h"
+
+class TestVariableSnapshot : public QObject
+{
+    Q_OBJECT
+private slots:
+    void test_snapshot_lookup();
+    void test_snapshot_shared_arena();
+    void test_snapshot_load();
+};
+
+void TestVariableSnapshot::test_snapshot_lookup()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QUuid vendor = QUuid::fromString(
+        QLatin1String("605dab50-e046-4300-abb6-3dd810dd8b23"));
+
+    QList<QEFIVariable> variables;
+    variables.append(QEFIVariable(global, QStringLiteral("Timeout"),
+        QByteArray("\x05\x00", 2)));
+    variables.append(QEFIVariable(global, QStringLiteral("BootOrder"),
+        QByteArray("\x01\x00\x02\x00", 4)));
+    variables.append(QEFIVariable(vendor, QStringLiteral("MokListRT"),
+        QByteArray(64, 'x'), QEFI_VARIABLE_BOOTSERVICE_ACCESS));
+    variables.append(QEFIVariable());
+
+    QEFIVariableSnapshot snapshot = QEFIVariableSnapshot::fromVariables(variables);
+    QCOMPARE(snapshot.size(), 3);
+    QVERIFY(snapshot.contains(global, QStringLiteral("BootOrder")));
+    QVERIFY(!snapshot.contains(vendor, QStringLiteral("BootOrder")));
+    QVERIFY(!snapshot.contains(global, QStringLiteral("BootNext")));
+
+    QCOMPARE(snapshot.valueUint16(global, QStringLiteral("Timeout")), (quint16)5);
+    QCOMPARE(snapshot.value(global, QStringLiteral("BootOrder")),
+        QByteArray("\x01\x00\x02\x00", 4));
+
+    int size = 0;
+    quint32 attributes = 0;
+    const char *data = snapshot.constData(vendor, QStringLiteral("MokListRT"),
+        &size, &attributes);
+    QVERIFY(data != nullptr);
+    QCOMPARE(size, 64);
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_BOOTSERVICE_ACCESS);
+    QCOMPARE(QByteArray(data, size), QByteArray(64, 'x'));
+
+    QVERIFY(snapshot.constData(vendor, QStringLiteral("Missing"), &size) == nullptr);
+    QCOMPARE(snapshot.keys().size(), 3);
+}
+
+void TestVariableSnapshot::test_snapshot_shared_arena()
+{
+    QList<QEFIVariable> variables;
+    for (int i = 0; i < 100; i++) {
+        variables.append(QEFIVariable(QUuid(),
+            QStringLiteral("Boot%1").arg(i, 4, 16, QLatin1Char('0')),
+            QByteArray(8, (char)i)));
+    }
+    QEFIVariableSnapshot snapshot = QEFIVariableSnapshot::fromVariables(variables);
+    QEFIVariableSnapshot copy = snapshot;
+
+    // Payloads are laid back to back in the same arena
+    int size;
+    const char *first = snapshot.constData(QUuid(), QStringLiteral("Boot0000"), &size);
+    const char *second = copy.constData(QUuid(), QStringLiteral("Boot0001"), &size);
+    QCOMPARE(second - first, (qptrdiff)8);
+    QCOMPARE(copy.value(QUuid(), QStringLiteral("Boot0063")), QByteArray(8, (char)0x63));
+}
+
+void TestVariableSnapshot::test_snapshot_load()
+{
+    QUuid global = QUuid::fromString(
+        QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    QUuid vendor = QUuid::fromString(
+        QLatin1String("605dab50-e046-4300-abb6-3dd810dd8b23"));
+    QEFIMemoryBackend backend;
+    backend.setVariable(global, QStringLiteral("BootOrder"),
+        QByteArray("\x01\x00\x02\x00", 4), QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    backend.setVariable(global, QStringLiteral("Timeout"),
+        QByteArray("\x05\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    backend.setVariable(vendor, QStringLiteral("MokListRT"),
+        QByteArray(64, 'x'), QEFI_VARIABLE_BOOTSERVICE_ACCESS);
+    qefi_set_default_backend(&backend);
+
+    QEFIVariableSnapshot all = QEFIVariableSnapshot::load();
+    QCOMPARE(all.size(), 3);
+    QCOMPARE(all.valueUint16(global, QStringLiteral("Timeout")), (quint16)5);
+
+    QList<QUuid> guids;
+    guids.append(vendor);
+    QEFIVariableSnapshot filtered = QEFIVariableSnapshot::load(guids);
+    QCOMPARE(filtered.size(), 1);
+    QVERIFY(filtered.contains(vendor, QStringLiteral("MokListRT")));
+
+    // The value is still valid once the snapshot is gone
+    const QByteArray order = QEFIVariableSnapshot::load().value(global,
+        QStringLiteral("BootOrder"));
+    QCOMPARE(order, QByteArray("\x01\x00\x02\x00", 4));
+
+    qefi_set_default_backend(nullptr);
+}
+
+QTEST_MAIN(TestVariableSnapshot)
+
+#include "test_variable_snapshot.moc"
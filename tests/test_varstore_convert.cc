@@ -0,0 +1,229 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QtEndian>
+
+#include <cerrno>
+
+#include "test_data.h"
+#include "../qefi.h"
+
+class TestVarStoreConvert : public QObject
+{
+    Q_OBJECT
+private:
+    QUuid m_global;
+    QUuid m_vendor;
+    QByteArray m_bootData;
+
+    void fill(QEFIBackend &variables);
+    void compare(QEFIBackend &variables);
+private slots:
+    void initTestCase();
+    void test_json_round_trip();
+    void test_edk2_round_trip();
+    void test_pretty_json();
+    void test_aws_round_trip();
+    void test_unsupported();
+    void test_bulk_convert();
+};
+
+void TestVarStoreConvert::initTestCase()
+{
+    m_global = QUuid::fromString(QLatin1String("8be4df61-93ca-11d2-aa0d-00e098032c8c"));
+    m_vendor = QUuid::fromString(QLatin1String("605dab50-e046-4300-abb6-3dd810dd8b23"));
+    m_bootData = QByteArray((const char *)test_boot_data, TEST_BOOT_DATA_LENGTH);
+}
+
+void TestVarStoreConvert::fill(QEFIBackend &variables)
+{
+    QCOMPARE(variables.setVariable(m_global, QStringLiteral("Boot0001"),
+        m_bootData, QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(variables.setVariable(m_global, QStringLiteral("BootOrder"),
+        QByteArray("\x01\x00", 2), QEFI_VARIABLE_DEFAULT_ATTRIBUTES), 0);
+    QCOMPARE(variables.setVariable(m_vendor, QStringLiteral("VendorData"),
+        QByteArray(5, 'v'), QEFI_VARIABLE_NON_VOLATILE | QEFI_VARIABLE_BOOTSERVICE_ACCESS), 0);
+}
+
+void TestVarStoreConvert::compare(QEFIBackend &variables)
+{
+    QList<QEFIVariableKey> keys;
+    QCOMPARE(variables.listVariables(keys), 0);
+    QCOMPARE(keys.size(), 3);
+
+    QByteArray data;
+    quint32 attributes = 0;
+    QCOMPARE(variables.getVariable(m_global, QStringLiteral("Boot0001"), data, &attributes), 0);
+    QCOMPARE(data, m_bootData);
+    QCOMPARE(attributes, (quint32)QEFI_VARIABLE_DEFAULT_ATTRIBUTES);
+    QCOMPARE(variables.getVariable(m_vendor, QStringLiteral("VendorData"), data, &attributes), 0);
+    QCOMPARE(data, QByteArray(5, 'v'));
+    QCOMPARE(attributes, (quint32)(QEFI_VARIABLE_NON_VOLATILE | QEFI_VARIABLE_BOOTSERVICE_ACCESS));
+}
+
+void TestVarStoreConvert::test_json_round_trip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("vars.json"));
+
+    QEFIMemoryBackend variables;
+    fill(variables);
+    QCOMPARE(qefi_varstore_export(variables, fileName, VARSTORE_Json), 0);
+    QCOMPARE(qefi_varstore_format(fileName), VARSTORE_Json);
+
+    QEFIMemoryBackend loaded;
+    QCOMPARE(qefi_varstore_import(fileName, loaded), 0);
+    compare(loaded);
+}
+
+void TestVarStoreConvert::test_edk2_round_trip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString json = dir.filePath(QStringLiteral("vars.json"));
+    const QString fd = dir.filePath(QStringLiteral("VARS.fd"));
+
+    QEFIMemoryBackend variables;
+    fill(variables);
+    QCOMPARE(qefi_varstore_export(variables, json, VARSTORE_Json), 0);
+    QCOMPARE(qefi_varstore_convert(json, fd, VARSTORE_Edk2), 0);
+    QCOMPARE(qefi_varstore_format(fd), VARSTORE_Edk2);
+
+    QEFIMemoryBackend loaded;
+    QCOMPARE(qefi_varstore_import(fd, loaded), 0);
+    compare(loaded);
+}
+
+void TestVarStoreConvert::test_pretty_json()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("vars.json"));
+
+    QEFIMemoryBackend variables;
+    fill(variables);
+    QCOMPARE(qefi_varstore_export(variables, fileName, VARSTORE_Json,
+        QEFI_VARSTORE_PRETTY), 0);
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray json = file.readAll();
+    QVERIFY(json.contains('\n'));
+    QVERIFY(json.contains(QByteArray("\"description\": \"") + test_boot_name));
+
+    // The extra keys do not get in the way of a reload
+    QEFIMemoryBackend loaded;
+    QCOMPARE(qefi_varstore_import(fileName, loaded), 0);
+    compare(loaded);
+}
+
+void TestVarStoreConvert::test_aws_round_trip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("uefi-data"));
+    const QString fd = dir.filePath(QStringLiteral("VARS.fd"));
+
+    QEFIMemoryBackend variables;
+    fill(variables);
+    QCOMPARE(qefi_varstore_export(variables, fileName, VARSTORE_AwsBlob), 0);
+    QCOMPARE(qefi_varstore_format(fileName), VARSTORE_AwsBlob);
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray blob = QByteArray::fromBase64(file.readAll());
+    file.close();
+    QVERIFY(blob.startsWith("AMZNUEFI"));
+
+    QEFIMemoryBackend loaded;
+    QCOMPARE(qefi_varstore_import(fileName, loaded), 0);
+    compare(loaded);
+
+    // The raw blob is accepted as well, and converts to an image
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(blob);
+    file.close();
+    QCOMPARE(qefi_varstore_convert(fileName, fd, VARSTORE_Edk2), 0);
+    QEFIMemoryBackend converted;
+    QCOMPARE(qefi_varstore_import(fd, converted), 0);
+    compare(converted);
+
+    // A flipped byte fails the CRC
+    QByteArray corrupted = blob;
+    corrupted[corrupted.size() - 1] = ~corrupted[corrupted.size() - 1];
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(corrupted.toBase64());
+    file.close();
+    QEFIMemoryBackend rejected;
+    QCOMPARE(qefi_varstore_import(fileName, rejected), -EINVAL);
+}
+
+void TestVarStoreConvert::test_unsupported()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("uefi-data"));
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(QByteArray("AMZNUEFI").toBase64());
+    file.close();
+
+    QEFIMemoryBackend variables;
+    QCOMPARE(qefi_varstore_format(fileName), VARSTORE_AwsBlob);
+    QCOMPARE(qefi_varstore_import(fileName, variables), -EINVAL);
+
+    // A zlib stream that asks for a preset dictionary, 0x78 0xbb
+    QByteArray blob("AMZNUEFI\0\0\0\0\0\0\0\0\x78\xbb\0\0\0\0", 22);
+    quint32 crc = 0xffffffff;
+    for (int i = 12; i < blob.size(); i++) {
+        crc ^= (uchar)blob[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    qToLittleEndian<quint32>(~crc, blob.data() + 8);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(blob);
+    file.close();
+    QCOMPARE(qefi_varstore_import(fileName, variables), -ENOTSUP);
+
+    QCOMPARE(qefi_varstore_export(variables, fileName, VARSTORE_Unknown), -EINVAL);
+    QCOMPARE(qefi_varstore_import(dir.filePath(QStringLiteral("missing")), variables), -ENOENT);
+}
+
+void TestVarStoreConvert::test_bulk_convert()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(QDir(dir.path()).mkdir(QStringLiteral("out")));
+
+    QEFIMemoryBackend variables;
+    fill(variables);
+    QStringList inputs;
+    for (int i = 0; i < 8; i++) {
+        inputs.append(dir.filePath(QStringLiteral("vm%1.json").arg(i)));
+        QCOMPARE(qefi_varstore_export(variables, inputs.last(), VARSTORE_Json), 0);
+    }
+    inputs.append(dir.filePath(QStringLiteral("missing.json")));
+    // Same base name as the first one
+    QVERIFY(QDir(dir.path()).mkdir(QStringLiteral("other")));
+    inputs.append(dir.filePath(QStringLiteral("other/vm0.json")));
+    QCOMPARE(qefi_varstore_export(variables, inputs.last(), VARSTORE_Json), 0);
+
+    QList<int> errors = qefi_varstore_convert(inputs,
+        dir.filePath(QStringLiteral("out")), VARSTORE_Edk2);
+    QCOMPARE(errors.size(), inputs.size());
+    QCOMPARE(errors[8], -ENOENT);
+    QCOMPARE(errors.last(), -EEXIST);
+    for (int i = 0; i < 8; i++) {
+        QCOMPARE(errors[i], 0);
+        QEFIMemoryBackend loaded;
+        QCOMPARE(qefi_varstore_import(dir.filePath(
+            QStringLiteral("out/vm%1.fd").arg(i)), loaded), 0);
+        compare(loaded);
+    }
+}
+
+QTEST_MAIN(TestVarStoreConvert)
+
+#include "test_varstore_convert.moc"